@@ -0,0 +1,219 @@
+// Compares the two JSON encoders of bulkDNS on synthetic answers:
+//   sdns_from_wire() + sdns_json_dns_string()  (the default output)
+//   dnswire_parse() + jsonenc_message()        ('--fast-json')
+// It prints the time per record of both and the number of records where
+// the two outputs are not byte-identical.
+//
+// make bench && ./bin/json_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sdns.h>
+#include <sdns_json.h>
+#include <dnswire.h>
+#include <jsonenc.h>
+
+#define BENCH_DEFAULT_ITERATIONS 200000
+#define BENCH_MAX_MSG 512
+#define BENCH_MAX_MESSAGES 32
+
+struct _bench_msg{
+    const char * label;
+    char wire[BENCH_MAX_MSG];
+    size_t len;
+};
+
+typedef struct _bench_msg bench_msg;
+
+static uint64_t bench_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_put(bench_msg * m, const void * data, size_t len){
+    memcpy(m->wire + m->len, data, len);
+    m->len += len;
+}
+
+static void bench_u16(bench_msg * m, uint16_t value){
+    uint8_t b[2] = {value >> 8, value & 0xFF};
+    bench_put(m, b, 2);
+}
+
+static void bench_u32(bench_msg * m, uint32_t value){
+    bench_u16(m, value >> 16);
+    bench_u16(m, value & 0xFFFF);
+}
+
+// header + question 'www.example.com' (offset 12), 'ancount' answers
+static void bench_start(bench_msg * m, const char * label, uint16_t qtype, uint16_t ancount){
+    static const char qname[] = "\3www\7example\3com";
+    memset(m, 0, sizeof(bench_msg));
+    m->label = label;
+    bench_u16(m, 0x1234);
+    bench_u16(m, 0x8180);
+    bench_u16(m, 1);
+    bench_u16(m, ancount);
+    bench_u16(m, 0);
+    bench_u16(m, 0);
+    bench_put(m, qname, sizeof(qname));
+    bench_u16(m, qtype);
+    bench_u16(m, 1);
+}
+
+// an answer owned by the qname (compression pointer to offset 12)
+static void bench_rr(bench_msg * m, uint16_t type, const void * rdata, uint16_t rdlen){
+    bench_u16(m, 0xC00C);
+    bench_u16(m, type);
+    bench_u16(m, 1);
+    bench_u32(m, 3600);
+    bench_u16(m, rdlen);
+    bench_put(m, rdata, rdlen);
+}
+
+// the OPT record of EDNS0 in the additional section
+static void bench_opt(bench_msg * m, const void * rdata, uint16_t rdlen){
+    uint8_t root = 0;
+    bench_put(m, &root, 1);
+    bench_u16(m, 41);
+    bench_u16(m, 1232);         // UDP payload size
+    bench_u32(m, 0x00008000);   // DO
+    bench_u16(m, rdlen);
+    bench_put(m, rdata, rdlen);
+    m->wire[11] += 1;           // arcount
+}
+
+static int bench_messages(bench_msg * list){
+    int n = 0;
+    bench_start(&list[n], "A x2", 1, 2);
+    bench_rr(&list[n], 1, "\x5d\xb8\xd8\x22", 4);
+    bench_rr(&list[n], 1, "\x5d\xb8\xd8\x23", 4);
+    n++;
+    bench_start(&list[n], "AAAA", 28, 1);
+    bench_rr(&list[n], 28, "\x26\x06\x28\x00\x02\x20\x00\x01\x02\x48\x18\x93\x25\xc8\x19\x46", 16);
+    n++;
+    bench_start(&list[n], "MX", 15, 1);
+    bench_rr(&list[n], 15, "\x00\x0a\x04mail\xc0\x10", 9);
+    n++;
+    bench_start(&list[n], "CNAME", 5, 1);
+    bench_rr(&list[n], 5, "\x03""cdn\x07""example\x03net\x00", 17);
+    n++;
+    bench_start(&list[n], "TXT", 16, 1);
+    bench_rr(&list[n], 16, "\x0fv=spf1 -all \"x\"\x05hello", 22);
+    n++;
+    bench_start(&list[n], "SOA", 6, 1);
+    bench_rr(&list[n], 6, "\x02ns\xc0\x10\x05""admin\xc0\x10"
+                          "\x78\x49\x3a\x01\x00\x00\x1c\x20\x00\x00\x0e\x10\x00\x12\x75\x00\x00\x00\x0e\x10", 33);
+    n++;
+    // the escaping: control characters, DEL, '/', '"' and '\'
+    bench_start(&list[n], "TXT control", 16, 1);
+    bench_rr(&list[n], 16, "\x0e""a\x01\x1f\x7f\b\f\n\r\t/\"\\z\x00", 15);
+    n++;
+    // valid UTF-8 is written as it is, the other strings are left out
+    bench_start(&list[n], "TXT high bytes", 16, 1);
+    bench_rr(&list[n], 16, "\x05\xc3\xa9t\xc3\xa9\x03\xff\xfe!\x04\xf0\x9f\x98\x80\x02\xc0\xaf\x03\xed\xa0\x80", 22);
+    n++;
+    bench_start(&list[n], "CNAME high bytes", 5, 1);
+    bench_rr(&list[n], 5, "\x04\xc3\xa9t\x01\x03""a\x1f""b\x07""example\x00", 18);
+    n++;
+    bench_start(&list[n], "CNAME invalid UTF-8", 5, 1);
+    bench_rr(&list[n], 5, "\x02\xff\xfe\x07""example\x00", 12);
+    n++;
+    bench_start(&list[n], "HINFO", 13, 1);
+    bench_rr(&list[n], 13, "\x05Intel\x05Linux", 12);
+    n++;
+    bench_start(&list[n], "SRV", 33, 1);
+    bench_rr(&list[n], 33, "\x00\x0a\x00\x3c\x13\xc4\x03sip\xc0\x10", 12);
+    n++;
+    bench_start(&list[n], "RRSIG", 46, 1);
+    bench_rr(&list[n], 46, "\x00\x01\x0d\x03\x00\x00\x0e\x10\x65\x00\x00\x00\x64\x00\x00\x00\x30\x39"
+                           "\xc0\x10\xde\xad\xbe\xef\x01\x02", 26);
+    n++;
+    bench_start(&list[n], "CAA", 257, 2);
+    bench_rr(&list[n], 257, "\x00\x05issueletsencrypt.org", 22);
+    bench_rr(&list[n], 257, "\x80\x05iodefmailto:a\tb\x7f", 18);
+    n++;
+    bench_start(&list[n], "CAA high bytes", 257, 2);
+    bench_rr(&list[n], 257, "\x00\x05issue\xc3\xa9", 9);
+    bench_rr(&list[n], 257, "\x00\x02\xff\xfe\xff", 5);
+    n++;
+    bench_start(&list[n], "OPT", 1, 1);
+    bench_rr(&list[n], 1, "\x5d\xb8\xd8\x22", 4);
+    bench_opt(&list[n], "\x00\x03\x00\x04""abcd\x00\x0a\x00\x00", 12);
+    n++;
+    bench_start(&list[n], "OPT empty", 1, 0);
+    bench_opt(&list[n], "", 0);
+    n++;
+    bench_start(&list[n], "unknown type", 65280, 1);
+    bench_rr(&list[n], 65280, "\x00\x01\xfe\xff", 4);
+    n++;
+    return n;
+}
+
+static char * bench_sdns(bench_msg * m){
+    sdns_context * ctx = sdns_init_context();
+    if (ctx == NULL)
+        return NULL;
+    ctx->raw = m->wire;
+    ctx->raw_len = m->len;
+    char * out = NULL;
+    if (sdns_from_wire(ctx) == 0)
+        out = sdns_json_dns_string(ctx);
+    ctx->raw = NULL;
+    sdns_free_context(ctx);
+    return out;
+}
+
+static int bench_fast(bench_msg * m, jsonenc_buf * buf){
+    dnswire_msg wire;
+    buf->len = 0;
+    if (dnswire_parse(m->wire, m->len, &wire) != 0)
+        return 1;
+    if (jsonenc_message(buf, m->wire, m->len, &wire) != 0)
+        return 1;
+    return jsonenc_append(buf, "", 1);     // NUL for the comparison
+}
+
+int main(int argc, char ** argv){
+    long int iterations = argc > 1?atol(argv[1]):BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0){
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    bench_msg list[BENCH_MAX_MESSAGES];
+    int count = bench_messages(list);
+    jsonenc_buf buf;
+    if (jsonenc_init(&buf) != 0)
+        return 1;
+    // byte-identity check
+    int mismatch = 0;
+    for (int i=0; i<count; ++i){
+        char * ref = bench_sdns(&list[i]);
+        int res = bench_fast(&list[i], &buf);
+        if (ref == NULL || res != 0 || strcmp(ref, buf.mem) != 0){
+            mismatch++;
+            fprintf(stderr, "mismatch (%s):\n  sdns: %s\n  fast: %s\n", list[i].label,
+                    ref?ref:"(error)", res == 0?buf.mem:"(error)");
+        }
+        free(ref);
+    }
+    uint64_t start = bench_now_ns();
+    for (long int k=0; k<iterations; ++k)
+        free(bench_sdns(&list[k % count]));
+    uint64_t sdns_ns = bench_now_ns() - start;
+    start = bench_now_ns();
+    for (long int k=0; k<iterations; ++k)
+        bench_fast(&list[k % count], &buf);
+    uint64_t fast_ns = bench_now_ns() - start;
+    jsonenc_free(&buf);
+    printf("records: %ld\n", iterations);
+    printf("sdns+jansson: %.1f ns/record\n", (double)sdns_ns / iterations);
+    printf("fast-json:    %.1f ns/record (%.2fx)\n", (double)fast_ns / iterations,
+           fast_ns > 0?(double)sdns_ns / fast_ns:0.0);
+    printf("mismatches:   %d of %d messages\n", mismatch, count);
+    return mismatch == 0?0:1;
+}
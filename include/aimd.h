@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+#ifndef AIMD_H
+#define AIMD_H
+
+#define AIMD_LOSS_LIMIT 0.02        // decrease when more than 2% of an epoch timed out
+#define AIMD_RTT_LIMIT 2.0          // or when the RTT of an epoch is twice the best one
+#define AIMD_RTT_MIN_SPIKE 5000     // ... and at least 5ms more (ignore the jitter of tiny RTTs)
+#define AIMD_DECREASE 0.5           // multiplicative decrease factor
+#define AIMD_INCREASE 1             // additive increase per epoch
+#define AIMD_MIN_EPOCH 16           // an epoch is never shorter than this (small windows are noisy)
+
+// Additive-increase/multiplicative-decrease controller of the number
+// of in-flight queries. An epoch is 'window' finished queries (about
+// one round trip of the whole window), at least AIMD_MIN_EPOCH. At the
+// end of each epoch, the window grows by AIMD_INCREASE if the loss and
+// the RTT are fine and is multiplied by AIMD_DECREASE otherwise.
+struct _aimd_ctx{
+    unsigned int window;            // current number of queries we may have in flight
+    unsigned int min_window;
+    unsigned int max_window;
+    unsigned long int done;         // finished queries in this epoch (answers + timeouts)
+    unsigned long int lost;         // timeouts in this epoch
+    uint64_t rtt_sum;               // sum of the RTTs (microseconds) of the answers of this epoch
+    unsigned long int rtt_count;
+    uint64_t base_rtt;              // best average RTT of an epoch so far (0: unknown)
+    double last_loss;               // loss ratio of the last finished epoch
+    uint64_t last_rtt;              // average RTT of the last finished epoch
+};
+
+typedef struct _aimd_ctx aimd_ctx;
+
+/*function declaration*/
+void aimd_init(aimd_ctx * ctx, unsigned int initial, unsigned int min_window, unsigned int max_window);
+int aimd_on_answer(aimd_ctx * ctx, uint64_t rtt);
+int aimd_on_timeout(aimd_ctx * ctx);
+
+#endif
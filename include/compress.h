@@ -0,0 +1,34 @@
+#include <stddef.h>
+#include <jsonenc.h>
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// Compression of the output in independent blocks: each block is a whole
+// gzip member or zstd frame. The standard tools read a file made of such
+// blocks back to back as one stream (gzip -d, zcat, zstd -d).
+
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_ZSTD 2             // only with COMPILE_WITH_ZSTD
+
+#define COMPRESS_GZIP_LEVEL 6       // default levels (zlib's and zstd's defaults)
+#define COMPRESS_ZSTD_LEVEL 3
+
+struct _compress_ctx{
+    int method;
+    int level;
+    void * state;                   // z_stream or ZSTD_CCtx (one per thread)
+};
+
+typedef struct _compress_ctx compress_ctx;
+
+/*function declaration*/
+int compress_method(const char * name);
+int compress_default_level(int method);
+int compress_check_level(int method, int level);
+compress_ctx * compress_init(int method, int level);
+int compress_block(compress_ctx * ctx, const char * data, size_t len, jsonenc_buf * out);
+void compress_free(compress_ctx * ctx);
+
+#endif
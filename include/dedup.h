@@ -0,0 +1,45 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <siphash.h>
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+// The names of the input we already queried. A name is known by a 64-bit
+// keyed hash of its lowercase form without the trailing dot, kept either in
+// a hash set (exact, it grows with the input) or in a Bloom filter of a
+// fixed size (a few unique names may be taken for duplicates once it fills).
+
+#define DEDUP_STRIPES 64                // locks of the hash set (the high bits of the hash pick one)
+#define DEDUP_STRIPE_SLOTS 1024         // first size of each stripe (doubles when half full)
+#define DEDUP_BLOOM_HASHES 7            // bits per name in the Bloom filter (~1% false positives at 10 bits per name)
+#define DEDUP_MAX_NAME 255              // longer names are always queried (they are not domain names)
+
+struct _dedup_stripe{
+    pthread_mutex_t lock;
+    uint64_t * slots;               // open addressing, 0 is an empty slot
+    size_t mask;                    // number of slots - 1
+    size_t count;
+    char pad[64];                   // each stripe on its own cache line
+};
+
+typedef struct _dedup_stripe dedup_stripe;
+
+struct _dedup_ctx{
+    uint8_t key[SIPHASH_KEY_SIZE];
+    dedup_stripe * stripes;         // the hash set (NULL with the Bloom filter)
+    uint64_t * bloom;               // the Bloom filter (NULL with the hash set)
+    uint64_t bloom_bits;
+    unsigned long int duplicates;   // names we didn't query (atomic)
+};
+
+typedef struct _dedup_ctx dedup_ctx;
+
+/*function declaration*/
+dedup_ctx * dedup_init(const uint8_t * key, size_t bloom_mb);
+int dedup_seen(dedup_ctx * ctx, const char * name, size_t len);
+size_t dedup_memory(dedup_ctx * ctx);
+void dedup_free(dedup_ctx * ctx);
+
+#endif
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <jsonenc.h>
+
+#ifndef DNSTAP_H
+#define DNSTAP_H
+
+// '--dnstap' output: the queries and answers as dnstap messages in a Frame
+// Streams file, or sent to a collector listening on a Unix socket (the
+// bidirectional Frame Streams handshake). The protobuf encoding of the few
+// fields we use is written by hand, so we don't need a protobuf library.
+
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+#define DNSTAP_VERSION "bulkDNS"
+#define DNSTAP_MAX_IDENTITY 255
+#define DNSTAP_MAX_CONTROL 512              // largest control frame we accept from a collector
+#define DNSTAP_HANDSHAKE_TIMEOUT 5          // seconds we wait for the collector to answer
+
+// Frame Streams control frames
+#define DNSTAP_FSTRM_ACCEPT 0x01
+#define DNSTAP_FSTRM_START 0x02
+#define DNSTAP_FSTRM_STOP 0x03
+#define DNSTAP_FSTRM_READY 0x04
+#define DNSTAP_FSTRM_FINISH 0x05
+#define DNSTAP_FSTRM_CONTENT_TYPE 0x01      // the only field of the control frames
+
+// dnstap Message.type
+#define DNSTAP_RESOLVER_QUERY 3
+#define DNSTAP_RESOLVER_RESPONSE 4
+#define DNSTAP_CLIENT_QUERY 5
+#define DNSTAP_CLIENT_RESPONSE 6
+
+// dnstap SocketProtocol
+#define DNSTAP_UDP 1
+#define DNSTAP_TCP 2
+
+struct _dnstap_ctx{
+    int fd;
+    int is_socket;                  // 1 if 'fd' is the connection to a collector
+    char identity[DNSTAP_MAX_IDENTITY + 1];     // our host name
+    size_t identity_len;
+    pthread_mutex_t lock;           // for dnstap_write()
+};
+
+typedef struct _dnstap_ctx dnstap_ctx;
+
+/*function declaration*/
+dnstap_ctx * dnstap_open(const char * dest);
+int dnstap_append(dnstap_ctx * ctx, jsonenc_buf * buf, int type, int proto, const struct sockaddr_in * query_addr,
+                  const struct sockaddr_in * response_addr, const char * msg, size_t len, uint64_t time_us);
+int dnstap_write(dnstap_ctx * ctx, const char * data, size_t len);
+void dnstap_close(dnstap_ctx * ctx);
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DNSWIRE_H
+#define DNSWIRE_H
+
+// A small scanner for DNS messages in wire format. It checks the header
+// and the question, reads what we need to decide what to do with an
+// answer (rcode, TC, counts) and walks the records in place. Nothing is
+// allocated or copied: the full decoding (sdns) is left to the output.
+
+#define DNSWIRE_HEADER_SIZE 12
+#define DNSWIRE_MAX_POINTERS 64         // compression pointers we follow in one name
+#define DNSWIRE_TYPE_OPT 41
+
+struct _dnswire_msg{
+    uint16_t id;
+    int qr;
+    int opcode;
+    int aa;
+    int tc;
+    int rd;
+    int ra;
+    int rcode;                          // with the extended rcode of the OPT record (if any)
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+    size_t qname;                       // offset of the name of the question
+    uint16_t qtype;
+    uint16_t qclass;
+    size_t records;                     // offset of the first record (after the question)
+    int complete;                       // 1 if all the records are well formed
+    int edns;                           // 1 if there is an OPT record
+    uint16_t udp_size;                  // payload size of the OPT record
+};
+
+typedef struct _dnswire_msg dnswire_msg;
+
+struct _dnswire_rr{
+    size_t name;                        // offset of the owner name
+    uint16_t type;
+    uint16_t rr_class;
+    uint32_t ttl;
+    size_t rdata;                       // offset of the data
+    uint16_t rdlen;
+};
+
+typedef struct _dnswire_rr dnswire_rr;
+
+// what we know about an answer besides its message (for the output)
+struct _dnswire_meta{
+    unsigned int attempts;              // queries sent for it (UDP and TCP)
+    uint32_t addr;                      // address of the resolver (network order)
+    uint16_t port;                      // port of the resolver (network order)
+    uint32_t rtt_us;                    // since we sent the query (0: unknown)
+    uint64_t time_us;                   // when we received it (unix time)
+};
+
+typedef struct _dnswire_meta dnswire_meta;
+
+/*function declaration*/
+int dnswire_parse(const char * msg, size_t len, dnswire_msg * wire);
+int dnswire_skip_name(const char * msg, size_t len, size_t * pos);
+int dnswire_next_rr(const char * msg, size_t len, size_t * pos, dnswire_rr * rr);
+int dnswire_name_to_text(const char * msg, size_t len, size_t pos, char * name, size_t size);
+uint32_t dnswire_qname_hash(const char * msg, const dnswire_msg * wire);
+
+#endif
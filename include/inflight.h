@@ -0,0 +1,34 @@
+#include <stdint.h>
+
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#define INFLIGHT_EMPTY_KEY UINT64_MAX
+#define INFLIGHT_NOT_FOUND -1
+
+// make a key from a socket index and a DNS ID
+#define INFLIGHT_KEY(sock, id) ((((uint64_t)(sock)) << 16) | ((uint64_t)(id) & 0xFFFF))
+
+struct _inflight_entry{
+    uint64_t key;
+    unsigned int value;
+};
+
+// open-addressing hash table (linear probing) which maps
+// (socket, DNS ID) of the in-flight queries to their index.
+struct _inflight_ctx{
+    struct _inflight_entry * entries;
+    unsigned long int mask;         // capacity - 1 (capacity is a power of two)
+    unsigned long int count;        // number of entries in the table
+};
+
+typedef struct _inflight_ctx inflight_ctx;
+
+/*function declaration*/
+inflight_ctx * inflight_init(unsigned long int max_items);
+int inflight_put(inflight_ctx * ctx, uint64_t key, unsigned int value);
+long int inflight_get(inflight_ctx * ctx, uint64_t key);
+int inflight_del(inflight_ctx * ctx, uint64_t key);
+void inflight_free(inflight_ctx * ctx);
+
+#endif
@@ -0,0 +1,51 @@
+#include <stddef.h>
+
+#ifndef INREADER_H
+#define INREADER_H
+
+// The input of a scan: one name per line. A regular file is mapped in
+// memory, anything else (a pipe, stdin) is read in large chunks. Lines are
+// found with memchr() and the names are given as slices of the mapping (or
+// of the chunk) without the spaces around them: nothing is copied and the
+// blank lines are skipped.
+
+#define INREADER_CHUNK_SIZE (1024 * 1024)    // read() size when we can't map the input
+
+struct _inreader_ctx{
+    int fd;
+    char * map;                     // the mapped file (NULL: we read chunks)
+    size_t map_len;
+    size_t dropped;                 // the start of 'map' we gave back to the kernel
+    char * buf;                     // the chunks
+    size_t size;                    // of 'buf' (it grows for a line longer than a chunk)
+    size_t start;                   // the next line in 'map' or 'buf'
+    size_t end;                     // the end of the data in 'map' or 'buf'
+    int eof;                        // 1 once read() returned 0
+    unsigned long int names;        // names we gave
+};
+
+typedef struct _inreader_ctx inreader_ctx;
+
+// ' ', '\t', '\n', '\v', '\f' and '\r' (what str_strip() removes)
+static inline int inreader_is_space(char c){
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// remove the spaces around the line 'line' ('len' characters). returns
+// the length which is left (0: a blank line)
+static inline size_t inreader_trim(const char ** line, size_t * len){
+    while (*len > 0 && inreader_is_space((*line)[*len - 1]))
+        *len -= 1;
+    while (*len > 0 && inreader_is_space((*line)[0])){
+        *line += 1;
+        *len -= 1;
+    }
+    return *len;
+}
+
+/*function declaration*/
+inreader_ctx * inreader_open(int fd);
+int inreader_next(inreader_ctx * r, const char ** name, size_t * len);
+void inreader_free(inreader_ctx * r);
+
+#endif
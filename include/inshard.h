@@ -0,0 +1,53 @@
+#include <stddef.h>
+#include <pthread.h>
+
+#ifndef INSHARD_H
+#define INSHARD_H
+
+// The input file split between the scan threads: each one owns a range of
+// the mapping and reads it a chunk at a time, without any thread in the
+// middle. A line belongs to the chunk where it starts, so the ranges don't
+// have to be cut on a '\n'. A thread which is done with its range steals
+// the second half of the largest range left.
+
+#define INSHARD_CHUNK_SIZE (64 * 1024)      // bytes a thread takes from its range at once
+
+struct _inshard_range{
+    pthread_mutex_t lock;           // the owner and the thieves take it to move 'start' and 'end'
+    size_t start;                   // the next chunk of the range
+    size_t end;
+    char pad[64];                   // each range on its own cache line
+};
+
+typedef struct _inshard_range inshard_range;
+
+struct _inshard_ctx{
+    char * map;                     // the mapped input file
+    size_t map_len;
+    unsigned int count;             // of 'ranges' (one per thread)
+    unsigned int joined;            // threads which took their range (atomic)
+    inshard_range * ranges;
+    unsigned long int steals;       // ranges we split for an idle thread (atomic)
+};
+
+typedef struct _inshard_ctx inshard_ctx;
+
+// what one thread is reading (only the thread uses it)
+struct _inshard_cursor{
+    unsigned int id;                // the range of the thread
+    size_t pos;                     // the next line of the chunk
+    size_t chunk_start;
+    size_t chunk_end;               // lines which start before it are ours
+    size_t done_start;              // the chunk we read before (we drop its pages
+    size_t done_end;                // after the next one: see inshard_drop())
+};
+
+typedef struct _inshard_cursor inshard_cursor;
+
+/*function declaration*/
+inshard_ctx * inshard_open(int fd, unsigned int count);
+int inshard_join(inshard_ctx * ctx, inshard_cursor * cur);
+int inshard_next(inshard_ctx * ctx, inshard_cursor * cur, const char ** name, size_t * len);
+void inshard_free(inshard_ctx * ctx);
+
+#endif
@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <dnswire.h>
+
+#ifndef JSONENC_H
+#define JSONENC_H
+
+// Writes a DNS message as one JSON record, straight from the wire format
+// (no sdns context and no jansson tree). The record has the layout of the
+// default output: header, question, answer, authority and additional.
+
+#define JSONENC_INITIAL_SIZE 4096
+
+// a growing output buffer. It's reused from one record to the next, so
+// after a few records we never allocate anymore.
+struct _jsonenc_buf{
+    char * mem;
+    size_t len;
+    size_t size;
+};
+
+typedef struct _jsonenc_buf jsonenc_buf;
+
+/*function declaration*/
+int jsonenc_init(jsonenc_buf * buf);
+void jsonenc_free(jsonenc_buf * buf);
+int jsonenc_reserve(jsonenc_buf * buf, size_t n);
+int jsonenc_append(jsonenc_buf * buf, const char * data, size_t len);
+int jsonenc_uint(jsonenc_buf * buf, uint64_t value);
+int jsonenc_message(jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire);
+const char * jsonenc_type_name(uint16_t type, char * tmp);
+const char * jsonenc_class_name(uint16_t rr_class, char * tmp);
+const char * jsonenc_rcode_name(int rcode, char * tmp);
+
+#endif
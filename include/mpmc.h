@@ -0,0 +1,66 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MPMC_H
+#define MPMC_H
+
+// Bounded multi-producer/multi-consumer ring of pointers (Dmitry Vyukov's
+// design). Each cell has a sequence number which tells whose turn it is:
+// a push or a pop is one compare-and-swap on the position and one store
+// on the cell, without any lock.
+struct _mpmc_cell{
+    size_t seq;
+    void * data;
+};
+
+struct _mpmc_ring{
+    size_t mask;                    // capacity - 1 (the capacity is a power of two)
+    struct _mpmc_cell * cells;
+    char pad1[64];                  // producers and consumers on their own cache lines
+    size_t head;                    // next cell to push (atomic)
+    char pad2[64];
+    size_t tail;                    // next cell to pop (atomic)
+    char pad3[64];
+};
+
+typedef struct _mpmc_ring mpmc_ring;
+
+// A ring for the threads which have nothing else to do while it's empty
+// (or full): they sleep on a futex until items (or room) come, instead of
+// polling. Nothing is pushed once it's closed, so the consumers know they
+// are done when it's closed and empty.
+
+#define MPMC_FOREVER -1                 // timeout of the calls which wait
+#define MPMC_SPINS 100                  // tries before we sleep on the futex
+
+struct _mpmc_queue{
+    mpmc_ring * ring;
+    char pad1[64];
+    uint32_t pushed;                // futex: changes after each push (atomic)
+    uint32_t pop_waiters;           // consumers sleeping on 'pushed' (atomic)
+    char pad2[64];
+    uint32_t popped;                // futex: changes after each pop (atomic)
+    uint32_t push_waiters;          // producers sleeping on 'popped' (atomic)
+    char pad3[64];
+    int closed;                     // 1 once nothing more is pushed (atomic)
+};
+
+typedef struct _mpmc_queue mpmc_queue;
+
+/*function declaration*/
+mpmc_ring * mpmc_init(size_t capacity);
+void mpmc_free(mpmc_ring * ring);
+int mpmc_push(mpmc_ring * ring, void * data);
+void * mpmc_pop(mpmc_ring * ring);
+size_t mpmc_push_batch(mpmc_ring * ring, void ** items, size_t count);
+size_t mpmc_pop_batch(mpmc_ring * ring, void ** items, size_t max);
+mpmc_queue * mpmc_queue_init(size_t capacity);
+void mpmc_queue_free(mpmc_queue * q);
+int mpmc_queue_push(mpmc_queue * q, void * data, int timeout_ms);
+size_t mpmc_queue_push_batch(mpmc_queue * q, void ** items, size_t count, int timeout_ms);
+void * mpmc_queue_pop(mpmc_queue * q, int timeout_ms);
+size_t mpmc_queue_pop_batch(mpmc_queue * q, void ** items, size_t max, int timeout_ms);
+void mpmc_queue_close(mpmc_queue * q);
+int mpmc_queue_drained(mpmc_queue * q);
+
+#endif
@@ -0,0 +1,42 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <mpmc.h>
+
+#ifndef NAMEARENA_H
+#define NAMEARENA_H
+
+// Storage of the names of the input. The reader copies them back to back
+// into large slabs instead of one malloc() per name; a slab counts the
+// names which were not released yet and goes back to a free list once the
+// scan threads are done with all of them. Slabs are aligned on their size,
+// so a name tells its slab (and its arena) without any lookup.
+
+#define NAMEARENA_SLAB_SIZE (1024 * 1024)
+#define NAMEARENA_MAX_NAME 4096             // longer lines are not names: we skip them
+#define NAMEARENA_MAX_FREE 1024             // free slabs we keep (the others are freed)
+
+struct _namearena_ctx;
+
+struct _namearena_slab{
+    uint32_t refs;                  // names not released yet, +1 while we fill it (atomic)
+    uint32_t used;                  // bytes used from the start of the slab
+    struct _namearena_ctx * arena;  // where it goes back once it's empty
+};
+
+typedef struct _namearena_slab namearena_slab;
+
+struct _namearena_ctx{
+    namearena_slab * current;       // the slab we fill (only the reader uses it)
+    mpmc_ring * free;               // slabs without names
+    unsigned long int slabs;        // slabs we allocated (atomic, for '--stats')
+};
+
+typedef struct _namearena_ctx namearena_ctx;
+
+/*function declaration*/
+namearena_ctx * namearena_init(void);
+char * namearena_copy(namearena_ctx * arena, const char * name, size_t len);
+void namearena_release(char * name);
+void namearena_free(namearena_ctx * arena);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef OUTSPLIT_H
+#define OUTSPLIT_H
+
+// The files of '--output-split' and '--output-shards'. The output is cut
+// in shards (by the hash of the qname) and each shard in numbered parts
+// of at most N records or N bytes. A part is cut after a complete record:
+// the writer cuts 'records:N' parts after exactly N records, the others
+// between two of its blocks (so each part is a valid .gz/.zst file with
+// '--compress'). A full part is fsync()'d and closed before the next
+// one is opened. Only the writer thread uses it, so there is no lock.
+
+#define OUTSPLIT_NONE 0
+#define OUTSPLIT_RECORDS 1
+#define OUTSPLIT_BYTES 2
+
+#define OUTSPLIT_MAX_SHARDS 64
+#define OUTSPLIT_MAX_NAME 4096
+
+struct _outsplit_file{
+    int fd;                         // -1 if the part is not open
+    unsigned int part;              // number of the next part to open
+    uint64_t records;               // in the open part
+    uint64_t bytes;
+};
+
+typedef struct _outsplit_file outsplit_file;
+
+struct _outsplit_ctx{
+    int mode;                       // OUTSPLIT_NONE, OUTSPLIT_RECORDS or OUTSPLIT_BYTES
+    uint64_t limit;                 // records or bytes of a part
+    unsigned int shards;
+    char * stem;                    // the name of '-o' up to its extension
+    char * ext;                     // the extension ('.json.gz'), may be empty
+    char * header;                  // what goes before the records of each part
+    size_t header_len;
+    outsplit_file files[OUTSPLIT_MAX_SHARDS];
+    unsigned long int parts;        // files we opened (for '--stats')
+};
+
+typedef struct _outsplit_ctx outsplit_ctx;
+
+/*function declaration*/
+int outsplit_parse(const char * spec, int * mode, uint64_t * limit);
+outsplit_ctx * outsplit_init(const char * path, int mode, uint64_t limit, unsigned int shards);
+int outsplit_set_header(outsplit_ctx * ctx, const char * header, size_t len);
+int outsplit_start(outsplit_ctx * ctx);
+int outsplit_fd(outsplit_ctx * ctx, unsigned int shard);
+int outsplit_count(outsplit_ctx * ctx, unsigned int shard, uint64_t records, uint64_t bytes);
+uint64_t outsplit_room(outsplit_ctx * ctx, unsigned int shard);
+int outsplit_next(outsplit_ctx * ctx, unsigned int shard);
+int outsplit_close(outsplit_ctx * ctx);
+void outsplit_free(outsplit_ctx * ctx);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <jsonenc.h>
+#include <mpmc.h>
+#include <compress.h>
+#include <outsplit.h>
+
+#ifndef OUTWRITER_H
+#define OUTWRITER_H
+
+// One writer thread for the whole output. The threads which produce the
+// records fill a large buffer each and hand the full buffers to the writer
+// through a lock-free ring; the writer writes them with writev() and puts
+// them back in the pool. The pool is bounded: if the output is slower than
+// the scan, the producers wait for a free buffer.
+// With compression, a few workers sit between the producers and the writer:
+// each one compresses whole buffers into independent blocks, so the output
+// is a valid stream whatever the order of the blocks.
+// With '--output-split'/'--output-shards', the writer writes to the files
+// of an outsplit_ctx instead of one descriptor: a producer fills one buffer
+// per shard ('lane') and the writer cuts the files between two buffers.
+// With 'records:N' and no compression, the buffers also keep where each of
+// their records ends, so the writer cuts a part right after its N-th record.
+
+#define OUTWRITER_BUFFER_SIZE (256 * 1024)
+#define OUTWRITER_RECORD_ROOM (16 * 1024)  // we hand off a buffer once it has less room than this
+#define OUTWRITER_FLUSH_MS 1000             // nor do we keep records longer than this
+#define OUTWRITER_MAX_IOV 64                // buffers per writev()
+#define OUTWRITER_WAIT_MS 10                // the longest sleep of the writer or a producer
+#define OUTWRITER_MAX_WRITERS 8             // writers which may exist at the same time
+#define OUTWRITER_MAX_LANES OUTSPLIT_MAX_SHARDS
+#define OUTWRITER_MAX_RECORDS 4096          // records of a buffer whose ends we keep (hand off after them)
+
+// one buffer of the pool. It only has complete records.
+struct _outwriter_buf{
+    jsonenc_buf data;
+    jsonenc_buf packed;             // 'data' compressed (only with compression)
+    uint64_t since_ms;              // when the first record went in
+    unsigned int lane;              // the shard of its records
+    uint64_t records;               // complete records in 'data'
+    uint32_t * ends;                // end of each record in 'data' (only with 'exact')
+};
+
+typedef struct _outwriter_buf outwriter_buf;
+
+// a ring of buffers and the threads which take them from it
+struct _outwriter_stage{
+    mpmc_ring * ring;
+    pthread_cond_t wake;            // there are buffers in the ring (or we are closing)
+    int idle;                       // threads sleeping on 'wake' (atomic)
+    int closing;                    // 1 once nothing more is pushed (atomic)
+};
+
+typedef struct _outwriter_stage outwriter_stage;
+
+struct _outwriter_ctx{
+    int fd;                         // -1 with 'split'
+    outsplit_ctx * split;           // the files of the output (NULL: 'fd')
+    unsigned int lanes;             // shards of 'split' (1 without it)
+    int exact;                      // 1 if the parts are cut after their last record ('records:N', no compression)
+    int slot;                       // index of our buffer in the thread-local current buffers
+    unsigned int count;             // size of the pool
+    outwriter_buf * bufs;
+    mpmc_ring * free;               // empty buffers
+    outwriter_stage ready;          // full buffers for the workers (or the writer)
+    outwriter_stage packed;         // compressed buffers for the writer
+    pthread_t thread;
+    int method;                     // COMPRESS_NONE, COMPRESS_GZIP or COMPRESS_ZSTD
+    int level;
+    unsigned int num_workers;       // compression threads (0 without compression)
+    pthread_t * workers;
+    pthread_mutex_t lock;           // only to sleep and wake up
+    pthread_cond_t room;            // there are free buffers
+    int waiting;                    // producers waiting for a buffer (atomic)
+    int failed;                     // 1 after a write (or compression) error
+    // for '--stats'
+    unsigned long int bytes;
+    unsigned long int raw_bytes;    // before compression
+    unsigned long int writes;
+    unsigned long int stalls;       // times a producer found no free buffer
+};
+
+typedef struct _outwriter_ctx outwriter_ctx;
+
+/*function declaration*/
+outwriter_ctx * outwriter_init(int fd, unsigned int count);
+outwriter_ctx * outwriter_init_compressed(int fd, unsigned int count, int method, int level, unsigned int workers);
+outwriter_ctx * outwriter_init_split(outsplit_ctx * split, unsigned int count, int method, int level, unsigned int workers);
+jsonenc_buf * outwriter_buffer(outwriter_ctx * w);
+jsonenc_buf * outwriter_lane_buffer(outwriter_ctx * w, unsigned int lane);
+void outwriter_commit(outwriter_ctx * w);
+void outwriter_lane_commit(outwriter_ctx * w, unsigned int lane);
+void outwriter_tick(outwriter_ctx * w, uint64_t now_ms);
+void outwriter_release(outwriter_ctx * w);
+void outwriter_close(outwriter_ctx * w);
+void outwriter_free(outwriter_ctx * w);
+
+#endif
@@ -0,0 +1,33 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <jsonenc.h>
+
+#ifndef PCAPFILE_H
+#define PCAPFILE_H
+
+// '--pcap' capture of the queries and answers in the classic pcap format.
+// We don't capture from an interface: we know the messages we send and
+// receive, so we write them with an IPv4 and UDP (or TCP) header we make
+// up. The link type is 'raw IP', Wireshark and tcpdump read it as it is.
+// The numbers of the pcap headers are in host byte order (the magic tells
+// the readers which one), the packet headers are in network byte order.
+
+#define PCAPFILE_MAGIC 0xa1b2c3d4
+#define PCAPFILE_SNAPLEN 65535
+#define PCAPFILE_LINKTYPE_RAW 101
+#define PCAPFILE_FILE_HEADER_SIZE 24
+#define PCAPFILE_RECORD_HEADER_SIZE 16
+#define PCAPFILE_IP_HEADER_SIZE 20
+#define PCAPFILE_UDP_HEADER_SIZE 8
+#define PCAPFILE_TCP_HEADER_SIZE 20
+
+#define PCAPFILE_UDP 17
+#define PCAPFILE_TCP 6          // the message has the 2-byte length of DNS over TCP
+
+/*function declaration*/
+int pcapfile_header(jsonenc_buf * buf);
+int pcapfile_append(jsonenc_buf * buf, int proto, const struct sockaddr_in * src, const struct sockaddr_in * dst,
+                    const char * msg, size_t len, uint64_t time_us);
+
+#endif
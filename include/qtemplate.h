@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef QTEMPLATE_H
+#define QTEMPLATE_H
+
+// UDP payload size we announce in EDNS0 (the DNS flag day 2020 value:
+// large enough for most answers and small enough to avoid fragmentation)
+#define QTEMPLATE_EDNS_UDP_SIZE 1232
+
+#define QTEMPLATE_HEADER_SIZE 12
+#define QTEMPLATE_MAX_NAME 255          // wire size of the longest domain name
+// qtype + qclass + OPT RR (root, type, class, ttl, rdlen) + NSID option
+#define QTEMPLATE_MAX_TRAILER (4 + 11 + 4)
+
+// All the queries of a scan are the same except for the qname and the ID.
+// We build the header and the trailer (question type/class and the EDNS0
+// OPT record) once and only copy them around the name of each query.
+struct _qtemplate_ctx{
+    uint8_t header[QTEMPLATE_HEADER_SIZE];
+    uint8_t trailer[QTEMPLATE_MAX_TRAILER];
+    size_t trailer_len;
+};
+
+typedef struct _qtemplate_ctx qtemplate_ctx;
+
+/*function declaration*/
+void qtemplate_init(qtemplate_ctx * ctx, uint16_t qtype, uint16_t qclass, int edns, int set_do, int set_nsid);
+size_t qtemplate_build(qtemplate_ctx * ctx, const char * name, uint16_t id, char * buffer, size_t size);
+
+#endif
@@ -0,0 +1,24 @@
+#include <stdint.h>
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+// Token bucket implemented as GCRA (generic cell rate algorithm).
+// The whole state is one 64-bit 'theoretical arrival time' that we
+// update with compare-and-swap, so all the threads can share one
+// limiter without a lock.
+struct _ratelimit_ctx{
+    uint64_t interval;          // nanoseconds between two tokens at the target rate
+    uint64_t burst;             // how far (ns) we may run ahead of the schedule
+    uint64_t tat;               // theoretical arrival time of the next token (atomic)
+};
+
+typedef struct _ratelimit_ctx ratelimit_ctx;
+
+/*function declaration*/
+ratelimit_ctx * ratelimit_init(double rate, uint64_t slice_ns);
+int ratelimit_take(ratelimit_ctx * ctx, uint64_t now, uint64_t * wait);
+void ratelimit_refund(ratelimit_ctx * ctx);
+void ratelimit_free(ratelimit_ctx * ctx);
+
+#endif
@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <dnswire.h>
+#include <jsonenc.h>
+
+#ifndef RAWLOG_H
+#define RAWLOG_H
+
+// Binary log of the answers ('--format=raw'): a file header and then, for
+// each answer, a record header followed by the DNS message as we received
+// it. '--decode' turns it into JSON/TSV/CSV later. All the numbers are in
+// network byte order.
+//
+// file header:   "BULKDNS" 0x01 | flags (4)
+// record header: message length (4) | time_us (8) | rtt_us (4) |
+//                resolver address (4) | resolver port (2) | attempts (2)
+
+#define RAWLOG_MAGIC "BULKDNS\x01"
+#define RAWLOG_MAGIC_SIZE 8
+#define RAWLOG_FILE_HEADER_SIZE 12
+#define RAWLOG_RECORD_HEADER_SIZE 24
+#define RAWLOG_MAX_MESSAGE 65535
+
+#define RAWLOG_FLAG_ATTEMPTS 1          // the scan used '--retries' (write the attempts)
+
+/*function declaration*/
+int rawlog_file_header(jsonenc_buf * buf, uint32_t flags);
+int rawlog_check_file_header(const char * data, uint32_t * flags);
+int rawlog_append(jsonenc_buf * buf, const char * msg, size_t len, dnswire_meta * meta);
+int rawlog_record_header(const char * data, size_t * len, dnswire_meta * meta);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <netinet/in.h>
+#include <ratelimit.h>
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+// how we spread the queries over the resolvers
+#define RESOLVER_POLICY_WRR 0           // smooth weighted round-robin
+#define RESOLVER_POLICY_LEAST 1         // least outstanding queries (per weight)
+
+// what happened to a query (for the health of its resolver)
+#define RESOLVER_ANSWER 0
+#define RESOLVER_TIMEOUT 1
+#define RESOLVER_REFUSED 2
+
+#define RESOLVER_HEALTH_WINDOW 64       // we judge a resolver every 64 results
+#define RESOLVER_MAX_TIMEOUT 0.5        // eject if more than half of them timed out
+#define RESOLVER_MAX_REFUSED 0.5        // or if more than half of them are REFUSED
+#define RESOLVER_EJECT_MS 10000         // first ejection, doubled while the probes fail
+#define RESOLVER_MAX_EJECT_MS 300000
+
+#define RESOLVER_MAX_WEIGHT 1000
+
+// one resolver of the pool. The health part is shared by all the
+// scan engines and only updated with atomic operations.
+struct _resolver_entry{
+    struct sockaddr_in addr;
+    unsigned int weight;
+    char name[32];                  // "ip:port" for the logs
+    ratelimit_ctx * rate;           // '--resolver-rate' of this resolver (NULL: no limit)
+    unsigned long int results;      // results in the current health window
+    unsigned long int timeouts;     // timeouts in the current health window
+    unsigned long int refused;      // REFUSED in the current health window
+    uint64_t ejected_until;         // end of the ejection (ms, monotonic). 0: healthy
+    int probing;                    // 1 if a probe query is in flight
+    unsigned int ejections;         // ejections in a row (for the backoff)
+    // totals for '--stats' (added by the engines when they finish)
+    unsigned long int sent;
+    unsigned long int total_timeouts;
+    unsigned long int total_refused;
+    unsigned long int total_ejections;
+};
+
+typedef struct _resolver_entry resolver_entry;
+
+struct _resolver_pool{
+    resolver_entry * list;
+    unsigned int count;
+    int policy;
+    unsigned int healthy;           // resolvers which are not ejected (atomic)
+};
+
+typedef struct _resolver_pool resolver_pool;
+
+// what each scan engine knows about the resolvers (not shared)
+struct _resolver_load{
+    long int current;               // state of the smooth weighted round-robin
+    unsigned int outstanding;       // queries of this engine in flight to the resolver
+    unsigned long int sent;
+    unsigned long int timeouts;
+    unsigned long int refused;
+};
+
+typedef struct _resolver_load resolver_load;
+
+/*function declaration*/
+resolver_pool * resolver_pool_init(const char * spec, uint16_t default_port, int policy, double rate, uint64_t slice_ns);
+void resolver_pool_free(resolver_pool * pool);
+resolver_load * resolver_load_init(resolver_pool * pool);
+void resolver_load_free(resolver_pool * pool, resolver_load * load);
+int resolver_usable(resolver_pool * pool, unsigned int idx);
+unsigned int resolver_pick(resolver_pool * pool, resolver_load * load, uint64_t now, int * probe);
+unsigned int resolver_pick_other(resolver_pool * pool, resolver_load * load, unsigned int except);
+void resolver_report(resolver_pool * pool, resolver_load * load, unsigned int idx, int outcome, int probe, uint64_t now);
+void resolver_cancel_probe(resolver_pool * pool, unsigned int idx);
+
+#endif
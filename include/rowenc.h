@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <dnswire.h>
+#include <jsonenc.h>
+
+#ifndef ROWENC_H
+#define ROWENC_H
+
+// Writes the answers as TSV or CSV rows with only the fields we ask for
+// ('--fields'), straight from the wire format. One row per response;
+// the fields of a section (e.g. 'answer.rdata') have one value per record,
+// separated by ';'. Names and rdata are in the presentation format of the
+// zone files (like dig), so they never have a tab or a newline.
+
+#define ROWENC_FORMAT_JSON 0
+#define ROWENC_FORMAT_TSV 1
+#define ROWENC_FORMAT_CSV 2
+#define ROWENC_FORMAT_RAW 3             // not rows: the binary log of rawlog.h
+
+#define ROWENC_MAX_FIELDS 32
+#define ROWENC_DEFAULT_FIELDS "qname,qtype,rcode,answer.ttl,answer.rdata"
+#define ROWENC_VALUE_SEPARATOR ';'
+
+// fields of the message
+#define ROWENC_QNAME 0
+#define ROWENC_QTYPE 1
+#define ROWENC_QCLASS 2
+#define ROWENC_RCODE 3
+#define ROWENC_ID 4
+#define ROWENC_FLAGS 5
+#define ROWENC_ANCOUNT 6
+#define ROWENC_NSCOUNT 7
+#define ROWENC_ARCOUNT 8
+#define ROWENC_ATTEMPTS 9
+#define ROWENC_RESOLVER 10
+#define ROWENC_RTT 11
+#define ROWENC_TIME 12
+#define ROWENC_SECTION_FIELDS 16    // 'answer.*', 'authority.*' and 'additional.*' come after
+
+// fields of the records of a section
+#define ROWENC_RR_NAME 0
+#define ROWENC_RR_TYPE 1
+#define ROWENC_RR_CLASS 2
+#define ROWENC_RR_TTL 3
+#define ROWENC_RR_RDATA 4
+#define ROWENC_RR_FIELDS 5
+
+struct _rowenc_ctx{
+    int format;                     // ROWENC_FORMAT_TSV or ROWENC_FORMAT_CSV
+    unsigned int count;
+    int fields[ROWENC_MAX_FIELDS];
+};
+
+typedef struct _rowenc_ctx rowenc_ctx;
+
+/*function declaration*/
+int rowenc_format(const char * name);
+int rowenc_init(rowenc_ctx * ctx, int format, const char * fields);
+int rowenc_header(rowenc_ctx * ctx, jsonenc_buf * buf);
+int rowenc_message(rowenc_ctx * ctx, jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire, dnswire_meta * meta);
+int rowenc_rdata(jsonenc_buf * buf, const char * msg, size_t len, dnswire_rr * rr);
+
+#endif
@@ -0,0 +1,26 @@
+#include <stdint.h>
+
+#ifndef RTTHIST_H
+#define RTTHIST_H
+
+// log-linear histogram of RTTs in microseconds: 8 linear buckets for
+// each power of two, so a bucket is never wider than 12.5% of its value
+#define RTTHIST_SUB_BITS 3
+#define RTTHIST_SUB (1 << RTTHIST_SUB_BITS)
+#define RTTHIST_MAX_BITS 32             // larger values go to the last bucket (~71 minutes)
+#define RTTHIST_BUCKETS (RTTHIST_SUB + (RTTHIST_MAX_BITS - RTTHIST_SUB_BITS) * RTTHIST_SUB)
+
+struct _rtthist_ctx{
+    unsigned long int count;
+    unsigned long int buckets[RTTHIST_BUCKETS];
+};
+
+typedef struct _rtthist_ctx rtthist_ctx;
+
+/*function declaration*/
+void rtthist_init(rtthist_ctx * ctx);
+void rtthist_add(rtthist_ctx * ctx, uint64_t rtt);
+uint64_t rtthist_percentile(rtthist_ctx * ctx, double percentile);
+void rtthist_merge(rtthist_ctx * dst, rtthist_ctx * src);
+
+#endif
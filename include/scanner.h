@@ -4,18 +4,89 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 #include <pthread.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <signal.h>
 #include <cmdparser.h>
-#include <cqueue.h>
+#include <udpbatch.h>
+#include <inflight.h>
+#include <twheel.h>
+#include <ratelimit.h>
+#include <aimd.h>
+#include <resolver.h>
+#include <rtthist.h>
+#include <siphash.h>
+#include <qtemplate.h>
+#include <dnswire.h>
+#include <jsonenc.h>
+#include <outwriter.h>
+#include <rowenc.h>
+#include <rawlog.h>
+#include <pcapfile.h>
+#include <dnstap.h>
+#include <compress.h>
+#include <outsplit.h>
+#include <inreader.h>
+#include <inshard.h>
+#include <dedup.h>
+#include <namearena.h>
 
 
 #ifndef _BULKDNS_SCANNER_H
 #define _BULKDNS_SCANNER_H
 
-#define BULKDNS_MAX_QUEUE_SIZE 1000000
+// names waiting for the scan threads (and answers waiting for a TCP thread).
+// The feeder sleeps until there is room, so it doesn't need to be large.
+#define BULKDNS_MAX_QUEUE_SIZE 65536
 
-#define BULKDNS_MAX_SOCKET_FOR_POLL 32
+// TCP connections of the server mode waiting for the Lua script
+#define BULKDNS_SERVER_QUEUE_SIZE 64
+
+// names a scan thread takes from the input queue at once
+#define BULKDNS_INPUT_BATCH 32
+
+#define BULKDNS_MAX_EPOLL_EVENTS 256
+
+// largest query we ever build (qname + header + question + EDNS0)
+#define BULKDNS_MAX_QUERY_SIZE 512
+
+// pacing slice of the rate limiters: we never send more than one slice
+// worth of queries at once
+#define BULKDNS_RATE_SLICE_MS 1
+
+// how often an engine with queries in flight checks an empty input queue
+#define BULKDNS_INPUT_POLL_MS 100
+
+// largest UDP response we can receive
+#define BULKDNS_MAX_UDP_RESPONSE 65535
+
+// with '--sockets', a socket carries at most this many queries (half of
+// the DNS IDs, so a free random ID is found after two tries on average)
+#define BULKDNS_MAX_SOCKET_QUERIES 32768
+
+// receive/send buffers we ask for a '--sockets' socket (the kernel caps
+// them to net.core.rmem_max and net.core.wmem_max)
+#define BULKDNS_SOCKET_BUFFER (8 * 1024 * 1024)
+
+// '--hedge' waits for this many RTT samples and updates its delay every
+// BULKDNS_HEDGE_UPDATE samples
+#define BULKDNS_HEDGE_MIN_SAMPLES 100
+#define BULKDNS_HEDGE_UPDATE 256
+
+// how often the '--stateless' receiver checks if its sender is done
+#define BULKDNS_STATELESS_POLL_MS 100
+
+// '--decode' reads the raw log in chunks of about 1MB (whole records) and
+// hands them to the decoder threads. At most 4 chunks per thread wait.
+#define BULKDNS_DECODE_CHUNK_SIZE (1024 * 1024)
+#define BULKDNS_DECODE_CHUNKS_PER_THREAD 4
+
+// default number of threads which compress the output ('--compress')
+#define BULKDNS_COMPRESS_THREADS 2
+#define BULKDNS_MAX_COMPRESS_THREADS 64
+
+// output buffers of the writer thread for each scan thread. Every thread
+// which writes records holds one at a time, the others are being written.
+#define BULKDNS_OUTPUT_BUFFERS_PER_THREAD 4
 
 
 struct scanner_input {
@@ -25,7 +96,8 @@ struct scanner_input {
     int no_edns;                    // should we have edns0?
     int rr_type;                    // which DNS RR type
     int rr_class;                   // which DNS class?
-    char * resolver;                // which recursive resolver use to get the data from
+    char * resolver;                // which recursive resolvers use to get the data from (list or file)
+    int resolver_policy;            // RESOLVER_POLICY_WRR or RESOLVER_POLICY_LEAST
     unsigned int port;              // which port use to send the queries
     char * output_file;             // where to write the results
     char * output_error;            // where to write the errors
@@ -35,42 +107,196 @@ struct scanner_input {
     FILE * ERROR;                   // error file handle
     FILE * INPUT;                   // input file handle
     unsigned int concurrency;       // number of concurrent requests (This is the number of open sockets/ports)
+    unsigned int threads;           // number of scan engine threads (one epoll loop per thread)
+    unsigned int batch;             // how many queries we send/receive with one sendmmsg()/recvmmsg()
+    unsigned int sockets;           // number of UDP sockets shared by all the queries (0: one per '--batch' queries)
+    int stats;                      // print scan statistics at the end of the scan
+    unsigned int retries;           // how many times we retry a query (0: never)
+    unsigned int retry_backoff;     // backoff before the first retry in milliseconds (doubles each retry)
+    int retry_servfail;             // retry the queries answered with SERVFAIL
+    int retry_refused;              // retry the queries answered with REFUSED
+    double rate;                    // maximum queries per second of the whole scan (0: no limit)
+    double resolver_rate;           // maximum queries per second sent to each resolver (0: no limit)
+    int adaptive;                   // adapt the number of in-flight queries to loss and RTT (AIMD)
+    double hedge;                   // percentile of the RTT after which we send a duplicate (0: never)
+    unsigned int hedge_budget;      // duplicates may add at most this percent of the queries
+    int stateless;                  // no in-flight table: the DNS ID is a keyed hash of the query
+    int decode;                     // convert a raw log ('--format=raw') instead of scanning
+    int fast_json;                  // encode the output from the wire format instead of sdns/jansson
+    int format;                     // ROWENC_FORMAT_JSON, ROWENC_FORMAT_TSV or ROWENC_FORMAT_CSV
+    char * fields;                  // '--fields' (only valid in initial_check_command_line())
+    rowenc_ctx rows;                // the fields of the TSV/CSV rows
+    char * pcap_file;               // capture the queries and the answers to this pcap file
+    FILE * PCAP;                    // '--pcap' file handle (NULL: no capture)
+    char * dnstap_dest;             // '--dnstap': a file or 'unix:<path>' of a collector
+    int compress;                   // COMPRESS_NONE, COMPRESS_GZIP or COMPRESS_ZSTD
+    int compress_level;             // '--compress-level' (0: the default of the method)
+    unsigned int compress_threads;  // threads which compress the output blocks
+    int split_mode;                 // '--output-split': OUTSPLIT_NONE, OUTSPLIT_RECORDS or OUTSPLIT_BYTES
+    uint64_t split_limit;           // records or bytes of a part
+    unsigned int output_shards;     // '--output-shards' (1: no sharding)
+    outsplit_ctx * split;           // the files of the output with one of them (OUTPUT is NULL)
+    int shard_input;                // each scan thread reads its own part of the input file
+    int dedup;                      // query each name of the input once
+    int dedup_bloom_mb;             // '--dedup-bloom': size of the Bloom filter (0: exact hash set)
     unsigned int server_mode;       // should we work in server mode instead of active scan
     char * lua_file;                // Lua file to use either in server mode or custom scan
     char * bind_ip;                 // this is the IP address we want to bind to in server-mode
     int no_tcp;                     // should we run TCP server (1 which is default) or not (0)
 };
 
+typedef struct{
+    unsigned long int queries_sent;     // queries that left the sockets
+    unsigned long int send_calls;       // number of sendmmsg() calls
+    unsigned long int responses;        // UDP responses we received
+    unsigned long int recv_calls;       // number of recvmmsg() calls
+    unsigned long int timeouts;         // queries without any answer after '--timeout'
+    unsigned long int unmatched;        // responses that don't match any in-flight query
+    unsigned long int retries;          // queries we sent again (timeout, SERVFAIL, REFUSED)
+    unsigned long int paced;            // how many times the rate limiter made us wait
+    unsigned long int window_changes;   // how many times '--adaptive' changed the window
+    unsigned long int hedges;           // duplicates sent by '--hedge'
+    unsigned long int hedges_won;       // duplicates answered before the original query
+} scan_mode_stats;
+
 struct thread_param {
-    char * quit_data;
     struct scanner_input * si;
-    pthread_mutex_t lock;
-    cqueue_ctx * qinput;
-    cqueue_ctx * queue_tcp;
+    mpmc_queue * qinput;            // the names (closed once the input is read)
+    namearena_ctx * names;          // where the names of 'qinput' are stored
+    inshard_ctx * shards;           // '--shard-input' (NULL: the main thread fills 'qinput')
+    namearena_ctx ** shard_names;   // the names of each shard (one arena per thread)
+    dedup_ctx * dedup;              // '--dedup' (NULL: we query the duplicates too)
+    mpmc_queue * queue_tcp;         // truncated answers (closed once the UDP side is done)
+    scan_mode_stats stats;          // sum of the counters of all the scan engines
+    ratelimit_ctx * rate_limit;     // '--rate' shared by all the engines (NULL: no limit)
+    resolver_pool * resolvers;      // '-r' with the '--resolver-rate' limiter of each resolver
+    rtthist_ctx rtt;                // RTTs of all the engines (for '--stats')
+    uint8_t cookie_key[SIPHASH_KEY_SIZE];   // secret key of the '--stateless' DNS IDs
+    qtemplate_ctx query;            // what all the queries have in common (built once from 'si')
+    outwriter_ctx * output;         // writer thread of the scan output (NULL with Lua)
+    outwriter_ctx * pcap;           // writer thread of '--pcap' (NULL: no capture)
+    dnstap_ctx * dnstap;            // '--dnstap' stream (NULL: none)
+    outwriter_ctx * dnstap_output;  // writer thread of '--dnstap'
+    int capture;                    // 1 if '--pcap' or '--dnstap' wants the packets
+    struct sockaddr_in local;       // our address in the packets of '--pcap' and '--dnstap'
 };
 
 typedef struct{
     int * sock_list;
     int num_sock;
+    unsigned int depth;         // how many queries each socket carries
+    int thread_id;
     struct thread_param * tp;
 }scan_mode_receiver_param;
 
 
-typedef struct {
-    void * item;
-    int udp_sock;
-    struct sockaddr_in server;
+typedef struct{
+    int sockfd;
+    unsigned int index;         // index of the socket in its engine (part of the in-flight key)
+    uint16_t port;              // local port (network order): in the '--stateless' DNS ID and the captures
+    int dirty;                  // 1 if the socket is in the list of sockets to flush
+    udpbatch_ctx * batch;       // queries waiting for the next sendmmsg() on this socket
+}scan_mode_socket;
+
+
+// state of an in-flight query
+#define BULKDNS_QUERY_SENT 0            // waiting for the answer until the deadline
+#define BULKDNS_QUERY_BACKOFF 1         // waiting to be sent again
+
+// cap of the exponential backoff between retries
+#define BULKDNS_MAX_RETRY_BACKOFF_MS 10000
+
+// one in-flight query of a scan engine
+typedef struct _scan_mode_worker_item{
+    void * item;                // the domain name (owned by the query until it's done)
+    scan_mode_socket * sock;    // the socket we send the query on
+    unsigned int resolver;      // index of the resolver (in the pool) we send the query to
+    int probe;                  // 1 if the query is the health probe of an ejected resolver
+    char * query;               // wire format of the query (BULKDNS_MAX_QUERY_SIZE bytes)
+    size_t query_len;
+    uint16_t id;                // DNS ID of the query
+    int state;                  // BULKDNS_QUERY_SENT or BULKDNS_QUERY_BACKOFF
+    unsigned int attempts;      // how many times we sent the query
+    uint64_t sent_at;           // when we sent the last attempt (microseconds, monotonic clock)
+    twheel_timer timer;         // deadline of the query (or end of the backoff)
+    twheel_timer hedge_timer;   // when we send a duplicate of the query ('--hedge')
+    struct _scan_mode_worker_item * twin;   // the duplicate of the query (or the original of a duplicate)
+    int hedge;                  // 1 if this is a duplicate: 'item' belongs to 'twin'
 }scan_mode_worker_item;
 
 
+// what the UDP engines pass to the TCP threads
+typedef struct {
+    char * name;
+    unsigned int attempts;      // attempts over UDP before we fall back to TCP
+    unsigned int resolver;      // the resolver that sent the truncated answer
+}scan_mode_tcp_item;
+
+
+// state of one scan engine (one thread, one epoll loop)
+typedef struct{
+    struct thread_param * tp;
+    int epfd;
+    scan_mode_socket * socks;
+    int num_sock;
+    scan_mode_worker_item * queries;    // all the queries this engine can have in flight
+    unsigned int num_queries;
+    unsigned int * free_queries;        // stack of the indexes of the free entries of 'queries'
+    unsigned int num_free;
+    char * query_mem;                   // wire format of the queries
+    inflight_ctx * inflight;            // (socket, DNS ID) -> index in 'queries'
+    twheel_ctx * timers;                // deadlines of the in-flight queries (1 tick = 1ms)
+    scan_mode_socket ** dirty;          // sockets that have queries waiting in their batch
+    int num_dirty;
+    udpbatch_ctx * recv_batch;
+    uint64_t rng;                       // state of the random generator for DNS IDs
+    int id;                             // thread id of the engine (for the logs)
+    int adaptive;                       // 1 if 'aimd' limits the queries in flight
+    aimd_ctx aimd;                      // window of '--adaptive'
+    resolver_load * load;               // what this engine sent to each resolver
+    rtthist_ctx rtt;                    // RTTs of the queries answered at the first attempt
+    uint64_t hedge_after;               // '--hedge' delay in ms (0: not enough samples yet)
+    unsigned long int started;          // queries we took from the input (base of the hedge budget)
+    unsigned int hedge_reserve;         // entries we keep free for the duplicates
+    scan_mode_stats stats;
+}scan_mode_engine;
+
+
+// '--stateless' runs one sender and one receiver thread over each share
+// of the sockets. They only share the sockets and the end of the sending.
+typedef struct{
+    struct thread_param * tp;
+    int id;
+    scan_mode_socket * socks;
+    int num_sock;
+    uint64_t done_ms;                   // when the sender sent its last query (atomic, 0: still sending)
+    pthread_t receiver;
+    scan_mode_stats stats;              // counters of the receiver
+}scan_stateless_ctx;
+
+
 // server-mode structure definition
 
+// records of the raw log (record header + message) back to back
+typedef struct{
+    char * mem;
+    size_t len;
+}decode_mode_chunk;
+
+// shared by the '--decode' reader (main thread) and the decoder threads
+typedef struct{
+    struct thread_param * tp;
+    mpmc_queue * chunks;            // closed once the reader pushed the last chunk
+    unsigned long int records;      // answers we read (atomic)
+    unsigned long int errors;       // answers dnswire could not parse (atomic)
+}decode_mode_ctx;
+
 typedef struct {
-    pthread_mutex_t * mutex_queue;
-    pthread_cond_t * cond_queue;
     int sockfd;
-    cqueue_ctx * queue_handle;
+    mpmc_queue * queue_handle;
     char * lua_file;
+    dnstap_ctx * dnstap;        // '--dnstap' (NULL: none)
+    struct sockaddr_in local;   // the address we listen on (for '--dnstap')
 } server_mode_thread_params;
 
 typedef struct{
@@ -78,6 +304,7 @@ typedef struct{
     uint16_t port;
     char * lua_file;
     int run_tcp_server;         // 1 means we should run and 0 means no TCP server
+    char * dnstap_dest;         // '--dnstap': a file or 'unix:<path>' of a collector
 } server_mode_server_param;
 
 typedef struct{
@@ -96,29 +323,70 @@ typedef struct{
 
 
 //server-mode function declaration
-void handle_read_socket(int sockfd, char * mem_result, struct thread_param * tp);
+int handle_read_socket(scan_mode_engine * eng, scan_mode_socket * sms);
+void handle_udp_response(char * mem_result, size_t received, dnswire_msg * wire, struct sockaddr_in * from,
+                         scan_mode_worker_item * smwi, struct thread_param * tp);
+void scan_write_record(struct thread_param * tp, unsigned int lane, const char * record, unsigned int attempts);
+void scan_write_answer(struct thread_param * tp, char * msg, size_t len, dnswire_msg * wire, dnswire_meta * meta);
+void scan_answer_meta(dnswire_meta * meta, unsigned int attempts, struct sockaddr_in * from, uint64_t sent_at);
+int scan_write_header(struct scanner_input * si);
+outwriter_ctx * scan_output_init(struct scanner_input * si);
+int scan_capture_init(struct thread_param * tp);
+int scan_input_shard(struct thread_param * tp, unsigned int count);
+void scan_capture_queries(struct thread_param * tp, scan_mode_socket * sms);
+void scan_capture_answers(struct thread_param * tp, scan_mode_socket * sms, udpbatch_ctx * rb);
+void scan_capture(struct thread_param * tp, int proto, int query, struct sockaddr_in * src, struct sockaddr_in * dst,
+                  const char * msg, size_t len, uint64_t time_us);
+void scan_output_tick(struct thread_param * tp);
+void scan_output_release(struct thread_param * tp);
 int udp_socket_send(char * tosend_buffer, size_t tosend_len, int sockfd, struct sockaddr_in server);
 void server_mode_to_log(const char * msg, FILE* fd);
+void server_mode_to_dnstap(server_mode_thread_params * tp, int type, int proto, struct sockaddr_in * client,
+                           const char * msg, size_t len);
 void server_mode_run_all(server_mode_server_param *smsp);
 void switch_server_mode(struct scanner_input *);
 
+// decode mode function declaration
+int switch_decode_mode(struct scanner_input * si);
+void * decode_mode_worker(void * ptr);
+
 
 // scan mode function declaration
 void * tcp_routine_handler(void * ptr);
 void * scan_receiver_routine(void * ptr);
 void * read_item_from_queue(struct thread_param * tp);
+void * try_read_item_from_queue(struct thread_param * tp, int * quit);
+void scan_flush_socket(scan_mode_engine * eng, scan_mode_socket * sms);
+void scan_flush_sockets(scan_mode_engine * eng);
+int scan_engine_send(scan_mode_engine * eng, void * item, unsigned int resolver, int probe);
+void scan_engine_release(scan_mode_engine * eng, scan_mode_worker_item * smwi);
+void scan_engine_expire(scan_mode_engine * eng);
+int scan_engine_retry(scan_mode_engine * eng, scan_mode_worker_item * smwi);
+int scan_engine_pace(scan_mode_engine * eng, unsigned int resolver, uint64_t * wait_ms);
+void scan_engine_resend(scan_mode_engine * eng, scan_mode_worker_item * smwi);
+int scan_engine_hedge(scan_mode_engine * eng, scan_mode_worker_item * smwi);
+void scan_engine_rtt(scan_mode_engine * eng, uint64_t rtt);
+int scan_engine_can_send(scan_mode_engine * eng);
+void scan_engine_adapt(scan_mode_engine * eng, int changed, unsigned int old_window);
+void scan_stateless_init(scan_stateless_ctx * ctx, struct thread_param * tp, int id, int * sock_list, int num_sock);
+void scan_stateless_free(scan_stateless_ctx * ctx);
+void * scan_stateless_sender(void * ptr);
+void * scan_stateless_receiver(void * ptr);
+int scan_stateless_id(struct thread_param * tp, const char * msg, size_t len, uint16_t port, struct sockaddr_in * server, uint16_t * id);
+int bulkdns_same_question(const char * query, size_t query_len, const char * response, size_t response_len);
+void scan_merge_stats(struct thread_param * tp, scan_mode_stats * st);
+void scan_print_stats(struct thread_param * tp);
 
 int init_udp_socket(struct scanner_input * si);
 #ifdef COMPILE_WITH_LUA
 void * scan_lua_worker_routine(void * ptr);
 #endif
-void dns_routine_scan(scan_mode_worker_item*, struct scanner_input * si, char * mem_result);
-int perform_lookup_udp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer, size_t * toreceive_len, struct scanner_input * si, int sockfd);
-int perform_lookup_tcp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer, size_t * toreceive_len, struct scanner_input * si);
+int dns_routine_scan(scan_mode_worker_item*, struct thread_param * tp, char * mem_result);
+int perform_lookup_udp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer, size_t * toreceive_len, struct sockaddr_in * server, struct scanner_input * si, int sockfd);
+int perform_lookup_tcp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer, size_t * toreceive_len, struct sockaddr_in * server, struct scanner_input * si, struct sockaddr_in * local);
 void *scan_worker_routine(void * ptr);
 int convert_type_to_int(char * type);
 int convert_class_to_int(char * cls);
-char * readline(FILE * fp);
 
 #ifdef COMPILE_WITH_LUA
 void lua_dns_routine_scan(void * item, struct scanner_input * si, lua_State * L);
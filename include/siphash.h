@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+// SipHash-2-4: a keyed 64-bit hash. Without the key, nobody can guess
+// the hash of a message, so we use it to sign what we send.
+#define SIPHASH_KEY_SIZE 16
+
+/*function declaration*/
+uint64_t siphash24(const uint8_t * key, const void * data, size_t len);
+
+#endif
@@ -0,0 +1,43 @@
+#include <stdint.h>
+
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+// 4 levels of 64 slots. With 1ms ticks, the wheel covers 2^24ms (~4.6 hours)
+#define TWHEEL_LEVELS 4
+#define TWHEEL_BITS 6
+#define TWHEEL_SLOTS (1 << TWHEEL_BITS)
+#define TWHEEL_MASK (TWHEEL_SLOTS - 1)
+#define TWHEEL_MAX_DELTA ((((uint64_t)1) << (TWHEEL_LEVELS * TWHEEL_BITS)) - 1)
+#define TWHEEL_NO_TIMER UINT64_MAX
+
+// the timer is a part of the object it belongs to (no allocation)
+struct _twheel_timer{
+    struct _twheel_timer * prev;
+    struct _twheel_timer * next;
+    struct _twheel_timer ** slot;   // head of the slot list the timer is linked to
+    uint64_t expires;           // absolute time (in ticks) when the timer fires
+    int pending;                // 1 if the timer is in the wheel
+    void * data;                // the object this timer belongs to
+};
+
+typedef struct _twheel_timer twheel_timer;
+
+struct _twheel_ctx{
+    uint64_t now;                                       // current time of the wheel (in ticks)
+    twheel_timer * slots[TWHEEL_LEVELS][TWHEEL_SLOTS];  // list of timers of each slot
+    twheel_timer * expired;                             // timers of the last tick not returned yet
+    unsigned long int count;                            // number of pending timers
+};
+
+typedef struct _twheel_ctx twheel_ctx;
+
+/*function declaration*/
+twheel_ctx * twheel_init(uint64_t now);
+void twheel_add(twheel_ctx * ctx, twheel_timer * timer, uint64_t expires);
+void twheel_del(twheel_ctx * ctx, twheel_timer * timer);
+twheel_timer * twheel_advance(twheel_ctx * ctx, uint64_t now);
+uint64_t twheel_next_expiry(twheel_ctx * ctx);
+void twheel_free(twheel_ctx * ctx);
+
+#endif
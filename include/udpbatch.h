@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#ifndef UDPBATCH_H
+#define UDPBATCH_H
+
+// the kernel refuses more than UIO_MAXIOV (1024) messages per call
+#define UDPBATCH_MAX_SIZE 1024
+
+typedef struct{
+    unsigned int size;                  // maximum number of messages in the batch
+    unsigned int count;                 // number of messages currently in the batch
+    size_t msg_size;                    // size of the buffer of each message (0: caller's buffers)
+    char * mem;                         // 'size * msg_size' bytes of message buffers
+    struct mmsghdr * msgs;              // what we pass to sendmmsg()/recvmmsg()
+    struct iovec * iov;                 // one iovec per message (points to mem)
+    struct sockaddr_in * addr;          // destination (send) or source (receive) of each message
+    unsigned long int calls;            // number of sendmmsg()/recvmmsg() calls so far
+    unsigned long int messages;         // number of messages moved by those calls
+} udpbatch_ctx;
+
+/*function declaration*/
+udpbatch_ctx * udpbatch_init(unsigned int size, size_t msg_size);
+int udpbatch_add(udpbatch_ctx * ctx, char * buffer, size_t len, struct sockaddr_in * to);
+int udpbatch_send(udpbatch_ctx * ctx, int sockfd);
+int udpbatch_recv(udpbatch_ctx * ctx, int sockfd);
+char * udpbatch_msg(udpbatch_ctx * ctx, unsigned int i, size_t * len);
+struct sockaddr_in * udpbatch_addr(udpbatch_ctx * ctx, unsigned int i);
+void udpbatch_free(udpbatch_ctx * ctx);
+
+#endif
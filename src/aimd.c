@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <aimd.h>
+
+void aimd_init(aimd_ctx * ctx, unsigned int initial, unsigned int min_window, unsigned int max_window){
+    if (min_window == 0)
+        min_window = 1;
+    if (max_window < min_window)
+        max_window = min_window;
+    if (initial < min_window)
+        initial = min_window;
+    if (initial > max_window)
+        initial = max_window;
+    ctx->window = initial;
+    ctx->min_window = min_window;
+    ctx->max_window = max_window;
+    ctx->done = 0;
+    ctx->lost = 0;
+    ctx->rtt_sum = 0;
+    ctx->rtt_count = 0;
+    ctx->base_rtt = 0;
+    ctx->last_loss = 0;
+    ctx->last_rtt = 0;
+}
+
+// close the epoch if it's finished and adjust the window.
+// returns 1 if the window changed and 0 otherwise
+static int aimd_epoch(aimd_ctx * ctx){
+    if (ctx->done < ctx->window || ctx->done < AIMD_MIN_EPOCH)
+        return 0;
+    ctx->last_loss = (double)ctx->lost / ctx->done;
+    ctx->last_rtt = ctx->rtt_count > 0?ctx->rtt_sum / ctx->rtt_count:0;
+    ctx->done = 0;
+    ctx->lost = 0;
+    ctx->rtt_sum = 0;
+    ctx->rtt_count = 0;
+
+    int congested = ctx->last_loss > AIMD_LOSS_LIMIT;
+    if (ctx->last_rtt > 0){
+        if (ctx->base_rtt == 0 || ctx->last_rtt < ctx->base_rtt)
+            ctx->base_rtt = ctx->last_rtt;
+        if (ctx->last_rtt > AIMD_RTT_LIMIT * ctx->base_rtt &&
+            ctx->last_rtt > ctx->base_rtt + AIMD_RTT_MIN_SPIKE)
+            congested = 1;
+    }
+    unsigned int old = ctx->window;
+    if (congested){
+        ctx->window = (unsigned int)(ctx->window * AIMD_DECREASE);
+        if (ctx->window < ctx->min_window)
+            ctx->window = ctx->min_window;
+    }else{
+        ctx->window += AIMD_INCREASE;
+        if (ctx->window > ctx->max_window)
+            ctx->window = ctx->max_window;
+    }
+    return ctx->window != old;
+}
+
+// an answer arrived 'rtt' microseconds after the query was sent.
+// 'rtt' is 0 if we don't know which attempt was answered.
+int aimd_on_answer(aimd_ctx * ctx, uint64_t rtt){
+    ctx->done += 1;
+    if (rtt > 0){
+        ctx->rtt_sum += rtt;
+        ctx->rtt_count += 1;
+    }
+    return aimd_epoch(ctx);
+}
+
+// a query timed out
+int aimd_on_timeout(aimd_ctx * ctx){
+    ctx->done += 1;
+    ctx->lost += 1;
+    return aimd_epoch(ctx);
+}
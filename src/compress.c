@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef COMPILE_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include <compress.h>
+
+// 'gzip' or 'zstd'. returns -1 if we don't know 'name' and -2 if
+// we know it but bulkDNS was compiled without it
+int compress_method(const char * name){
+    if (strcasecmp(name, "gzip") == 0)
+        return COMPRESS_GZIP;
+    if (strcasecmp(name, "zstd") == 0){
+#ifdef COMPILE_WITH_ZSTD
+        return COMPRESS_ZSTD;
+#else
+        return -2;
+#endif
+    }
+    if (strcasecmp(name, "none") == 0)
+        return COMPRESS_NONE;
+    return -1;
+}
+
+int compress_default_level(int method){
+    return method == COMPRESS_ZSTD?COMPRESS_ZSTD_LEVEL:COMPRESS_GZIP_LEVEL;
+}
+
+// returns 0 if 'level' is valid for 'method'
+int compress_check_level(int method, int level){
+#ifdef COMPILE_WITH_ZSTD
+    if (method == COMPRESS_ZSTD)
+        return level >= 1 && level <= ZSTD_maxCLevel()?0:1;
+#endif
+    return level >= 1 && level <= 9?0:1;
+}
+
+compress_ctx * compress_init(int method, int level){
+    compress_ctx * ctx = (compress_ctx*) calloc(1, sizeof(compress_ctx));
+    if (ctx == NULL)
+        return NULL;
+    ctx->method = method;
+    ctx->level = level;
+    if (method == COMPRESS_GZIP){
+        z_stream * zs = (z_stream*) calloc(1, sizeof(z_stream));
+        // 15 + 16: the largest window and a gzip header and trailer
+        if (zs == NULL || deflateInit2(zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+            free(zs);
+            free(ctx);
+            return NULL;
+        }
+        ctx->state = zs;
+    }
+#ifdef COMPILE_WITH_ZSTD
+    if (method == COMPRESS_ZSTD){
+        ctx->state = ZSTD_createCCtx();
+        if (ctx->state == NULL){
+            free(ctx);
+            return NULL;
+        }
+    }
+#endif
+    return ctx;
+}
+
+// append 'data' to 'out' as one gzip member (or zstd frame). returns 0 on success
+int compress_block(compress_ctx * ctx, const char * data, size_t len, jsonenc_buf * out){
+    if (ctx->method == COMPRESS_GZIP){
+        z_stream * zs = (z_stream*) ctx->state;
+        if (deflateReset(zs) != Z_OK)
+            return 1;
+        size_t bound = deflateBound(zs, len);
+        if (jsonenc_reserve(out, bound) != 0)
+            return 1;
+        zs->next_in = (Bytef*) data;
+        zs->avail_in = len;
+        zs->next_out = (Bytef*) out->mem + out->len;
+        zs->avail_out = bound;
+        if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+            return 1;
+        out->len += bound - zs->avail_out;
+        return 0;
+    }
+#ifdef COMPILE_WITH_ZSTD
+    if (ctx->method == COMPRESS_ZSTD){
+        size_t bound = ZSTD_compressBound(len);
+        if (jsonenc_reserve(out, bound) != 0)
+            return 1;
+        size_t res = ZSTD_compressCCtx((ZSTD_CCtx*) ctx->state, out->mem + out->len, bound, data, len, ctx->level);
+        if (ZSTD_isError(res))
+            return 1;
+        out->len += res;
+        return 0;
+    }
+#endif
+    return jsonenc_append(out, data, len);
+}
+
+void compress_free(compress_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    if (ctx->method == COMPRESS_GZIP){
+        deflateEnd((z_stream*) ctx->state);
+        free(ctx->state);
+    }
+#ifdef COMPILE_WITH_ZSTD
+    if (ctx->method == COMPRESS_ZSTD)
+        ZSTD_freeCCtx((ZSTD_CCtx*) ctx->state);
+#endif
+    free(ctx);
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dedup.h>
+
+// 'bloom_mb' is the size of the Bloom filter in MB (0: the exact hash set)
+dedup_ctx * dedup_init(const uint8_t * key, size_t bloom_mb){
+    dedup_ctx * ctx = (dedup_ctx*) calloc(1, sizeof(dedup_ctx));
+    if (ctx == NULL){
+        fprintf(stderr, "Can not initialize the deduplication of the input\n");
+        return NULL;
+    }
+    memcpy(ctx->key, key, SIPHASH_KEY_SIZE);
+    if (bloom_mb > 0){
+        ctx->bloom_bits = (uint64_t)bloom_mb * 1024 * 1024 * 8;
+        ctx->bloom = (uint64_t*) calloc(ctx->bloom_bits / 64, sizeof(uint64_t));
+        if (ctx->bloom == NULL){
+            fprintf(stderr, "Can not allocate %zu MB for the Bloom filter\n", bloom_mb);
+            free(ctx);
+            return NULL;
+        }
+        return ctx;
+    }
+    ctx->stripes = (dedup_stripe*) calloc(DEDUP_STRIPES, sizeof(dedup_stripe));
+    if (ctx->stripes == NULL){
+        fprintf(stderr, "Can not initialize the deduplication of the input\n");
+        free(ctx);
+        return NULL;
+    }
+    for (int i=0; i<DEDUP_STRIPES; ++i){
+        dedup_stripe * s = &(ctx->stripes[i]);
+        pthread_mutex_init(&(s->lock), NULL);
+        s->slots = (uint64_t*) calloc(DEDUP_STRIPE_SLOTS, sizeof(uint64_t));
+        s->mask = DEDUP_STRIPE_SLOTS - 1;
+        if (s->slots == NULL){
+            fprintf(stderr, "Can not initialize the deduplication of the input\n");
+            dedup_free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+// the hash of 'name' in lowercase without the trailing dot (never 0)
+static uint64_t dedup_hash(dedup_ctx * ctx, const char * name, size_t len){
+    char lower[DEDUP_MAX_NAME];
+    if (len > 0 && name[len - 1] == '.')
+        len--;
+    for (size_t i=0; i<len; ++i){
+        char c = name[i];
+        lower[i] = (c >= 'A' && c <= 'Z')?c + ('a' - 'A'):c;
+    }
+    uint64_t hash = siphash24(ctx->key, lower, len);
+    return hash == 0?1:hash;
+}
+
+// the slots of 'hash' are taken from its low bits, the stripe from the high ones
+static size_t dedup_find(uint64_t * slots, size_t mask, uint64_t hash){
+    size_t i = hash & mask;
+    while (slots[i] != 0 && slots[i] != hash)
+        i = (i + 1) & mask;
+    return i;
+}
+
+// twice as many slots. returns 1 if we can't allocate them
+static int dedup_grow(dedup_stripe * s){
+    size_t mask = s->mask * 2 + 1;
+    uint64_t * slots = (uint64_t*) calloc(mask + 1, sizeof(uint64_t));
+    if (slots == NULL)
+        return 1;
+    for (size_t i=0; i<=s->mask; ++i){
+        if (s->slots[i] != 0)
+            slots[dedup_find(slots, mask, s->slots[i])] = s->slots[i];
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->mask = mask;
+    return 0;
+}
+
+static int dedup_set_seen(dedup_ctx * ctx, uint64_t hash){
+    dedup_stripe * s = &(ctx->stripes[hash >> 58]);
+    int seen = 1;
+    pthread_mutex_lock(&(s->lock));
+    size_t i = dedup_find(s->slots, s->mask, hash);
+    if (s->slots[i] == 0){
+        seen = 0;
+        // we keep one empty slot, so dedup_find() always stops: without
+        // memory, the names which don't fit are queried even if they repeat
+        if (s->count < s->mask){
+            s->slots[i] = hash;
+            s->count += 1;
+        }
+        if (s->count * 2 > s->mask && dedup_grow(s) != 0 && s->count * 2 == s->mask + 1)
+            fprintf(stderr, "WARNING: Can not grow the deduplication set\n");
+    }
+    pthread_mutex_unlock(&(s->lock));
+    return seen;
+}
+
+// all the bits of 'hash' were set before us. The bits come from 'hash' and
+// a second hash made from it (double hashing). Two threads which add the
+// same name at the same time may both find it new: it's queried twice.
+static int dedup_bloom_seen(dedup_ctx * ctx, uint64_t hash){
+    uint64_t step = hash * 0x9E3779B97F4A7C15ULL;
+    step = (step ^ (step >> 31)) | 1;
+    int seen = 1;
+    for (int i=0; i<DEDUP_BLOOM_HASHES; ++i){
+        uint64_t bit = (hash + (uint64_t)i * step) % ctx->bloom_bits;
+        uint64_t mask = 1ULL << (bit & 63);
+        if ((__atomic_fetch_or(&(ctx->bloom[bit >> 6]), mask, __ATOMIC_RELAXED) & mask) == 0)
+            seen = 0;
+    }
+    return seen;
+}
+
+// 1 if we saw 'name' ('len' characters) before, 0 if it's new (we remember
+// it). Any thread may call it.
+int dedup_seen(dedup_ctx * ctx, const char * name, size_t len){
+    if (len > DEDUP_MAX_NAME)
+        return 0;
+    uint64_t hash = dedup_hash(ctx, name, len);
+    int seen = ctx->bloom != NULL?dedup_bloom_seen(ctx, hash):dedup_set_seen(ctx, hash);
+    if (seen)
+        __atomic_fetch_add(&(ctx->duplicates), 1, __ATOMIC_RELAXED);
+    return seen;
+}
+
+// bytes we use for the hashes (for '--stats')
+size_t dedup_memory(dedup_ctx * ctx){
+    if (ctx->bloom != NULL)
+        return ctx->bloom_bits / 8;
+    size_t bytes = 0;
+    for (int i=0; i<DEDUP_STRIPES; ++i)
+        bytes += (ctx->stripes[i].mask + 1) * sizeof(uint64_t);
+    return bytes;
+}
+
+void dedup_free(dedup_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    for (int i=0; ctx->stripes != NULL && i<DEDUP_STRIPES; ++i){
+        pthread_mutex_destroy(&(ctx->stripes[i].lock));
+        free(ctx->stripes[i].slots);
+    }
+    free(ctx->stripes);
+    free(ctx->bloom);
+    free(ctx);
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <dnstap.h>
+
+// protobuf wire types
+#define DNSTAP_PB_VARINT 0
+#define DNSTAP_PB_BYTES 2
+#define DNSTAP_PB_FIXED32 5
+
+// a frame is its length (4 bytes) and the Dnstap message: a few bytes of
+// header fields, the Message fields and the DNS message
+#define DNSTAP_FRAME_ROOM 128
+
+static inline void dnstap_put32(char * p, uint32_t value){
+    p[0] = value >> 24;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+static inline uint32_t dnstap_get32(const char * p){
+    return ((uint32_t)(uint8_t)p[0] << 24) | ((uint32_t)(uint8_t)p[1] << 16) |
+           ((uint32_t)(uint8_t)p[2] << 8) | (uint8_t)p[3];
+}
+
+static inline size_t dnstap_varint_size(uint64_t value){
+    size_t n = 1;
+    while (value >= 0x80){
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static inline char * dnstap_varint(char * p, uint64_t value){
+    while (value >= 0x80){
+        *p++ = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *p++ = (char)value;
+    return p;
+}
+
+static inline char * dnstap_key(char * p, unsigned int field, unsigned int wire_type){
+    return dnstap_varint(p, (field << 3) | wire_type);
+}
+
+static inline char * dnstap_uint(char * p, unsigned int field, uint64_t value){
+    return dnstap_varint(dnstap_key(p, field, DNSTAP_PB_VARINT), value);
+}
+
+static inline char * dnstap_fixed32(char * p, unsigned int field, uint32_t value){
+    p = dnstap_key(p, field, DNSTAP_PB_FIXED32);
+    p[0] = value & 0xFF;          // little endian
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+static inline char * dnstap_bytes(char * p, unsigned int field, const void * data, size_t len){
+    p = dnstap_varint(dnstap_key(p, field, DNSTAP_PB_BYTES), len);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static int dnstap_write_all(int fd, const char * data, size_t len){
+    while (len > 0){
+        ssize_t res = write(fd, data, len);
+        if (res < 0){
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+static int dnstap_read_all(int fd, char * data, size_t len){
+    while (len > 0){
+        ssize_t res = read(fd, data, len);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return 1;
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+// write a control frame of 'type' (with our content type, except for STOP)
+static int dnstap_control(int fd, uint32_t type){
+    char frame[12 + 8 + sizeof(DNSTAP_CONTENT_TYPE)];
+    size_t content = type == DNSTAP_FSTRM_STOP?0:strlen(DNSTAP_CONTENT_TYPE);
+    size_t len = 4 + (content > 0?8 + content:0);
+    dnstap_put32(frame, 0);             // the escape: a data frame of length 0
+    dnstap_put32(frame + 4, (uint32_t)len);
+    dnstap_put32(frame + 8, type);
+    if (content > 0){
+        dnstap_put32(frame + 12, DNSTAP_FSTRM_CONTENT_TYPE);
+        dnstap_put32(frame + 16, (uint32_t)content);
+        memcpy(frame + 20, DNSTAP_CONTENT_TYPE, content);
+    }
+    return dnstap_write_all(fd, frame, 8 + len);
+}
+
+// read the control frame the collector sends us. returns its type (0 on error)
+static uint32_t dnstap_read_control(int fd){
+    char frame[DNSTAP_MAX_CONTROL];
+    if (dnstap_read_all(fd, frame, 8) != 0 || dnstap_get32(frame) != 0)
+        return 0;
+    uint32_t len = dnstap_get32(frame + 4);
+    if (len < 4 || len > DNSTAP_MAX_CONTROL || dnstap_read_all(fd, frame, len) != 0)
+        return 0;
+    return dnstap_get32(frame);
+}
+
+// connect to the collector at 'path' and agree on the content type
+static int dnstap_connect(const char * path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "ERROR: The path of the dnstap socket is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1){
+        perror("ERROR: Can not create the dnstap socket");
+        return -1;
+    }
+    struct timeval tv = {.tv_sec = DNSTAP_HANDSHAKE_TIMEOUT, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0){
+        perror("ERROR: Can not connect to the dnstap socket");
+        close(fd);
+        return -1;
+    }
+    if (dnstap_control(fd, DNSTAP_FSTRM_READY) != 0 || dnstap_read_control(fd) != DNSTAP_FSTRM_ACCEPT){
+        fprintf(stderr, "ERROR: The dnstap collector did not accept '%s'\n", DNSTAP_CONTENT_TYPE);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 'dest' is a file name or 'unix:<path>' for a collector. We start the
+// stream: after this, the caller only writes data frames to 'fd'.
+dnstap_ctx * dnstap_open(const char * dest){
+    dnstap_ctx * ctx = (dnstap_ctx*) calloc(1, sizeof(dnstap_ctx));
+    if (ctx == NULL){
+        fprintf(stderr, "Can not initialize the dnstap output\n");
+        return NULL;
+    }
+    if (gethostname(ctx->identity, DNSTAP_MAX_IDENTITY) != 0)
+        ctx->identity[0] = '\0';
+    ctx->identity[DNSTAP_MAX_IDENTITY] = '\0';
+    ctx->identity_len = strlen(ctx->identity);
+    if (strncmp(dest, "unix:", 5) == 0){
+        ctx->is_socket = 1;
+        ctx->fd = dnstap_connect(dest + 5);
+    }else{
+        ctx->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (ctx->fd == -1)
+            perror("ERROR: Can not open the dnstap file");
+    }
+    if (ctx->fd == -1){
+        free(ctx);
+        return NULL;
+    }
+    if (dnstap_control(ctx->fd, DNSTAP_FSTRM_START) != 0){
+        perror("ERROR: Can not write the dnstap output");
+        close(ctx->fd);
+        free(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&(ctx->lock), NULL);
+    return ctx;
+}
+
+// append one data frame to 'buf': a dnstap Message of 'type' for 'msg'.
+// 'query_addr' sent the query and 'response_addr' answers it, whatever
+// the type is. 'time_us' is the unix time of 'msg'. returns 0 on success
+int dnstap_append(dnstap_ctx * ctx, jsonenc_buf * buf, int type, int proto, const struct sockaddr_in * query_addr,
+                  const struct sockaddr_in * response_addr, const char * msg, size_t len, uint64_t time_us){
+    if (jsonenc_reserve(buf, DNSTAP_FRAME_ROOM + ctx->identity_len + len) != 0)
+        return 1;
+    int response = type == DNSTAP_RESOLVER_RESPONSE || type == DNSTAP_CLIENT_RESPONSE;
+    uint64_t sec = time_us / 1000000;
+    uint32_t nsec = (uint32_t)(time_us % 1000000) * 1000;
+    // the Message goes after the header fields of the Dnstap. Its length
+    // is known once it's written, so we make room for it afterwards.
+    char * frame = buf->mem + buf->len;
+    char * p = frame + 4;
+    p = dnstap_bytes(p, 1, ctx->identity, ctx->identity_len);
+    p = dnstap_bytes(p, 2, DNSTAP_VERSION, strlen(DNSTAP_VERSION));
+    p = dnstap_uint(p, 15, 1);                  // Dnstap.type: MESSAGE
+    p = dnstap_key(p, 14, DNSTAP_PB_BYTES);
+    char * start = p + 1;                       // one byte for the length if it's short
+    char * m = start;
+    m = dnstap_uint(m, 1, type);
+    m = dnstap_uint(m, 2, 1);                   // socket_family: INET
+    m = dnstap_uint(m, 3, proto);
+    m = dnstap_bytes(m, 4, &(query_addr->sin_addr.s_addr), 4);
+    m = dnstap_bytes(m, 5, &(response_addr->sin_addr.s_addr), 4);
+    m = dnstap_uint(m, 6, ntohs(query_addr->sin_port));
+    m = dnstap_uint(m, 7, ntohs(response_addr->sin_port));
+    if (response){
+        m = dnstap_uint(m, 12, sec);
+        m = dnstap_fixed32(m, 13, nsec);
+        m = dnstap_bytes(m, 14, msg, len);
+    }else{
+        m = dnstap_uint(m, 8, sec);
+        m = dnstap_fixed32(m, 9, nsec);
+        m = dnstap_bytes(m, 10, msg, len);
+    }
+    size_t message_len = m - start;
+    size_t shift = dnstap_varint_size(message_len) - 1;
+    if (shift > 0)
+        memmove(start + shift, start, message_len);
+    p = dnstap_varint(p, message_len) + message_len;
+    dnstap_put32(frame, (uint32_t)(p - frame - 4));
+    buf->len += p - frame;
+    return 0;
+}
+
+// write 'data' (whole frames) to the output. It's for the callers without
+// an output writer: the frames of two threads are never mixed.
+int dnstap_write(dnstap_ctx * ctx, const char * data, size_t len){
+    pthread_mutex_lock(&(ctx->lock));
+    int res = dnstap_write_all(ctx->fd, data, len);
+    pthread_mutex_unlock(&(ctx->lock));
+    return res;
+}
+
+// end the stream (a collector tells us it got everything) and close it
+void dnstap_close(dnstap_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    if (dnstap_control(ctx->fd, DNSTAP_FSTRM_STOP) == 0 && ctx->is_socket &&
+        dnstap_read_control(ctx->fd) != DNSTAP_FSTRM_FINISH)
+        fprintf(stderr, "WARNING: The dnstap collector did not confirm the end of the stream\n");
+    close(ctx->fd);
+    pthread_mutex_destroy(&(ctx->lock));
+    free(ctx);
+}
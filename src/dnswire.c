@@ -0,0 +1,150 @@
+#include <string.h>
+#include <dnswire.h>
+
+static inline uint16_t dnswire_u16(const char * p){
+    return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+}
+
+static inline uint32_t dnswire_u32(const char * p){
+    return ((uint32_t)dnswire_u16(p) << 16) | dnswire_u16(p + 2);
+}
+
+// move 'pos' after the name that starts there (a pointer ends the name).
+// returns 0 on success and 1 if the name is not valid.
+int dnswire_skip_name(const char * msg, size_t len, size_t * pos){
+    size_t p = *pos;
+    while (p < len){
+        uint8_t label = (uint8_t)msg[p];
+        if (label == 0){
+            *pos = p + 1;
+            return 0;
+        }
+        if ((label & 0xC0) == 0xC0){
+            if (p + 2 > len)
+                return 1;
+            *pos = p + 2;
+            return 0;
+        }
+        if ((label & 0xC0) != 0)
+            return 1;           // extended label types are not used
+        p += label + 1;
+    }
+    return 1;
+}
+
+// read the record at 'pos' and move 'pos' after it.
+// returns 0 on success and 1 if the record is not valid.
+int dnswire_next_rr(const char * msg, size_t len, size_t * pos, dnswire_rr * rr){
+    size_t p = *pos;
+    rr->name = p;
+    if (dnswire_skip_name(msg, len, &p) != 0 || p + 10 > len)
+        return 1;
+    rr->type = dnswire_u16(msg + p);
+    rr->rr_class = dnswire_u16(msg + p + 2);
+    rr->ttl = dnswire_u32(msg + p + 4);
+    rr->rdlen = dnswire_u16(msg + p + 8);
+    rr->rdata = p + 10;
+    if (rr->rdata + rr->rdlen > len)
+        return 1;
+    *pos = rr->rdata + rr->rdlen;
+    return 0;
+}
+
+// check the header and the question of 'msg' and walk its records.
+// returns 0 if the header and the question are valid ('wire->complete'
+// tells if the records are valid too: a truncated answer may be cut).
+int dnswire_parse(const char * msg, size_t len, dnswire_msg * wire){
+    memset(wire, 0, sizeof(dnswire_msg));
+    if (len < DNSWIRE_HEADER_SIZE)
+        return 1;
+    wire->id = dnswire_u16(msg);
+    uint8_t flags1 = (uint8_t)msg[2];
+    uint8_t flags2 = (uint8_t)msg[3];
+    wire->qr = (flags1 >> 7) & 1;
+    wire->opcode = (flags1 >> 3) & 0x0F;
+    wire->aa = (flags1 >> 2) & 1;
+    wire->tc = (flags1 >> 1) & 1;
+    wire->rd = flags1 & 1;
+    wire->ra = (flags2 >> 7) & 1;
+    wire->rcode = flags2 & 0x0F;
+    wire->qdcount = dnswire_u16(msg + 4);
+    wire->ancount = dnswire_u16(msg + 6);
+    wire->nscount = dnswire_u16(msg + 8);
+    wire->arcount = dnswire_u16(msg + 10);
+    if (wire->qdcount != 1)
+        return 1;           // we always send one question
+    size_t pos = DNSWIRE_HEADER_SIZE;
+    wire->qname = pos;
+    // no pointer in the question: it's the first name of the message
+    while (pos < len && msg[pos] != 0){
+        if (((uint8_t)msg[pos] & 0xC0) != 0)
+            return 1;
+        pos += (uint8_t)msg[pos] + 1;
+    }
+    if (pos + 5 > len)
+        return 1;
+    wire->qtype = dnswire_u16(msg + pos + 1);
+    wire->qclass = dnswire_u16(msg + pos + 3);
+    pos += 5;
+    wire->records = pos;
+    unsigned int count = (unsigned int)wire->ancount + wire->nscount + wire->arcount;
+    dnswire_rr rr;
+    for (unsigned int i=0; i<count; ++i){
+        if (dnswire_next_rr(msg, len, &pos, &rr) != 0)
+            return 0;
+        if (rr.type == DNSWIRE_TYPE_OPT && i >= (unsigned int)wire->ancount + wire->nscount){
+            wire->edns = 1;
+            wire->udp_size = rr.rr_class;
+            wire->rcode |= (rr.ttl >> 24) << 4;
+        }
+    }
+    wire->complete = 1;
+    return 0;
+}
+
+// write the name at 'pos' as text ("a.b.c", "." for the root) to 'name'
+// following the compression pointers. returns 0 on success and 1 if the
+// name is not valid or longer than 'size'.
+int dnswire_name_to_text(const char * msg, size_t len, size_t pos, char * name, size_t size){
+    size_t out = 0;
+    unsigned int pointers = 0;
+    if (size < 2)
+        return 1;
+    while (pos < len){
+        uint8_t label = (uint8_t)msg[pos];
+        if (label == 0){
+            if (out == 0)
+                name[out++] = '.';
+            name[out] = '\0';
+            return 0;
+        }
+        if ((label & 0xC0) == 0xC0){
+            if (pos + 2 > len || ++pointers > DNSWIRE_MAX_POINTERS)
+                return 1;
+            pos = ((label & 0x3F) << 8) | (uint8_t)msg[pos + 1];
+            continue;
+        }
+        if ((label & 0xC0) != 0 || pos + 1 + label > len || out + label + 2 > size)
+            return 1;
+        if (out > 0)
+            name[out++] = '.';
+        memcpy(name + out, msg + pos + 1, label);
+        out += label;
+        pos += label + 1;
+    }
+    return 1;
+}
+
+// hash (FNV-1a) of the name of the question, whatever its case, so the
+// answers for one name always get the same value. 'wire' comes from
+// dnswire_parse(), which checked the name.
+uint32_t dnswire_qname_hash(const char * msg, const dnswire_msg * wire){
+    uint32_t hash = 2166136261u;
+    for (size_t pos = wire->qname; pos < wire->records && msg[pos] != 0; ++pos){
+        uint8_t c = (uint8_t)msg[pos];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
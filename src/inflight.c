@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inflight.h>
+
+static inline unsigned long int inflight_hash(uint64_t key){
+    // a 64-bit mixer (from splitmix64) so that consecutive
+    // sockets and IDs spread over the whole table
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (unsigned long int)key;
+}
+
+inflight_ctx * inflight_init(unsigned long int max_items){
+    // the table is never more than half full
+    unsigned long int capacity = 16;
+    while (capacity < 2 * max_items)
+        capacity <<= 1;
+    inflight_ctx * ctx = (inflight_ctx*) malloc(sizeof(inflight_ctx));
+    if (!ctx){
+        fprintf(stderr, "Can not initialize the in-flight table\n");
+        return NULL;
+    }
+    ctx->entries = (struct _inflight_entry*) malloc(capacity * sizeof(struct _inflight_entry));
+    if (!ctx->entries){
+        fprintf(stderr, "Can not allocate memory for the in-flight table\n");
+        free(ctx);
+        return NULL;
+    }
+    for (unsigned long int i=0; i<capacity; ++i)
+        ctx->entries[i].key = INFLIGHT_EMPTY_KEY;
+    ctx->mask = capacity - 1;
+    ctx->count = 0;
+    return ctx;
+}
+
+// add a key to the table
+// return 0 on success, 1 if the key already exists
+// and 2 if the table is full
+int inflight_put(inflight_ctx * ctx, uint64_t key, unsigned int value){
+    if (ctx->count >= (ctx->mask + 1) / 2)
+        return 2;
+    unsigned long int i = inflight_hash(key) & ctx->mask;
+    while (ctx->entries[i].key != INFLIGHT_EMPTY_KEY){
+        if (ctx->entries[i].key == key)
+            return 1;
+        i = (i + 1) & ctx->mask;
+    }
+    ctx->entries[i].key = key;
+    ctx->entries[i].value = value;
+    ctx->count += 1;
+    return 0;
+}
+
+// return the value of the key or INFLIGHT_NOT_FOUND
+long int inflight_get(inflight_ctx * ctx, uint64_t key){
+    unsigned long int i = inflight_hash(key) & ctx->mask;
+    while (ctx->entries[i].key != INFLIGHT_EMPTY_KEY){
+        if (ctx->entries[i].key == key)
+            return ctx->entries[i].value;
+        i = (i + 1) & ctx->mask;
+    }
+    return INFLIGHT_NOT_FOUND;
+}
+
+// remove the key from the table
+// return 0 on success and 1 if the key does not exist
+int inflight_del(inflight_ctx * ctx, uint64_t key){
+    unsigned long int i = inflight_hash(key) & ctx->mask;
+    while (ctx->entries[i].key != key){
+        if (ctx->entries[i].key == INFLIGHT_EMPTY_KEY)
+            return 1;
+        i = (i + 1) & ctx->mask;
+    }
+    // backward-shift deletion: move the following entries of the
+    // same cluster back so that we never need tombstones.
+    unsigned long int j = i;
+    while (1){
+        j = (j + 1) & ctx->mask;
+        if (ctx->entries[j].key == INFLIGHT_EMPTY_KEY)
+            break;
+        unsigned long int home = inflight_hash(ctx->entries[j].key) & ctx->mask;
+        // can the entry at 'j' move to 'i'? only if its home is not in (i, j]
+        if (((j - home) & ctx->mask) >= ((j - i) & ctx->mask)){
+            ctx->entries[i] = ctx->entries[j];
+            i = j;
+        }
+    }
+    ctx->entries[i].key = INFLIGHT_EMPTY_KEY;
+    ctx->count -= 1;
+    return 0;
+}
+
+void inflight_free(inflight_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    free(ctx->entries);
+    free(ctx);
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <inreader.h>
+
+// read the input 'fd' (which stays open). returns NULL on error
+inreader_ctx * inreader_open(int fd){
+    inreader_ctx * r = (inreader_ctx*) calloc(1, sizeof(inreader_ctx));
+    if (r == NULL){
+        fprintf(stderr, "Can not initialize the input reader\n");
+        return NULL;
+    }
+    r->fd = fd;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        void * map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED){
+            // the kernel reads ahead and drops the pages behind us
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            r->map = (char*) map;
+            r->map_len = (size_t)st.st_size;
+            r->end = r->map_len;
+            return r;
+        }
+    }
+    // a pipe, a terminal or a file we can't map
+    r->size = INREADER_CHUNK_SIZE;
+    r->buf = (char*) malloc(r->size);
+    if (r->buf == NULL){
+        fprintf(stderr, "Can not allocate memory for the input\n");
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// keep the incomplete line at the start of 'buf' and read after it
+static void inreader_fill(inreader_ctx * r){
+    if (r->start > 0){
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->size){
+        // a line longer than the buffer
+        char * mem = (char*) realloc(r->buf, r->size * 2);
+        if (mem == NULL){
+            fprintf(stderr, "Can not allocate memory for the input\n");
+            r->eof = 1;
+            return;
+        }
+        r->buf = mem;
+        r->size *= 2;
+    }
+    while (1){
+        ssize_t res = read(r->fd, r->buf + r->end, r->size - r->end);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            perror("ERROR: Can not read the input");
+        if (res <= 0){
+            r->eof = 1;
+            return;
+        }
+        r->end += res;
+        return;
+    }
+}
+
+// the names before 'start' were copied: drop the pages of the mapping we
+// read, so a large input doesn't stay in our RSS until the end of the scan
+static void inreader_drop(inreader_ctx * r){
+    size_t upto = r->start - r->start % INREADER_CHUNK_SIZE;
+    if (upto <= r->dropped)
+        return;
+    madvise(r->map + r->dropped, upto - r->dropped, MADV_DONTNEED);
+    r->dropped = upto;
+}
+
+// the next name of the input: 'name' points to its 'len' characters (not
+// null-terminated) until the next call. returns 1 if there is a name and
+// 0 at the end of the input.
+int inreader_next(inreader_ctx * r, const char ** name, size_t * len){
+    if (r->map != NULL)
+        inreader_drop(r);
+    while (1){
+        char * line = (r->map != NULL?r->map:r->buf) + r->start;
+        size_t avail = r->end - r->start;
+        char * nl = avail > 0?(char*) memchr(line, '\n', avail):NULL;
+        size_t line_len;
+        if (nl != NULL){
+            line_len = nl - line;
+            r->start += line_len + 1;
+        }else if (r->map == NULL && !r->eof){
+            inreader_fill(r);
+            continue;
+        }else if (avail > 0){
+            line_len = avail;       // the last line has no '\n'
+            r->start = r->end;
+        }else{
+            return 0;
+        }
+        *name = line;
+        *len = line_len;
+        if (inreader_trim(name, len) == 0)
+            continue;       // a blank line
+        r->names += 1;
+        return 1;
+    }
+}
+
+void inreader_free(inreader_ctx * r){
+    if (r == NULL)
+        return;
+    if (r->map != NULL)
+        munmap(r->map, r->map_len);
+    free(r->buf);
+    free(r);
+}
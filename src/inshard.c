@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <inreader.h>
+#include <inshard.h>
+
+// map the input 'fd' (which stays open) and cut it in 'count' ranges of
+// the same size. returns NULL if it's not a file we can map (a pipe, stdin)
+inshard_ctx * inshard_open(int fd, unsigned int count){
+    struct stat st;
+    if (count == 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+    void * map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    inshard_ctx * ctx = (inshard_ctx*) calloc(1, sizeof(inshard_ctx));
+    inshard_range * ranges = (inshard_range*) calloc(count, sizeof(inshard_range));
+    if (ctx == NULL || ranges == NULL){
+        fprintf(stderr, "Can not initialize the input shards\n");
+        munmap(map, (size_t)st.st_size);
+        free(ctx);
+        free(ranges);
+        return NULL;
+    }
+    ctx->map = (char*) map;
+    ctx->map_len = (size_t)st.st_size;
+    ctx->count = count;
+    ctx->ranges = ranges;
+    for (unsigned int i=0; i<count; ++i){
+        pthread_mutex_init(&(ranges[i].lock), NULL);
+        ranges[i].start = ctx->map_len / count * i;
+        ranges[i].end = i + 1 == count?ctx->map_len:ctx->map_len / count * (i + 1);
+    }
+    return ctx;
+}
+
+// the calling thread takes the next range. returns 0 on success and 1 if
+// all the ranges are taken (we have more threads than ranges)
+int inshard_join(inshard_ctx * ctx, inshard_cursor * cur){
+    unsigned int id = __atomic_fetch_add(&(ctx->joined), 1, __ATOMIC_RELAXED);
+    if (id >= ctx->count)
+        return 1;
+    memset(cur, 0, sizeof(inshard_cursor));
+    cur->id = id;
+    return 0;
+}
+
+// [start, end) is the next chunk of the thread: its first line is after
+// the first '\n' unless the chunk starts a line
+static void inshard_set_chunk(inshard_ctx * ctx, inshard_cursor * cur, size_t start, size_t end){
+    cur->chunk_start = start;
+    cur->chunk_end = end;
+    cur->pos = start;
+    if (start > 0 && ctx->map[start - 1] != '\n'){
+        char * nl = (char*) memchr(ctx->map + start, '\n', ctx->map_len - start);
+        cur->pos = nl == NULL?ctx->map_len:(size_t)(nl - ctx->map) + 1;
+    }
+}
+
+// a chunk of our range. returns 1 if it's empty
+static int inshard_take_own(inshard_ctx * ctx, inshard_cursor * cur){
+    inshard_range * own = &(ctx->ranges[cur->id]);
+    pthread_mutex_lock(&(own->lock));
+    size_t start = own->start;
+    size_t end = own->end;
+    if (end - start > INSHARD_CHUNK_SIZE)
+        end = start + INSHARD_CHUNK_SIZE;
+    __atomic_store_n(&(own->start), end, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&(own->lock));
+    if (start == end)
+        return 1;
+    inshard_set_chunk(ctx, cur, start, end);
+    return 0;
+}
+
+// our range is empty: move the second half of the largest range to ours
+// (or take what's left of it if it's less than two chunks). returns 1 if
+// there is nothing left to steal
+static int inshard_steal(inshard_ctx * ctx, inshard_cursor * cur){
+    while (1){
+        inshard_range * victim = NULL;
+        size_t largest = 0;
+        for (unsigned int i=0; i<ctx->count; ++i){
+            inshard_range * r = &(ctx->ranges[i]);
+            size_t start = __atomic_load_n(&(r->start), __ATOMIC_RELAXED);
+            size_t end = __atomic_load_n(&(r->end), __ATOMIC_RELAXED);
+            if (end > start && end - start > largest){
+                largest = end - start;
+                victim = r;
+            }
+        }
+        if (victim == NULL)
+            return 1;
+        pthread_mutex_lock(&(victim->lock));
+        size_t start = victim->start;
+        size_t end = victim->end;
+        if (start == end){
+            // its owner (or another thief) was faster
+            pthread_mutex_unlock(&(victim->lock));
+            continue;
+        }
+        if (end - start < 2 * INSHARD_CHUNK_SIZE){
+            __atomic_store_n(&(victim->start), end, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&(victim->lock));
+            inshard_set_chunk(ctx, cur, start, end);
+        }else{
+            size_t mid = start + (end - start) / 2;
+            __atomic_store_n(&(victim->end), mid, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&(victim->lock));
+            inshard_range * own = &(ctx->ranges[cur->id]);
+            pthread_mutex_lock(&(own->lock));
+            __atomic_store_n(&(own->start), mid, __ATOMIC_RELAXED);
+            __atomic_store_n(&(own->end), end, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&(own->lock));
+        }
+        __atomic_fetch_add(&(ctx->steals), 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+}
+
+// the names of the chunk were copied: drop the pages of the chunk before
+// it, so the input doesn't stay in our RSS until the end of the scan. Not
+// the pages of this one: the first fault in the next chunk maps the pages
+// around it again (fault-around), this chunk included.
+static void inshard_drop(inshard_ctx * ctx, inshard_cursor * cur){
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t from = (cur->done_start + page - 1) / page * page;
+    size_t to = cur->done_end / page * page;
+    if (to > from)
+        madvise(ctx->map + from, to - from, MADV_DONTNEED);
+    cur->done_start = cur->chunk_start;
+    cur->done_end = cur->chunk_end;
+}
+
+// the next name of the thread: 'name' points to its 'len' characters (not
+// null-terminated) in the mapping. returns 1 if there is a name and 0 once
+// the whole input was read.
+int inshard_next(inshard_ctx * ctx, inshard_cursor * cur, const char ** name, size_t * len){
+    while (1){
+        if (cur->pos < cur->chunk_end){
+            // a line starts at 'pos': it may end in the next chunk
+            char * line = ctx->map + cur->pos;
+            size_t avail = ctx->map_len - cur->pos;
+            char * nl = (char*) memchr(line, '\n', avail);
+            size_t line_len = nl == NULL?avail:(size_t)(nl - line);
+            cur->pos += line_len + 1;
+            *name = line;
+            *len = line_len;
+            if (inreader_trim(name, len) == 0)
+                continue;       // a blank line
+            return 1;
+        }
+        if (cur->chunk_end > cur->chunk_start){
+            inshard_drop(ctx, cur);
+            cur->chunk_start = cur->chunk_end;
+        }
+        if (inshard_take_own(ctx, cur) == 0)
+            continue;
+        if (inshard_steal(ctx, cur) != 0)
+            return 0;
+    }
+}
+
+void inshard_free(inshard_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    for (unsigned int i=0; i<ctx->count; ++i)
+        pthread_mutex_destroy(&(ctx->ranges[i].lock));
+    munmap(ctx->map, ctx->map_len);
+    free(ctx->ranges);
+    free(ctx);
+}
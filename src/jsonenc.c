@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <jsonenc.h>
+
+static const char * jsonenc_hex_digits = "0123456789abcdef";
+
+// jsonenc_name() and jsonenc_key_string() return it when the string is not
+// valid UTF-8: jansson refuses such a string, so sdns leaves the member out
+#define JSONENC_INVALID 2
+
+static inline uint16_t jsonenc_u16(const char * p){
+    return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+}
+
+static inline uint32_t jsonenc_u32(const char * p){
+    return ((uint32_t)jsonenc_u16(p) << 16) | jsonenc_u16(p + 2);
+}
+
+int jsonenc_init(jsonenc_buf * buf){
+    buf->len = 0;
+    buf->size = JSONENC_INITIAL_SIZE;
+    buf->mem = (char*) malloc(buf->size);
+    if (buf->mem == NULL){
+        fprintf(stderr, "Can not allocate memory for the JSON buffer\n");
+        buf->size = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void jsonenc_free(jsonenc_buf * buf){
+    free(buf->mem);
+    buf->mem = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+// make room for 'n' more bytes. returns 0 on success and 1 if we can't
+int jsonenc_reserve(jsonenc_buf * buf, size_t n){
+    if (buf->len + n <= buf->size)
+        return 0;
+    size_t size = buf->size > 0?buf->size:JSONENC_INITIAL_SIZE;
+    while (size < buf->len + n)
+        size *= 2;
+    char * tmp = (char*) realloc(buf->mem, size);
+    if (tmp == NULL)
+        return 1;
+    buf->mem = tmp;
+    buf->size = size;
+    return 0;
+}
+
+int jsonenc_append(jsonenc_buf * buf, const char * data, size_t len){
+    if (jsonenc_reserve(buf, len) != 0)
+        return 1;
+    memcpy(buf->mem + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static inline int jsonenc_str(jsonenc_buf * buf, const char * str){
+    return jsonenc_append(buf, str, strlen(str));
+}
+
+int jsonenc_uint(jsonenc_buf * buf, uint64_t value){
+    char tmp[24];
+    int pos = sizeof(tmp);
+    do{
+        tmp[--pos] = '0' + (value % 10);
+        value /= 10;
+    }while (value > 0);
+    return jsonenc_append(buf, tmp + pos, sizeof(tmp) - pos);
+}
+
+// '"key": ' (the caller writes the value). There is no comma right after
+// '{' even if 'first' is 0: the member before it may have been left out.
+static int jsonenc_key(jsonenc_buf * buf, const char * key, int first){
+    if (!first && buf->len > 0 && buf->mem[buf->len - 1] != '{' && jsonenc_str(buf, ", ") != 0)
+        return 1;
+    if (jsonenc_str(buf, "\"") != 0 || jsonenc_str(buf, key) != 0)
+        return 1;
+    return jsonenc_str(buf, "\": ");
+}
+
+// '"key": value' where value is a number. 'first' is 0 if we need a comma before.
+static int jsonenc_key_uint(jsonenc_buf * buf, const char * key, uint64_t value, int first){
+    return jsonenc_key(buf, key, first) || jsonenc_uint(buf, value);
+}
+
+// 1 if 'data' is valid UTF-8 by the rules of jansson (utf8.c): no
+// overlong form, no surrogate and nothing above U+10FFFF
+static int jsonenc_utf8_valid(const uint8_t * data, size_t len){
+    size_t i = 0;
+    while (i < len){
+        uint8_t c = data[i];
+        size_t size;
+        uint32_t value;
+        if (c < 0x80){
+            i++;
+            continue;
+        }else if (c >= 0xC2 && c <= 0xDF){
+            size = 2;
+            value = c & 0x1F;
+        }else if (c >= 0xE0 && c <= 0xEF){
+            size = 3;
+            value = c & 0x0F;
+        }else if (c >= 0xF0 && c <= 0xF4){
+            size = 4;
+            value = c & 0x07;
+        }else{
+            return 0;       // a continuation byte, 0xC0, 0xC1 or above 0xF4
+        }
+        if (i + size > len)
+            return 0;
+        for (size_t k=1; k<size; ++k){
+            if ((data[i + k] & 0xC0) != 0x80)
+                return 0;
+            value = (value << 6) | (data[i + k] & 0x3F);
+        }
+        if (value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF) ||
+            (size == 3 && value < 0x800) || (size == 4 && value < 0x10000))
+            return 0;
+        i += size;
+    }
+    return 1;
+}
+
+// write 'len' bytes (valid UTF-8) as the inside of a JSON string, escaped
+// like json_dumps() does: '"', '\', the short forms of \b \f \n \r \t and
+// '\u00XX' (upper case) for the other control characters. DEL and the
+// non-ASCII characters are written as they are.
+static int jsonenc_escape(jsonenc_buf * buf, const uint8_t * data, size_t len){
+    static const char * upper_hex = "0123456789ABCDEF";
+    if (jsonenc_reserve(buf, len * 6) != 0)
+        return 1;
+    char * out = buf->mem + buf->len;
+    for (size_t i=0; i<len; ++i){
+        uint8_t c = data[i];
+        if (c == '"' || c == '\\'){
+            *out++ = '\\';
+            *out++ = (char)c;
+        }else if (c < 0x20){
+            switch (c){
+                case '\b': *out++ = '\\'; *out++ = 'b'; break;
+                case '\f': *out++ = '\\'; *out++ = 'f'; break;
+                case '\n': *out++ = '\\'; *out++ = 'n'; break;
+                case '\r': *out++ = '\\'; *out++ = 'r'; break;
+                case '\t': *out++ = '\\'; *out++ = 't'; break;
+                default:
+                    *out++ = '\\'; *out++ = 'u'; *out++ = '0'; *out++ = '0';
+                    *out++ = upper_hex[c >> 4];
+                    *out++ = upper_hex[c & 0x0F];
+            }
+        }else{
+            *out++ = (char)c;
+        }
+    }
+    buf->len = out - buf->mem;
+    return 0;
+}
+
+static int jsonenc_string(jsonenc_buf * buf, const char * data, size_t len){
+    if (jsonenc_str(buf, "\"") != 0 || jsonenc_escape(buf, (const uint8_t *)data, len) != 0)
+        return 1;
+    return jsonenc_str(buf, "\"");
+}
+
+// '"key": "data"', or nothing if 'data' is not valid UTF-8
+static int jsonenc_key_string(jsonenc_buf * buf, const char * key, const char * data, size_t len, int first){
+    if (!jsonenc_utf8_valid((const uint8_t *)data, len))
+        return 0;
+    return jsonenc_key(buf, key, first) || jsonenc_string(buf, data, len);
+}
+
+static int jsonenc_hex(jsonenc_buf * buf, const char * data, size_t len){
+    if (jsonenc_reserve(buf, len * 2 + 2) != 0)
+        return 1;
+    char * out = buf->mem + buf->len;
+    *out++ = '"';
+    for (size_t i=0; i<len; ++i){
+        *out++ = jsonenc_hex_digits[(uint8_t)data[i] >> 4];
+        *out++ = jsonenc_hex_digits[(uint8_t)data[i] & 0x0F];
+    }
+    *out++ = '"';
+    buf->len = out - buf->mem;
+    return 0;
+}
+
+// write the name at 'pos' as a JSON string ("a.b.c.", "." for the root)
+// following the compression pointers. returns 0 on success and
+// JSONENC_INVALID if a label is not valid UTF-8 (part of the name may be
+// written: the caller removes it).
+static int jsonenc_name(jsonenc_buf * buf, const char * msg, size_t len, size_t pos){
+    unsigned int pointers = 0;
+    size_t written = 0;
+    if (jsonenc_str(buf, "\"") != 0)
+        return 1;
+    while (pos < len){
+        uint8_t label = (uint8_t)msg[pos];
+        if (label == 0){
+            if (written == 0 && jsonenc_str(buf, ".") != 0)
+                return 1;
+            return jsonenc_str(buf, "\"");
+        }
+        if ((label & 0xC0) == 0xC0){
+            if (pos + 2 > len || ++pointers > DNSWIRE_MAX_POINTERS)
+                return 1;
+            pos = ((label & 0x3F) << 8) | (uint8_t)msg[pos + 1];
+            continue;
+        }
+        if ((label & 0xC0) != 0 || pos + 1 + label > len)
+            return 1;
+        if (!jsonenc_utf8_valid((const uint8_t *)msg + pos + 1, label))
+            return JSONENC_INVALID;
+        if (jsonenc_escape(buf, (const uint8_t *)msg + pos + 1, label) != 0 || jsonenc_str(buf, ".") != 0)
+            return 1;
+        written += label + 1;
+        pos += label + 1;
+    }
+    return 1;
+}
+
+// '"key": "name"' for the name at 'pos', or nothing if the name is not
+// valid UTF-8
+static int jsonenc_key_name_at(jsonenc_buf * buf, const char * key, const char * msg, size_t len,
+                               size_t pos, int first){
+    size_t mark = buf->len;
+    if (jsonenc_key(buf, key, first) != 0)
+        return 1;
+    int res = jsonenc_name(buf, msg, len, pos);
+    if (res == JSONENC_INVALID){
+        buf->len = mark;
+        return 0;
+    }
+    return res;
+}
+
+// the same for a name inside the rdata which ends at 'end': move 'pos' after it
+static int jsonenc_key_name(jsonenc_buf * buf, const char * key, const char * msg, size_t len,
+                            size_t * pos, size_t end, int first){
+    size_t next = *pos;
+    if (dnswire_skip_name(msg, end, &next) != 0)
+        return 1;
+    if (jsonenc_key_name_at(buf, key, msg, len, *pos, first) != 0)
+        return 1;
+    *pos = next;
+    return 0;
+}
+
+const char * jsonenc_type_name(uint16_t type, char * tmp){
+    switch (type){
+        case 1: return "A";
+        case 2: return "NS";
+        case 5: return "CNAME";
+        case 6: return "SOA";
+        case 12: return "PTR";
+        case 13: return "HINFO";
+        case 15: return "MX";
+        case 16: return "TXT";
+        case 28: return "AAAA";
+        case 33: return "SRV";
+        case 41: return "OPT";
+        case 46: return "RRSIG";
+        case 104: return "NID";
+        case 105: return "L32";
+        case 106: return "L64";
+        case 107: return "LP";
+        case 256: return "URI";
+        case 257: return "CAA";
+    }
+    sprintf(tmp, "TYPE%u", type);
+    return tmp;
+}
+
+const char * jsonenc_class_name(uint16_t rr_class, char * tmp){
+    switch (rr_class){
+        case 1: return "IN";
+        case 3: return "CH";
+        case 4: return "HS";
+        case 254: return "NONE";
+        case 255: return "ANY";
+    }
+    sprintf(tmp, "CLASS%u", rr_class);
+    return tmp;
+}
+
+const char * jsonenc_rcode_name(int rcode, char * tmp){
+    static const char * names[] = {"NoError", "FormErr", "ServFail", "NXDomain", "NotImp", "Refused",
+                                   "YXDomain", "YXRRSet", "NXRRSet", "NotAuth", "NotZone", "DSOTYPENI"};
+    if (rcode >= 0 && rcode < (int)(sizeof(names) / sizeof(names[0])))
+        return names[rcode];
+    sprintf(tmp, "RCODE%d", rcode);
+    return tmp;
+}
+
+// the members of "rdata" for the known types. returns 1 if the rdata
+// does not match its type (the caller writes it as hex instead).
+static int jsonenc_rdata(jsonenc_buf * buf, const char * msg, size_t len, dnswire_rr * rr){
+    const char * p = msg + rr->rdata;
+    size_t n = rr->rdlen;
+    size_t pos = rr->rdata;
+    size_t end = rr->rdata + rr->rdlen;
+    char ip[INET6_ADDRSTRLEN];
+    char tmp[16];
+    switch (rr->type){
+        case 1:         // A
+        case 28:        // AAAA
+            if ((rr->type == 1 && n != 4) || (rr->type == 28 && n != 16))
+                return 1;
+            inet_ntop(rr->type == 1?AF_INET:AF_INET6, p, ip, sizeof(ip));
+            return jsonenc_key(buf, "address", 1) || jsonenc_string(buf, ip, strlen(ip));
+        case 2:         // NS
+            return jsonenc_key_name(buf, "nsname", msg, len, &pos, end, 1) || pos != end;
+        case 5:         // CNAME
+            return jsonenc_key_name(buf, "cname", msg, len, &pos, end, 1) || pos != end;
+        case 12:        // PTR
+            return jsonenc_key_name(buf, "ptrdname", msg, len, &pos, end, 1) || pos != end;
+        case 15:        // MX
+            if (n < 3)
+                return 1;
+            pos += 2;
+            return jsonenc_key_uint(buf, "preference", jsonenc_u16(p), 1) ||
+                   jsonenc_key_name(buf, "exchange", msg, len, &pos, end, 0) || pos != end;
+        case 6:         // SOA
+            if (jsonenc_key_name(buf, "mname", msg, len, &pos, end, 1) ||
+                jsonenc_key_name(buf, "rname", msg, len, &pos, end, 0) || pos + 20 != end)
+                return 1;
+            return jsonenc_key_uint(buf, "serial", jsonenc_u32(msg + pos), 0) ||
+                   jsonenc_key_uint(buf, "refresh", jsonenc_u32(msg + pos + 4), 0) ||
+                   jsonenc_key_uint(buf, "retry", jsonenc_u32(msg + pos + 8), 0) ||
+                   jsonenc_key_uint(buf, "expire", jsonenc_u32(msg + pos + 12), 0) ||
+                   jsonenc_key_uint(buf, "minimum", jsonenc_u32(msg + pos + 16), 0);
+        case 16:        // TXT: one string per character-string
+            // (the ones which are not valid UTF-8 are left out, like
+            // json_array_append_new() does with what json_stringn() refused)
+            if (jsonenc_key(buf, "data", 1) || jsonenc_str(buf, "["))
+                return 1;
+            for (int written = 0; pos < end; ){
+                size_t slen = (uint8_t)msg[pos];
+                if (pos + 1 + slen > end)
+                    return 1;
+                if (jsonenc_utf8_valid((const uint8_t *)msg + pos + 1, slen)){
+                    if ((written++ > 0 && jsonenc_str(buf, ", ")) || jsonenc_string(buf, msg + pos + 1, slen))
+                        return 1;
+                }
+                pos += slen + 1;
+            }
+            return jsonenc_str(buf, "]");
+        case 13:        // HINFO: two character-strings (in hex)
+            if (n < 1 || (size_t)(uint8_t)p[0] + 2 > n || (size_t)(uint8_t)p[0] + 2 + (uint8_t)p[(uint8_t)p[0] + 1] != n)
+                return 1;
+            return jsonenc_key(buf, "cpu", 1) || jsonenc_hex(buf, p + 1, (uint8_t)p[0]) ||
+                   jsonenc_key(buf, "os", 0) || jsonenc_hex(buf, p + (uint8_t)p[0] + 2, (uint8_t)p[(uint8_t)p[0] + 1]);
+        case 33:        // SRV
+            if (n < 7)
+                return 1;
+            pos += 6;
+            return jsonenc_key_uint(buf, "priority", jsonenc_u16(p), 1) ||
+                   jsonenc_key_uint(buf, "weight", jsonenc_u16(p + 2), 0) ||
+                   jsonenc_key_uint(buf, "port", jsonenc_u16(p + 4), 0) ||
+                   jsonenc_key_name(buf, "target", msg, len, &pos, end, 0) || pos != end;
+        case 46:        // RRSIG
+            if (n < 19)
+                return 1;
+            pos += 18;
+            if (jsonenc_key(buf, "type_covered", 1) || jsonenc_str(buf, "\"") ||
+                jsonenc_str(buf, jsonenc_type_name(jsonenc_u16(p), tmp)) || jsonenc_str(buf, "\"") ||
+                jsonenc_key_uint(buf, "algorithm", (uint8_t)p[2], 0) ||
+                jsonenc_key_uint(buf, "labels", (uint8_t)p[3], 0) ||
+                jsonenc_key_uint(buf, "original_ttl", jsonenc_u32(p + 4), 0) ||
+                jsonenc_key_uint(buf, "signature_expiration", jsonenc_u32(p + 8), 0) ||
+                jsonenc_key_uint(buf, "signature_inception", jsonenc_u32(p + 12), 0) ||
+                jsonenc_key_uint(buf, "key_tag", jsonenc_u16(p + 16), 0) ||
+                jsonenc_key_name(buf, "signers_name", msg, len, &pos, end, 0))
+                return 1;
+            return jsonenc_key(buf, "signature", 0) || jsonenc_hex(buf, msg + pos, end - pos);
+        case 104:       // NID
+        case 106:       // L64
+            if (n != 10)
+                return 1;
+            return jsonenc_key_uint(buf, "preference", jsonenc_u16(p), 1) ||
+                   jsonenc_key(buf, rr->type == 104?"nodeid":"locator64", 0) || jsonenc_hex(buf, p + 2, 8);
+        case 105:       // L32
+            if (n != 6)
+                return 1;
+            inet_ntop(AF_INET, p + 2, ip, sizeof(ip));
+            return jsonenc_key_uint(buf, "preference", jsonenc_u16(p), 1) ||
+                   jsonenc_key(buf, "locator32", 0) || jsonenc_string(buf, ip, strlen(ip));
+        case 107:       // LP
+            if (n < 3)
+                return 1;
+            pos += 2;
+            return jsonenc_key_uint(buf, "preference", jsonenc_u16(p), 1) ||
+                   jsonenc_key_name(buf, "fqdn", msg, len, &pos, end, 0) || pos != end;
+        case 256:       // URI (target in hex)
+            if (n < 4)
+                return 1;
+            return jsonenc_key_uint(buf, "priority", jsonenc_u16(p), 1) ||
+                   jsonenc_key_uint(buf, "weight", jsonenc_u16(p + 2), 0) ||
+                   jsonenc_key(buf, "target", 0) || jsonenc_hex(buf, p + 4, n - 4);
+        case 257:       // CAA
+            if (n < 2 || (size_t)(uint8_t)p[1] + 2 > n)
+                return 1;
+            return jsonenc_key_uint(buf, "flag", (uint8_t)p[0], 1) ||
+                   jsonenc_key_string(buf, "tag", p + 2, (uint8_t)p[1], 0) ||
+                   jsonenc_key_string(buf, "value", p + 2 + (uint8_t)p[1], n - 2 - (uint8_t)p[1], 0);
+    }
+    return 1;
+}
+
+// the OPT pseudo-record of EDNS0: its class and TTL are not what they
+// are in the other records
+static int jsonenc_opt(jsonenc_buf * buf, const char * msg, dnswire_rr * rr){
+    if (jsonenc_str(buf, "{\"name\": \".\", \"type\": \"OPT\"") ||
+        jsonenc_key_uint(buf, "udp_payload_size", rr->rr_class, 0) ||
+        jsonenc_key_uint(buf, "extended_rcode", rr->ttl >> 24, 0) ||
+        jsonenc_key_uint(buf, "version", (rr->ttl >> 16) & 0xFF, 0) ||
+        jsonenc_key_uint(buf, "DO", (rr->ttl >> 15) & 1, 0) ||
+        jsonenc_key_uint(buf, "Z", rr->ttl & 0x7FFF, 0) ||
+        jsonenc_key_uint(buf, "rdlength", rr->rdlen, 0) ||
+        jsonenc_key(buf, "options", 0) || jsonenc_str(buf, "["))
+        return 1;
+    size_t pos = rr->rdata;
+    size_t end = rr->rdata + rr->rdlen;
+    while (pos + 4 <= end){
+        uint16_t code = jsonenc_u16(msg + pos);
+        uint16_t olen = jsonenc_u16(msg + pos + 2);
+        if (pos + 4 + olen > end)
+            return 1;
+        if ((pos != rr->rdata && jsonenc_str(buf, ", ")) ||
+            jsonenc_str(buf, "{") || jsonenc_key_uint(buf, "code", code, 1) ||
+            jsonenc_key_uint(buf, "length", olen, 0) ||
+            jsonenc_key(buf, "data", 0) || jsonenc_hex(buf, msg + pos + 4, olen) || jsonenc_str(buf, "}"))
+            return 1;
+        pos += 4 + olen;
+    }
+    if (pos != end)
+        return 1;
+    return jsonenc_str(buf, "]}");
+}
+
+// one record of the answer, authority or additional section
+static int jsonenc_rr(jsonenc_buf * buf, const char * msg, size_t len, dnswire_rr * rr){
+    if (rr->type == DNSWIRE_TYPE_OPT)
+        return jsonenc_opt(buf, msg, rr);
+    char tmp[16];
+    if (jsonenc_str(buf, "{") || jsonenc_key_name_at(buf, "name", msg, len, rr->name, 1) ||
+        jsonenc_key(buf, "class", 0) || jsonenc_str(buf, "\"") || jsonenc_str(buf, jsonenc_class_name(rr->rr_class, tmp)) || jsonenc_str(buf, "\"") ||
+        jsonenc_key(buf, "type", 0) || jsonenc_str(buf, "\"") || jsonenc_str(buf, jsonenc_type_name(rr->type, tmp)) || jsonenc_str(buf, "\"") ||
+        jsonenc_key_uint(buf, "ttl", rr->ttl, 0) ||
+        jsonenc_key_uint(buf, "rdlength", rr->rdlen, 0) ||
+        jsonenc_key(buf, "rdata", 0) || jsonenc_str(buf, "{"))
+        return 1;
+    size_t mark = buf->len;
+    if (jsonenc_rdata(buf, msg, len, rr) != 0){
+        // unknown type or rdata we can't read: keep it as hex
+        buf->len = mark;
+        if (jsonenc_key(buf, "data", 1) || jsonenc_hex(buf, msg + rr->rdata, rr->rdlen))
+            return 1;
+    }
+    return jsonenc_str(buf, "}}");
+}
+
+// append the JSON record of 'msg' (checked by dnswire_parse() into 'wire')
+// to 'buf'. returns 0 on success. On error, 'buf' is left as it was.
+int jsonenc_message(jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire){
+    size_t start = buf->len;
+    char tmp[16];
+    if (wire->complete == 0)
+        return 1;
+    int rcode = (uint8_t)msg[3] & 0x0F;
+    int z = ((uint8_t)msg[3] >> 6) & 1;
+    int ad = ((uint8_t)msg[3] >> 5) & 1;
+    int cd = ((uint8_t)msg[3] >> 4) & 1;
+    if (jsonenc_str(buf, "{\"header\": {") ||
+        jsonenc_key_uint(buf, "ID", wire->id, 1) ||
+        jsonenc_key_uint(buf, "opcode", wire->opcode, 0) ||
+        jsonenc_key(buf, "rcode", 0) || jsonenc_str(buf, "\"") || jsonenc_str(buf, jsonenc_rcode_name(rcode, tmp)) || jsonenc_str(buf, "\"") ||
+        jsonenc_key_uint(buf, "qdcount", wire->qdcount, 0) ||
+        jsonenc_key_uint(buf, "ancount", wire->ancount, 0) ||
+        jsonenc_key_uint(buf, "arcount", wire->arcount, 0) ||
+        jsonenc_key_uint(buf, "nscount", wire->nscount, 0) ||
+        jsonenc_key(buf, "flags", 0) || jsonenc_str(buf, "{") ||
+        jsonenc_key_uint(buf, "qr", wire->qr, 1) ||
+        jsonenc_key_uint(buf, "aa", wire->aa, 0) ||
+        jsonenc_key_uint(buf, "tc", wire->tc, 0) ||
+        jsonenc_key_uint(buf, "rd", wire->rd, 0) ||
+        jsonenc_key_uint(buf, "ra", wire->ra, 0) ||
+        jsonenc_key_uint(buf, "z", z, 0) ||
+        jsonenc_key_uint(buf, "AD", ad, 0) ||
+        jsonenc_key_uint(buf, "CD", cd, 0) ||
+        jsonenc_str(buf, "}}, \"question\": {") ||
+        jsonenc_key_name_at(buf, "qname", msg, len, wire->qname, 1) ||
+        jsonenc_key(buf, "qclass", 0) || jsonenc_str(buf, "\"") || jsonenc_str(buf, jsonenc_class_name(wire->qclass, tmp)) || jsonenc_str(buf, "\"") ||
+        jsonenc_key(buf, "qtype", 0) || jsonenc_str(buf, "\"") || jsonenc_str(buf, jsonenc_type_name(wire->qtype, tmp)) || jsonenc_str(buf, "\"") ||
+        jsonenc_str(buf, "}"))
+        goto error;
+    static const char * sections[] = {"answer", "authority", "additional"};
+    uint16_t counts[] = {wire->ancount, wire->nscount, wire->arcount};
+    size_t pos = wire->records;
+    dnswire_rr rr;
+    for (int s=0; s<3; ++s){
+        if (jsonenc_key(buf, sections[s], 0) || jsonenc_str(buf, "["))
+            goto error;
+        for (unsigned int i=0; i<counts[s]; ++i){
+            if (dnswire_next_rr(msg, len, &pos, &rr) != 0)
+                goto error;
+            if ((i > 0 && jsonenc_str(buf, ", ")) || jsonenc_rr(buf, msg, len, &rr))
+                goto error;
+        }
+        if (jsonenc_str(buf, "]"))
+            goto error;
+    }
+    if (jsonenc_str(buf, "}"))
+        goto error;
+    return 0;
+error:
+    buf->len = start;
+    return 1;
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <mpmc.h>
+
+// the capacity is rounded up to a power of two
+mpmc_ring * mpmc_init(size_t capacity){
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    mpmc_ring * ring = (mpmc_ring*) calloc(1, sizeof(mpmc_ring));
+    if (ring != NULL)
+        ring->cells = (struct _mpmc_cell*) malloc(size * sizeof(struct _mpmc_cell));
+    if (ring == NULL || ring->cells == NULL){
+        fprintf(stderr, "Can not allocate memory for the ring\n");
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    for (size_t i=0; i<size; ++i){
+        ring->cells[i].seq = i;
+        ring->cells[i].data = NULL;
+    }
+    return ring;
+}
+
+void mpmc_free(mpmc_ring * ring){
+    if (ring == NULL)
+        return;
+    free(ring->cells);
+    free(ring);
+}
+
+// returns 0 on success and 1 if the ring is full
+int mpmc_push(mpmc_ring * ring, void * data){
+    size_t pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+    while (1){
+        struct _mpmc_cell * cell = &(ring->cells[pos & ring->mask]);
+        size_t seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0){
+            // the cell is free for this position: claim it
+            if (__atomic_compare_exchange_n(&(ring->head), &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                cell->data = data;
+                __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            // another producer took it, 'pos' has the new head
+        }else if (diff < 0){
+            return 1;       // the consumers didn't free this cell yet
+        }else{
+            pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// returns NULL if the ring is empty
+void * mpmc_pop(mpmc_ring * ring){
+    size_t pos = __atomic_load_n(&(ring->tail), __ATOMIC_RELAXED);
+    while (1){
+        struct _mpmc_cell * cell = &(ring->cells[pos & ring->mask]);
+        size_t seq = __atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0){
+            if (__atomic_compare_exchange_n(&(ring->tail), &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                void * data = cell->data;
+                // the cell is free again one lap later
+                __atomic_store_n(&(cell->seq), pos + ring->mask + 1, __ATOMIC_RELEASE);
+                return data;
+            }
+        }else if (diff < 0){
+            return NULL;    // nothing was pushed here yet
+        }else{
+            pos = __atomic_load_n(&(ring->tail), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// push up to 'count' items with one compare-and-swap. returns how many
+// we pushed (0 if the ring is full)
+size_t mpmc_push_batch(mpmc_ring * ring, void ** items, size_t count){
+    size_t pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+    while (count > 0){
+        // the free cells from 'pos' on: a cell is free for position p when
+        // its sequence is p, and it stays free until we claim it
+        size_t n = 0;
+        while (n < count && n <= ring->mask){
+            size_t seq = __atomic_load_n(&(ring->cells[(pos + n) & ring->mask].seq), __ATOMIC_ACQUIRE);
+            if (seq != pos + n)
+                break;
+            n++;
+        }
+        if (n == 0){
+            size_t seq = __atomic_load_n(&(ring->cells[pos & ring->mask].seq), __ATOMIC_ACQUIRE);
+            if ((intptr_t)seq - (intptr_t)pos < 0)
+                return 0;       // full
+            pos = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&(ring->head), &pos, pos + n, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            for (size_t i=0; i<n; ++i){
+                struct _mpmc_cell * cell = &(ring->cells[(pos + i) & ring->mask]);
+                cell->data = items[i];
+                __atomic_store_n(&(cell->seq), pos + i + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+        // another producer moved the head, 'pos' has the new one
+    }
+    return 0;
+}
+
+// pop up to 'max' items with one compare-and-swap. returns how many we
+// popped (0 if the ring is empty)
+size_t mpmc_pop_batch(mpmc_ring * ring, void ** items, size_t max){
+    size_t pos = __atomic_load_n(&(ring->tail), __ATOMIC_RELAXED);
+    while (max > 0){
+        size_t n = 0;
+        while (n < max && n <= ring->mask){
+            size_t seq = __atomic_load_n(&(ring->cells[(pos + n) & ring->mask].seq), __ATOMIC_ACQUIRE);
+            if (seq != pos + n + 1)
+                break;
+            n++;
+        }
+        if (n == 0){
+            size_t seq = __atomic_load_n(&(ring->cells[pos & ring->mask].seq), __ATOMIC_ACQUIRE);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+                return 0;       // empty
+            pos = __atomic_load_n(&(ring->tail), __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&(ring->tail), &pos, pos + n, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+            for (size_t i=0; i<n; ++i){
+                struct _mpmc_cell * cell = &(ring->cells[(pos + i) & ring->mask]);
+                items[i] = cell->data;
+                __atomic_store_n(&(cell->seq), pos + i + ring->mask + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void mpmc_futex_wait(uint32_t * addr, uint32_t value, int timeout_ms){
+    struct timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, timeout_ms == MPMC_FOREVER?NULL:&ts, NULL, 0);
+}
+
+// something changed in 'addr' (a push or a pop): wake the threads sleeping on it
+static void mpmc_futex_wake(uint32_t * addr, uint32_t * waiters){
+    __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+static uint64_t mpmc_now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+mpmc_queue * mpmc_queue_init(size_t capacity){
+    mpmc_queue * q = (mpmc_queue*) calloc(1, sizeof(mpmc_queue));
+    if (q == NULL){
+        fprintf(stderr, "Can not allocate memory for the queue\n");
+        return NULL;
+    }
+    q->ring = mpmc_init(capacity);
+    if (q->ring == NULL){
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void mpmc_queue_free(mpmc_queue * q){
+    if (q == NULL)
+        return;
+    mpmc_free(q->ring);
+    free(q);
+}
+
+// push 'count' items, waiting for room at most 'timeout_ms' (MPMC_FOREVER:
+// no limit). returns how many we pushed: less than 'count' after a timeout
+size_t mpmc_queue_push_batch(mpmc_queue * q, void ** items, size_t count, int timeout_ms){
+    size_t done = 0;
+    unsigned int spins = 0;
+    uint64_t deadline = timeout_ms > 0?mpmc_now_ms() + timeout_ms:0;
+    while (done < count){
+        size_t n = mpmc_push_batch(q->ring, items + done, count - done);
+        if (n > 0){
+            done += n;
+            mpmc_futex_wake(&(q->pushed), &(q->pop_waiters));
+            spins = 0;
+            continue;
+        }
+        if (timeout_ms == 0)
+            break;
+        if (++spins < MPMC_SPINS)
+            continue;
+        int wait_ms = MPMC_FOREVER;
+        if (timeout_ms > 0){
+            uint64_t now = mpmc_now_ms();
+            if (now >= deadline)
+                break;
+            wait_ms = (int)(deadline - now);
+        }
+        // mpmc_futex_wake() reads the waiters after its change, so we check
+        // the ring again after we are counted and before we sleep
+        uint32_t seen = __atomic_load_n(&(q->popped), __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&(q->push_waiters), 1, __ATOMIC_SEQ_CST);
+        n = mpmc_push_batch(q->ring, items + done, count - done);
+        if (n == 0)
+            mpmc_futex_wait(&(q->popped), seen, wait_ms);
+        __atomic_fetch_sub(&(q->push_waiters), 1, __ATOMIC_SEQ_CST);
+        if (n > 0){
+            done += n;
+            mpmc_futex_wake(&(q->pushed), &(q->pop_waiters));
+        }
+    }
+    return done;
+}
+
+// returns 0 on success and 1 if the queue is still full after 'timeout_ms'
+int mpmc_queue_push(mpmc_queue * q, void * data, int timeout_ms){
+    return mpmc_queue_push_batch(q, &data, 1, timeout_ms) == 1?0:1;
+}
+
+// pop up to 'max' items, waiting at most 'timeout_ms' (MPMC_FOREVER: no
+// limit) for the first one. returns how many we popped: 0 after a timeout
+// or if the queue is closed and empty (see mpmc_queue_drained())
+size_t mpmc_queue_pop_batch(mpmc_queue * q, void ** items, size_t max, int timeout_ms){
+    unsigned int spins = 0;
+    uint64_t deadline = timeout_ms > 0?mpmc_now_ms() + timeout_ms:0;
+    while (1){
+        // nothing is pushed after 'closed': if the ring is empty after
+        // we saw it, it's empty for good
+        int closed = __atomic_load_n(&(q->closed), __ATOMIC_SEQ_CST);
+        size_t n = mpmc_pop_batch(q->ring, items, max);
+        if (n > 0){
+            mpmc_futex_wake(&(q->popped), &(q->push_waiters));
+            return n;
+        }
+        if (closed || timeout_ms == 0)
+            return 0;
+        if (++spins < MPMC_SPINS)
+            continue;
+        int wait_ms = MPMC_FOREVER;
+        if (timeout_ms > 0){
+            uint64_t now = mpmc_now_ms();
+            if (now >= deadline)
+                return 0;
+            wait_ms = (int)(deadline - now);
+        }
+        uint32_t seen = __atomic_load_n(&(q->pushed), __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&(q->pop_waiters), 1, __ATOMIC_SEQ_CST);
+        n = mpmc_pop_batch(q->ring, items, max);
+        if (n == 0 && !__atomic_load_n(&(q->closed), __ATOMIC_SEQ_CST))
+            mpmc_futex_wait(&(q->pushed), seen, wait_ms);
+        __atomic_fetch_sub(&(q->pop_waiters), 1, __ATOMIC_SEQ_CST);
+        if (n > 0){
+            mpmc_futex_wake(&(q->popped), &(q->push_waiters));
+            return n;
+        }
+    }
+}
+
+// one item or NULL (see mpmc_queue_pop_batch())
+void * mpmc_queue_pop(mpmc_queue * q, int timeout_ms){
+    void * data = NULL;
+    if (mpmc_queue_pop_batch(q, &data, 1, timeout_ms) == 0)
+        return NULL;
+    return data;
+}
+
+// the producers are done: the consumers get what's left and then nothing
+void mpmc_queue_close(mpmc_queue * q){
+    __atomic_store_n(&(q->closed), 1, __ATOMIC_SEQ_CST);
+    mpmc_futex_wake(&(q->pushed), &(q->pop_waiters));
+}
+
+// returns 1 if the queue is closed and every item was popped
+int mpmc_queue_drained(mpmc_queue * q){
+    if (!__atomic_load_n(&(q->closed), __ATOMIC_SEQ_CST))
+        return 0;
+    return __atomic_load_n(&(q->ring->tail), __ATOMIC_SEQ_CST) == __atomic_load_n(&(q->ring->head), __ATOMIC_SEQ_CST);
+}
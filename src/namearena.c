@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <namearena.h>
+
+namearena_ctx * namearena_init(void){
+    namearena_ctx * arena = (namearena_ctx*) calloc(1, sizeof(namearena_ctx));
+    if (arena == NULL){
+        fprintf(stderr, "Can not initialize the storage of the names\n");
+        return NULL;
+    }
+    arena->free = mpmc_init(NAMEARENA_MAX_FREE);
+    if (arena->free == NULL){
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+// the last name of 'slab' was released: keep it for the reader
+static void namearena_recycle(namearena_ctx * arena, namearena_slab * slab){
+    if (mpmc_push(arena->free, slab) != 0)
+        free(slab);
+}
+
+// drop the reference of the reader to the slab it was filling
+static void namearena_retire(namearena_ctx * arena){
+    namearena_slab * slab = arena->current;
+    arena->current = NULL;
+    if (slab != NULL && __atomic_sub_fetch(&(slab->refs), 1, __ATOMIC_ACQ_REL) == 0)
+        namearena_recycle(arena, slab);
+}
+
+// copy 'name' ('len' characters) to the arena as a null-terminated string.
+// Only one thread (the reader) may call it. returns NULL if the name is
+// too long (or if we can't allocate a slab).
+char * namearena_copy(namearena_ctx * arena, const char * name, size_t len){
+    if (len > NAMEARENA_MAX_NAME)
+        return NULL;
+    namearena_slab * slab = arena->current;
+    if (slab == NULL || slab->used + len + 1 > NAMEARENA_SLAB_SIZE){
+        namearena_retire(arena);
+        slab = (namearena_slab*) mpmc_pop(arena->free);
+        if (slab == NULL){
+            slab = (namearena_slab*) aligned_alloc(NAMEARENA_SLAB_SIZE, NAMEARENA_SLAB_SIZE);
+            if (slab == NULL){
+                fprintf(stderr, "Can not allocate memory for the names\n");
+                return NULL;
+            }
+            __atomic_fetch_add(&(arena->slabs), 1, __ATOMIC_RELAXED);
+        }
+        slab->refs = 1;
+        slab->used = sizeof(namearena_slab);
+        slab->arena = arena;
+        arena->current = slab;
+    }
+    char * copy = (char*) slab + slab->used;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    slab->used += len + 1;
+    __atomic_fetch_add(&(slab->refs), 1, __ATOMIC_RELAXED);
+    return copy;
+}
+
+// the scan is done with 'name' (any thread, 'name' may be NULL)
+void namearena_release(char * name){
+    if (name == NULL)
+        return;
+    namearena_slab * slab = (namearena_slab*) ((uintptr_t)name & ~((uintptr_t)NAMEARENA_SLAB_SIZE - 1));
+    if (__atomic_sub_fetch(&(slab->refs), 1, __ATOMIC_ACQ_REL) == 0)
+        namearena_recycle(slab->arena, slab);
+}
+
+// all the names were released
+void namearena_free(namearena_ctx * arena){
+    if (arena == NULL)
+        return;
+    namearena_retire(arena);
+    void * slab;
+    while ((slab = mpmc_pop(arena->free)) != NULL)
+        free(slab);
+    mpmc_free(arena->free);
+    free(arena);
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <outsplit.h>
+
+// 'records:N' or 'bytes:N'. N may end with K, M or G (powers of 1000
+// for the records and of 1024 for the bytes). returns 0 on success
+int outsplit_parse(const char * spec, int * mode, uint64_t * limit){
+    const char * value;
+    uint64_t unit;
+    if (strncmp(spec, "records:", 8) == 0){
+        *mode = OUTSPLIT_RECORDS;
+        value = spec + 8;
+        unit = 1000;
+    }else if (strncmp(spec, "bytes:", 6) == 0){
+        *mode = OUTSPLIT_BYTES;
+        value = spec + 6;
+        unit = 1024;
+    }else{
+        return 1;
+    }
+    char * end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    // strtoull() takes '-1' as a huge number
+    if (errno != 0 || end == value || n == 0 || value[0] == '-')
+        return 1;
+    uint64_t multiplier = 1;
+    if (*end == 'k' || *end == 'K'){
+        multiplier = unit;
+        end++;
+    }else if (*end == 'm' || *end == 'M'){
+        multiplier = unit * unit;
+        end++;
+    }else if (*end == 'g' || *end == 'G'){
+        multiplier = unit * unit * unit;
+        end++;
+    }
+    if (*end != '\0' || n > UINT64_MAX / multiplier)
+        return 1;
+    n *= multiplier;
+    *limit = n;
+    return 0;
+}
+
+// 'path' is the name of '-o': the parts are 'stem-SSS-PPPPP.ext' (without
+// the shard number if there is one shard and without the part number if we
+// don't split). Nothing is opened before outsplit_start().
+outsplit_ctx * outsplit_init(const char * path, int mode, uint64_t limit, unsigned int shards){
+    if (shards == 0 || shards > OUTSPLIT_MAX_SHARDS)
+        return NULL;
+    outsplit_ctx * ctx = (outsplit_ctx*) calloc(1, sizeof(outsplit_ctx));
+    if (ctx == NULL)
+        return NULL;
+    ctx->mode = mode;
+    ctx->limit = limit;
+    ctx->shards = shards;
+    // the extension starts at the first dot of the file name (not of the
+    // directories), so 'scan.json.gz' keeps '.json.gz' for the tools
+    const char * base = strrchr(path, '/');
+    base = base == NULL?path:base + 1;
+    const char * dot = base[0] == '\0'?NULL:strchr(base + 1, '.');
+    size_t stem_len = dot == NULL?strlen(path):(size_t)(dot - path);
+    ctx->stem = strndup(path, stem_len);
+    ctx->ext = strdup(path + stem_len);
+    if (ctx->stem == NULL || ctx->ext == NULL){
+        outsplit_free(ctx);
+        return NULL;
+    }
+    for (unsigned int i=0; i<shards; ++i)
+        ctx->files[i].fd = -1;
+    return ctx;
+}
+
+// the header of the output (the names of the TSV/CSV fields, the header
+// of a raw log) is written at the start of every part
+int outsplit_set_header(outsplit_ctx * ctx, const char * header, size_t len){
+    free(ctx->header);
+    ctx->header = NULL;
+    ctx->header_len = 0;
+    if (len == 0)
+        return 0;
+    ctx->header = (char*) malloc(len);
+    if (ctx->header == NULL)
+        return 1;
+    memcpy(ctx->header, header, len);
+    ctx->header_len = len;
+    return 0;
+}
+
+static int outsplit_write_all(int fd, const char * data, size_t len){
+    while (len > 0){
+        ssize_t res = write(fd, data, len);
+        if (res < 0){
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+// open the next part of 'shard' and write the header to it
+static int outsplit_open(outsplit_ctx * ctx, unsigned int shard){
+    outsplit_file * f = &(ctx->files[shard]);
+    char name[OUTSPLIT_MAX_NAME];
+    char shard_str[16] = "";
+    char part_str[16] = "";
+    if (ctx->shards > 1)
+        snprintf(shard_str, sizeof(shard_str), "-%03u", shard);
+    if (ctx->mode != OUTSPLIT_NONE)
+        snprintf(part_str, sizeof(part_str), "-%05u", f->part);
+    if ((size_t)snprintf(name, sizeof(name), "%s%s%s%s", ctx->stem, shard_str, part_str, ctx->ext) >= sizeof(name)){
+        fprintf(stderr, "ERROR: The name of the output file is too long\n");
+        return 1;
+    }
+    f->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f->fd == -1){
+        fprintf(stderr, "ERROR: Can not open the output file %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    f->part += 1;
+    f->records = 0;
+    f->bytes = ctx->header_len;
+    ctx->parts += 1;
+    if (ctx->header_len > 0 && outsplit_write_all(f->fd, ctx->header, ctx->header_len) != 0){
+        perror("ERROR: Can not write the output");
+        return 1;
+    }
+    return 0;
+}
+
+// open the first part of every shard, so each one has a file even if it
+// gets no record. returns 0 on success
+int outsplit_start(outsplit_ctx * ctx){
+    for (unsigned int i=0; i<ctx->shards; ++i){
+        if (ctx->files[i].fd == -1 && outsplit_open(ctx, i) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+// the file of 'shard' for the next block (-1 on error). The next part
+// is opened here, not when the previous one is full: a scan which ends
+// right after a full part doesn't leave an empty part behind.
+int outsplit_fd(outsplit_ctx * ctx, unsigned int shard){
+    if (ctx->files[shard].fd == -1 && outsplit_open(ctx, shard) != 0)
+        return -1;
+    return ctx->files[shard].fd;
+}
+
+// a block of 'records' records and 'bytes' bytes goes to the open part of
+// 'shard'. returns 1 if the part is full with it (call outsplit_next() once
+// it's written) and 0 if there is room for more.
+int outsplit_count(outsplit_ctx * ctx, unsigned int shard, uint64_t records, uint64_t bytes){
+    outsplit_file * f = &(ctx->files[shard]);
+    f->records += records;
+    f->bytes += bytes;
+    if (ctx->mode == OUTSPLIT_RECORDS)
+        return f->records >= ctx->limit;
+    if (ctx->mode == OUTSPLIT_BYTES)
+        return f->bytes >= ctx->limit;
+    return 0;
+}
+
+// records which still fit in the open part of 'shard' ('records:N' only)
+uint64_t outsplit_room(outsplit_ctx * ctx, unsigned int shard){
+    outsplit_file * f = &(ctx->files[shard]);
+    return f->records < ctx->limit?ctx->limit - f->records:0;
+}
+
+// close the part of 'shard' and make sure it's on the disk
+static int outsplit_close_file(outsplit_file * f){
+    if (f->fd == -1)
+        return 0;
+    int res = 0;
+    if (fsync(f->fd) != 0 && errno != EINVAL)      // EINVAL: a pipe or a special file
+        res = 1;
+    if (close(f->fd) != 0)
+        res = 1;
+    f->fd = -1;
+    return res;
+}
+
+int outsplit_next(outsplit_ctx * ctx, unsigned int shard){
+    if (outsplit_close_file(&(ctx->files[shard])) != 0){
+        perror("ERROR: Can not close the output file");
+        return 1;
+    }
+    return 0;
+}
+
+// the writer is done: close the last parts. returns 0 on success
+int outsplit_close(outsplit_ctx * ctx){
+    int res = 0;
+    for (unsigned int i=0; i<ctx->shards; ++i){
+        if (outsplit_close_file(&(ctx->files[i])) != 0){
+            perror("ERROR: Can not close the output file");
+            res = 1;
+        }
+    }
+    return res;
+}
+
+void outsplit_free(outsplit_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    free(ctx->stem);
+    free(ctx->ext);
+    free(ctx->header);
+    free(ctx);
+}
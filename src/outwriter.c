@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <outwriter.h>
+
+// the buffers the calling thread is filling for each writer and each of
+// its lanes (NULL: none)
+static __thread outwriter_buf * outwriter_current[OUTWRITER_MAX_WRITERS][OUTWRITER_MAX_LANES];
+
+// bitmap of the slots of 'outwriter_current' in use (atomic)
+static unsigned int outwriter_slots = 0;
+
+static int outwriter_take_slot(void){
+    unsigned int used = __atomic_load_n(&outwriter_slots, __ATOMIC_SEQ_CST);
+    for (int i=0; i<OUTWRITER_MAX_WRITERS; ++i){
+        if (used & (1U << i))
+            continue;
+        if (__atomic_compare_exchange_n(&outwriter_slots, &used, used | (1U << i), 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return i;
+        i = -1;     // 'used' has the new bitmap, look again
+    }
+    return -1;
+}
+
+static uint64_t outwriter_now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// sleep on 'cond' for at most OUTWRITER_WAIT_MS. 'lock' must be held.
+static void outwriter_wait(pthread_mutex_t * lock, pthread_cond_t * cond){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += OUTWRITER_WAIT_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L){
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+// write all the 'iov' to 'fd', even if the kernel takes them in pieces
+static int outwriter_writev(outwriter_ctx * w, int fd, struct iovec * iov, int cnt){
+    while (cnt > 0){
+        ssize_t res = writev(fd, iov, cnt);
+        if (res < 0){
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        w->writes += 1;
+        w->bytes += res;
+        while (cnt > 0 && (size_t)res >= iov->iov_len){
+            res -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0){
+            iov->iov_base = (char*)iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+    return 0;
+}
+
+// hand 'b' to the threads of stage 's'
+static void outwriter_put(outwriter_ctx * w, outwriter_stage * s, outwriter_buf * b){
+    mpmc_push(s->ring, b);      // never full: it has room for the whole pool
+    if (__atomic_load_n(&(s->idle), __ATOMIC_SEQ_CST) > 0){
+        pthread_mutex_lock(&(w->lock));
+        pthread_cond_signal(&(s->wake));
+        pthread_mutex_unlock(&(w->lock));
+    }
+}
+
+// the next buffer of stage 's'. We sleep until there is one and return
+// NULL once the stage is closing and empty.
+static outwriter_buf * outwriter_take(outwriter_ctx * w, outwriter_stage * s){
+    while (1){
+        outwriter_buf * b = (outwriter_buf*) mpmc_pop(s->ring);
+        if (b != NULL)
+            return b;
+        // nothing is pushed after 'closing', so an empty ring after it is the end
+        if (__atomic_load_n(&(s->closing), __ATOMIC_SEQ_CST))
+            return (outwriter_buf*) mpmc_pop(s->ring);
+        // outwriter_put() checks 'idle' after its push, so we check the ring again after setting it
+        pthread_mutex_lock(&(w->lock));
+        __atomic_fetch_add(&(s->idle), 1, __ATOMIC_SEQ_CST);
+        b = (outwriter_buf*) mpmc_pop(s->ring);
+        if (b == NULL && !__atomic_load_n(&(s->closing), __ATOMIC_SEQ_CST))
+            outwriter_wait(&(w->lock), &(s->wake));
+        __atomic_fetch_sub(&(s->idle), 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(w->lock));
+        if (b != NULL)
+            return b;
+    }
+}
+
+static void outwriter_close_stage(outwriter_ctx * w, outwriter_stage * s){
+    __atomic_store_n(&(s->closing), 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&(w->lock));
+    pthread_cond_broadcast(&(s->wake));
+    pthread_mutex_unlock(&(w->lock));
+}
+
+// a compression worker: one block per buffer, with a compressor of its own
+static void * outwriter_worker(void * ptr){
+    outwriter_ctx * w = (outwriter_ctx*) ptr;
+    compress_ctx * codec = compress_init(w->method, w->level);
+    if (codec == NULL){
+        fprintf(stderr, "ERROR: Can not initialize the compression of the output\n");
+        w->failed = 1;
+    }
+    outwriter_buf * b;
+    while ((b = outwriter_take(w, &(w->ready))) != NULL){
+        b->packed.len = 0;
+        if (codec != NULL && compress_block(codec, b->data.mem, b->data.len, &(b->packed)) != 0){
+            fprintf(stderr, "ERROR: Can not compress the output\n");
+            w->failed = 1;
+        }
+        outwriter_put(w, &(w->packed), b);
+    }
+    compress_free(codec);
+    return NULL;
+}
+
+// write the buffers of 'list' to the output: one writev() for all of them,
+// or with 'split', one for each run of buffers of the same shard which
+// doesn't go past the end of its part. A part is cut between buffers, or
+// with 'exact', right after its last record: the rest of that buffer
+// starts the next part.
+static void outwriter_write_list(outwriter_ctx * w, outwriter_buf ** list, int cnt){
+    struct iovec iov[OUTWRITER_MAX_IOV];
+    int i = 0;
+    uint64_t skip = 0;          // records of list[i] written to the part before
+    while (i < cnt){
+        unsigned int lane = list[i]->lane;
+        int fd = w->split != NULL?outsplit_fd(w->split, lane):w->fd;
+        int full = 0;
+        int n = 0;
+        while (i < cnt && !full){
+            outwriter_buf * b = list[i];
+            if (w->split != NULL && b->lane != lane)
+                break;
+            jsonenc_buf * out = w->num_workers > 0?&(b->packed):&(b->data);
+            size_t from = skip > 0?b->ends[skip - 1]:0;
+            size_t to = out->len;
+            uint64_t records = b->records - skip;
+            if (w->exact && !w->failed){
+                uint64_t room = outsplit_room(w->split, lane);
+                if (records > room){
+                    records = room;
+                    to = b->ends[skip + room - 1];
+                }
+            }
+            iov[n].iov_base = out->mem + from;
+            iov[n].iov_len = to - from;
+            if (skip == 0)
+                w->raw_bytes += b->data.len;
+            if (w->split != NULL)
+                full = outsplit_count(w->split, lane, records, to - from);
+            n++;
+            if (to < out->len){
+                skip += records;        // the part is full: the rest goes to the next one
+            }else{
+                skip = 0;
+                i++;
+            }
+        }
+        if (w->failed)
+            continue;           // we keep draining the buffers so the scan can finish
+        if (fd == -1){
+            w->failed = 1;      // outsplit said why
+        }else if (outwriter_writev(w, fd, iov, n) != 0){
+            perror("ERROR: Can not write the output");
+            w->failed = 1;
+        }else if (full && outsplit_next(w->split, lane) != 0){
+            w->failed = 1;
+        }
+    }
+}
+
+static void * outwriter_routine(void * ptr){
+    outwriter_ctx * w = (outwriter_ctx*) ptr;
+    outwriter_stage * input = w->num_workers > 0?&(w->packed):&(w->ready);
+    outwriter_buf * list[OUTWRITER_MAX_IOV];
+    while (1){
+        int cnt = 0;
+        outwriter_buf * b = outwriter_take(w, input);
+        if (b == NULL)
+            break;
+        list[cnt++] = b;
+        while (cnt < OUTWRITER_MAX_IOV && (b = (outwriter_buf*) mpmc_pop(input->ring)) != NULL)
+            list[cnt++] = b;
+        outwriter_write_list(w, list, cnt);
+        for (int i=0; i<cnt; ++i){
+            list[i]->data.len = 0;
+            mpmc_push(w->free, list[i]);    // never full: it has room for the whole pool
+        }
+        if (__atomic_load_n(&(w->waiting), __ATOMIC_SEQ_CST) > 0){
+            pthread_mutex_lock(&(w->lock));
+            pthread_cond_broadcast(&(w->room));
+            pthread_mutex_unlock(&(w->lock));
+        }
+    }
+    return NULL;
+}
+
+static outwriter_ctx * outwriter_create(int fd, outsplit_ctx * split, unsigned int count, int method, int level,
+                                        unsigned int workers);
+
+// 'fd' is the output. 'count' buffers are shared by all the producers:
+// it must be larger than the number of producer threads.
+outwriter_ctx * outwriter_init(int fd, unsigned int count){
+    return outwriter_create(fd, NULL, count, COMPRESS_NONE, 0, 0);
+}
+
+// the same with 'workers' threads which compress the buffers with 'method'
+// (COMPRESS_GZIP or COMPRESS_ZSTD) at 'level' before they are written
+outwriter_ctx * outwriter_init_compressed(int fd, unsigned int count, int method, int level, unsigned int workers){
+    return outwriter_create(fd, NULL, count, method, level, workers);
+}
+
+// the output goes to the files of 'split' (started by the caller), with or
+// without compression ('method' may be COMPRESS_NONE). 'count' must be larger
+// than the number of producers times the number of shards.
+outwriter_ctx * outwriter_init_split(outsplit_ctx * split, unsigned int count, int method, int level, unsigned int workers){
+    return outwriter_create(-1, split, count, method, level, workers);
+}
+
+static outwriter_ctx * outwriter_create(int fd, outsplit_ctx * split, unsigned int count, int method, int level,
+                                        unsigned int workers){
+    outwriter_ctx * w = (outwriter_ctx*) calloc(1, sizeof(outwriter_ctx));
+    if (w == NULL){
+        fprintf(stderr, "Can not initialize the output writer\n");
+        return NULL;
+    }
+    w->fd = fd;
+    w->split = split;
+    w->lanes = split != NULL?split->shards:1;
+    w->count = count;
+    w->method = method;
+    w->level = level;
+    w->num_workers = method != COMPRESS_NONE?(workers > 0?workers:1):0;
+    // a compressed block can't be cut, so the parts end between buffers
+    w->exact = split != NULL && split->mode == OUTSPLIT_RECORDS && w->num_workers == 0;
+    w->slot = outwriter_take_slot();
+    if (w->slot < 0){
+        fprintf(stderr, "Too many output writers (at most %d)\n", OUTWRITER_MAX_WRITERS);
+        outwriter_free(w);
+        return NULL;
+    }
+    w->bufs = (outwriter_buf*) calloc(count, sizeof(outwriter_buf));
+    w->free = mpmc_init(count);
+    w->ready.ring = mpmc_init(count);
+    w->packed.ring = mpmc_init(count);
+    w->workers = (pthread_t*) calloc(w->num_workers + 1, sizeof(pthread_t));
+    if (w->bufs == NULL || w->free == NULL || w->ready.ring == NULL || w->packed.ring == NULL || w->workers == NULL){
+        fprintf(stderr, "Can not allocate memory for the output buffers\n");
+        outwriter_free(w);
+        return NULL;
+    }
+    // the memory of a buffer is allocated the first time it's used
+    for (unsigned int i=0; i<count; ++i)
+        mpmc_push(w->free, &(w->bufs[i]));
+    pthread_mutex_init(&(w->lock), NULL);
+    pthread_cond_init(&(w->ready.wake), NULL);
+    pthread_cond_init(&(w->packed.wake), NULL);
+    pthread_cond_init(&(w->room), NULL);
+    for (unsigned int i=0; i<w->num_workers; ++i){
+        if (pthread_create(&(w->workers[i]), NULL, outwriter_worker, (void*) w) != 0){
+            fprintf(stderr, "ERROR: Can not create the output compression threads\n");
+            exit(1);
+        }
+    }
+    if (pthread_create(&(w->thread), NULL, outwriter_routine, (void*) w) != 0){
+        fprintf(stderr, "ERROR: Can not create the output writer thread\n");
+        exit(1);
+    }
+    return w;
+}
+
+// the buffer of the calling thread. Append one complete record to it and
+// call outwriter_commit(). If the pool is empty, we wait for the writer.
+// returns NULL only if we can't allocate the memory of a buffer.
+jsonenc_buf * outwriter_buffer(outwriter_ctx * w){
+    return outwriter_lane_buffer(w, 0);
+}
+
+// the same for the records of shard 'lane' (less than 'w->lanes')
+jsonenc_buf * outwriter_lane_buffer(outwriter_ctx * w, unsigned int lane){
+    outwriter_buf * b = outwriter_current[w->slot][lane];
+    if (b != NULL)
+        return &(b->data);
+    b = (outwriter_buf*) mpmc_pop(w->free);
+    if (b == NULL){
+        __atomic_fetch_add(&(w->stalls), 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&(w->lock));
+        __atomic_fetch_add(&(w->waiting), 1, __ATOMIC_SEQ_CST);
+        while ((b = (outwriter_buf*) mpmc_pop(w->free)) == NULL)
+            outwriter_wait(&(w->lock), &(w->room));
+        __atomic_fetch_sub(&(w->waiting), 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&(w->lock));
+    }
+    if (b->data.size < OUTWRITER_BUFFER_SIZE && jsonenc_reserve(&(b->data), OUTWRITER_BUFFER_SIZE) != 0){
+        fprintf(stderr, "Can not allocate memory for the output buffer\n");
+        mpmc_push(w->free, b);
+        return NULL;
+    }
+    if (w->exact && b->ends == NULL){
+        b->ends = (uint32_t*) malloc(OUTWRITER_MAX_RECORDS * sizeof(uint32_t));
+        if (b->ends == NULL){
+            fprintf(stderr, "Can not allocate memory for the output buffer\n");
+            mpmc_push(w->free, b);
+            return NULL;
+        }
+    }
+    b->since_ms = outwriter_now_ms();
+    b->lane = lane;
+    b->records = 0;
+    outwriter_current[w->slot][lane] = b;
+    return &(b->data);
+}
+
+// give the buffer of the calling thread for 'lane' to the writer
+static void outwriter_handoff(outwriter_ctx * w, unsigned int lane){
+    outwriter_buf * b = outwriter_current[w->slot][lane];
+    outwriter_current[w->slot][lane] = NULL;
+    if (b->data.len == 0){
+        mpmc_push(w->free, b);
+        return;
+    }
+    outwriter_put(w, &(w->ready), b);
+}
+
+// a record was appended: hand off the buffer if it's nearly full
+void outwriter_commit(outwriter_ctx * w){
+    outwriter_lane_commit(w, 0);
+}
+
+void outwriter_lane_commit(outwriter_ctx * w, unsigned int lane){
+    outwriter_buf * b = outwriter_current[w->slot][lane];
+    if (b == NULL)
+        return;
+    if (w->exact)
+        b->ends[b->records] = (uint32_t) b->data.len;
+    b->records += 1;
+    if (b->data.len + OUTWRITER_RECORD_ROOM > OUTWRITER_BUFFER_SIZE ||
+        (w->exact && b->records == OUTWRITER_MAX_RECORDS))
+        outwriter_handoff(w, lane);
+}
+
+// called from time to time by the producers: don't keep the records
+// of a slow scan for more than OUTWRITER_FLUSH_MS. 'w' may be NULL.
+void outwriter_tick(outwriter_ctx * w, uint64_t now_ms){
+    if (w == NULL)
+        return;
+    for (unsigned int lane=0; lane<w->lanes; ++lane){
+        outwriter_buf * b = outwriter_current[w->slot][lane];
+        if (b != NULL && b->data.len > 0 && now_ms >= b->since_ms + OUTWRITER_FLUSH_MS)
+            outwriter_handoff(w, lane);
+    }
+}
+
+// the calling thread is done: hand off what it has. 'w' may be NULL.
+void outwriter_release(outwriter_ctx * w){
+    if (w == NULL)
+        return;
+    for (unsigned int lane=0; lane<w->lanes; ++lane){
+        if (outwriter_current[w->slot][lane] != NULL)
+            outwriter_handoff(w, lane);
+    }
+}
+
+// all the producers released their buffer: write what's left and stop the
+// threads (the workers first, then the writer has all the blocks)
+void outwriter_close(outwriter_ctx * w){
+    outwriter_close_stage(w, &(w->ready));
+    for (unsigned int i=0; i<w->num_workers; ++i)
+        pthread_join(w->workers[i], NULL);
+    outwriter_close_stage(w, &(w->packed));
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&(w->lock));
+    pthread_cond_destroy(&(w->ready.wake));
+    pthread_cond_destroy(&(w->packed.wake));
+    pthread_cond_destroy(&(w->room));
+}
+
+void outwriter_free(outwriter_ctx * w){
+    if (w == NULL)
+        return;
+    for (unsigned int i=0; w->bufs != NULL && i<w->count; ++i){
+        jsonenc_free(&(w->bufs[i].data));
+        jsonenc_free(&(w->bufs[i].packed));
+        free(w->bufs[i].ends);
+    }
+    free(w->bufs);
+    free(w->workers);
+    mpmc_free(w->free);
+    mpmc_free(w->ready.ring);
+    mpmc_free(w->packed.ring);
+    if (w->slot >= 0)
+        __atomic_fetch_and(&outwriter_slots, ~(1U << w->slot), __ATOMIC_SEQ_CST);
+    free(w);
+}
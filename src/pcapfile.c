@@ -0,0 +1,84 @@
+#include <string.h>
+#include <pcapfile.h>
+
+static inline void pcapfile_put16(char * p, uint16_t value){
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void pcapfile_put32(char * p, uint32_t value){
+    pcapfile_put16(p, value >> 16);
+    pcapfile_put16(p + 2, value & 0xFFFF);
+}
+
+// the IPv4 header checksum: one's complement of the sum of its 16-bit words
+static uint16_t pcapfile_checksum(const char * header){
+    uint32_t sum = 0;
+    for (int i=0; i<PCAPFILE_IP_HEADER_SIZE; i+=2)
+        sum += ((uint8_t)header[i] << 8) | (uint8_t)header[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+int pcapfile_header(jsonenc_buf * buf){
+    if (jsonenc_reserve(buf, PCAPFILE_FILE_HEADER_SIZE) != 0)
+        return 1;
+    uint32_t magic = PCAPFILE_MAGIC;
+    uint16_t version[2] = {2, 4};
+    uint32_t rest[4] = {0, 0, PCAPFILE_SNAPLEN, PCAPFILE_LINKTYPE_RAW};     // zone, sigfigs, snaplen, link type
+    char * p = buf->mem + buf->len;
+    memcpy(p, &magic, 4);
+    memcpy(p + 4, version, 4);
+    memcpy(p + 8, rest, 16);
+    buf->len += PCAPFILE_FILE_HEADER_SIZE;
+    return 0;
+}
+
+// append the packet of 'msg' from 'src' to 'dst' ('proto' is PCAPFILE_UDP or
+// PCAPFILE_TCP) seen at 'time_us' (unix time). A packet larger than the
+// snap length is cut, like a capture would do. returns 0 on success
+int pcapfile_append(jsonenc_buf * buf, int proto, const struct sockaddr_in * src, const struct sockaddr_in * dst,
+                    const char * msg, size_t len, uint64_t time_us){
+    size_t transport = proto == PCAPFILE_TCP?PCAPFILE_TCP_HEADER_SIZE + 2:PCAPFILE_UDP_HEADER_SIZE;
+    size_t headers = PCAPFILE_IP_HEADER_SIZE + transport;
+    size_t packet = headers + len;
+    size_t captured = packet > PCAPFILE_SNAPLEN?PCAPFILE_SNAPLEN:packet;
+    if (jsonenc_reserve(buf, PCAPFILE_RECORD_HEADER_SIZE + captured) != 0)
+        return 1;
+    char * p = buf->mem + buf->len;
+    uint32_t record[4] = {(uint32_t)(time_us / 1000000), (uint32_t)(time_us % 1000000),
+                          (uint32_t)captured, (uint32_t)packet};
+    memcpy(p, record, PCAPFILE_RECORD_HEADER_SIZE);
+    p += PCAPFILE_RECORD_HEADER_SIZE;
+    // IPv4: no options, don't fragment, TTL 64
+    memset(p, 0, headers);
+    p[0] = 0x45;
+    // the length of the whole packet: only the record header knows the snap length
+    pcapfile_put16(p + 2, (uint16_t)(packet > 65535?65535:packet));
+    pcapfile_put16(p + 6, 0x4000);
+    p[8] = 64;
+    p[9] = (char)proto;
+    memcpy(p + 12, &(src->sin_addr.s_addr), 4);
+    memcpy(p + 16, &(dst->sin_addr.s_addr), 4);
+    pcapfile_put16(p + 10, pcapfile_checksum(p));
+    char * t = p + PCAPFILE_IP_HEADER_SIZE;
+    memcpy(t, &(src->sin_port), 2);
+    memcpy(t + 2, &(dst->sin_port), 2);
+    if (proto == PCAPFILE_TCP){
+        // one segment with the whole message: PSH+ACK, no options. We
+        // don't know the sequence numbers of the connection.
+        pcapfile_put32(t + 4, 1);
+        pcapfile_put32(t + 8, 1);
+        t[12] = (PCAPFILE_TCP_HEADER_SIZE / 4) << 4;
+        t[13] = 0x18;
+        pcapfile_put16(t + 14, 65535);
+        pcapfile_put16(t + PCAPFILE_TCP_HEADER_SIZE, (uint16_t)len);
+    }else{
+        // the UDP checksum is optional over IPv4: zero means none
+        pcapfile_put16(t + 4, (uint16_t)(PCAPFILE_UDP_HEADER_SIZE + len));
+    }
+    memcpy(p + headers, msg, captured - headers);
+    buf->len += PCAPFILE_RECORD_HEADER_SIZE + captured;
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <string.h>
+#include <qtemplate.h>
+
+// build the template of the queries. 'edns' adds an OPT record with the
+// DO bit if 'set_do' and an empty NSID option if 'set_nsid'.
+void qtemplate_init(qtemplate_ctx * ctx, uint16_t qtype, uint16_t qclass, int edns, int set_do, int set_nsid){
+    memset(ctx, 0, sizeof(qtemplate_ctx));
+    // ID (set per query), RD=1, one question and the OPT record
+    ctx->header[2] = 0x01;
+    ctx->header[5] = 1;
+    ctx->header[11] = edns?1:0;
+    uint8_t * p = ctx->trailer;
+    *p++ = (uint8_t)(qtype >> 8);
+    *p++ = (uint8_t)(qtype & 0xFF);
+    *p++ = (uint8_t)(qclass >> 8);
+    *p++ = (uint8_t)(qclass & 0xFF);
+    if (edns){
+        *p++ = 0;                   // root name
+        *p++ = 0;                   // type OPT (41)
+        *p++ = 41;
+        *p++ = (uint8_t)(QTEMPLATE_EDNS_UDP_SIZE >> 8);
+        *p++ = (uint8_t)(QTEMPLATE_EDNS_UDP_SIZE & 0xFF);
+        *p++ = 0;                   // extended rcode
+        *p++ = 0;                   // version
+        *p++ = set_do?0x80:0;       // DO bit and Z
+        *p++ = 0;
+        *p++ = 0;                   // rdlen
+        *p++ = set_nsid?4:0;
+        if (set_nsid){
+            *p++ = 0;               // option NSID (3) with no data
+            *p++ = 3;
+            *p++ = 0;
+            *p++ = 0;
+        }
+    }
+    ctx->trailer_len = p - ctx->trailer;
+}
+
+// write the query for 'name' ("example.com" or "example.com.") with 'id'
+// to 'buffer'. returns the size of the query or 0 if the name is not
+// valid or the query does not fit in 'size' bytes.
+size_t qtemplate_build(qtemplate_ctx * ctx, const char * name, uint16_t id, char * buffer, size_t size){
+    if (size < QTEMPLATE_HEADER_SIZE + QTEMPLATE_MAX_NAME + ctx->trailer_len)
+        return 0;
+    memcpy(buffer, ctx->header, QTEMPLATE_HEADER_SIZE);
+    buffer[0] = (char)(id >> 8);
+    buffer[1] = (char)(id & 0xFF);
+    // encode the labels: the length byte of each label goes where the
+    // previous dot was
+    size_t pos = QTEMPLATE_HEADER_SIZE;
+    if (!(name[0] == '.' && name[1] == '\0')){
+        const char * label = name;
+        while (1){
+            const char * dot = strchr(label, '.');
+            size_t len = dot == NULL?strlen(label):(size_t)(dot - label);
+            if (len == 0 && dot == NULL)
+                break;      // trailing dot
+            if (len == 0 || len > 63 || pos - QTEMPLATE_HEADER_SIZE + len + 2 > QTEMPLATE_MAX_NAME)
+                return 0;
+            buffer[pos++] = (char)len;
+            memcpy(buffer + pos, label, len);
+            pos += len;
+            if (dot == NULL)
+                break;
+            label = dot + 1;
+        }
+    }
+    buffer[pos++] = 0;
+    memcpy(buffer + pos, ctx->trailer, ctx->trailer_len);
+    return pos + ctx->trailer_len;
+}
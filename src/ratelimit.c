@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ratelimit.h>
+
+// 'rate' is the number of tokens per second. 'slice_ns' is the pacing
+// slice: at most one slice worth of tokens can be taken at once, so
+// the traffic is spread over time instead of being sent in bursts.
+ratelimit_ctx * ratelimit_init(double rate, uint64_t slice_ns){
+    if (rate <= 0)
+        return NULL;
+    ratelimit_ctx * ctx = (ratelimit_ctx*) malloc(sizeof(ratelimit_ctx));
+    if (!ctx){
+        fprintf(stderr, "Can not initialize the rate limiter\n");
+        return NULL;
+    }
+    ctx->interval = (uint64_t)(1000000000.0 / rate);
+    if (ctx->interval == 0)
+        ctx->interval = 1;
+    // we always allow at least one token
+    ctx->burst = slice_ns > ctx->interval?slice_ns - ctx->interval:0;
+    ctx->tat = 0;
+    return ctx;
+}
+
+// take one token at time 'now' (nanoseconds, monotonic).
+// return 0 on success. Otherwise, return 1 and set 'wait' to the
+// number of nanoseconds before the next token is available.
+int ratelimit_take(ratelimit_ctx * ctx, uint64_t now, uint64_t * wait){
+    uint64_t tat = __atomic_load_n(&(ctx->tat), __ATOMIC_RELAXED);
+    while (1){
+        uint64_t start = tat > now?tat:now;
+        if (start - now > ctx->burst){
+            *wait = start - now - ctx->burst;
+            return 1;
+        }
+        if (__atomic_compare_exchange_n(&(ctx->tat), &tat, start + ctx->interval, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 0;
+        // somebody else took a token, 'tat' has the new value. Try again.
+    }
+}
+
+// give back a token we took but could not use
+void ratelimit_refund(ratelimit_ctx * ctx){
+    __atomic_fetch_sub(&(ctx->tat), ctx->interval, __ATOMIC_RELAXED);
+}
+
+void ratelimit_free(ratelimit_ctx * ctx){
+    free(ctx);
+}
@@ -0,0 +1,68 @@
+#include <string.h>
+#include <rawlog.h>
+
+static inline void rawlog_put16(char * p, uint16_t value){
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline void rawlog_put32(char * p, uint32_t value){
+    rawlog_put16(p, value >> 16);
+    rawlog_put16(p + 2, value & 0xFFFF);
+}
+
+static inline uint16_t rawlog_get16(const char * p){
+    return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+}
+
+static inline uint32_t rawlog_get32(const char * p){
+    return ((uint32_t)rawlog_get16(p) << 16) | rawlog_get16(p + 2);
+}
+
+int rawlog_file_header(jsonenc_buf * buf, uint32_t flags){
+    if (jsonenc_reserve(buf, RAWLOG_FILE_HEADER_SIZE) != 0)
+        return 1;
+    memcpy(buf->mem + buf->len, RAWLOG_MAGIC, RAWLOG_MAGIC_SIZE);
+    rawlog_put32(buf->mem + buf->len + RAWLOG_MAGIC_SIZE, flags);
+    buf->len += RAWLOG_FILE_HEADER_SIZE;
+    return 0;
+}
+
+// 'data' has RAWLOG_FILE_HEADER_SIZE bytes. returns 0 if it's our header
+int rawlog_check_file_header(const char * data, uint32_t * flags){
+    if (memcmp(data, RAWLOG_MAGIC, RAWLOG_MAGIC_SIZE) != 0)
+        return 1;
+    *flags = rawlog_get32(data + RAWLOG_MAGIC_SIZE);
+    return 0;
+}
+
+// append one answer to 'buf'. returns 0 on success
+int rawlog_append(jsonenc_buf * buf, const char * msg, size_t len, dnswire_meta * meta){
+    if (len > RAWLOG_MAX_MESSAGE || jsonenc_reserve(buf, RAWLOG_RECORD_HEADER_SIZE + len) != 0)
+        return 1;
+    char * p = buf->mem + buf->len;
+    rawlog_put32(p, (uint32_t)len);
+    rawlog_put32(p + 4, (uint32_t)(meta->time_us >> 32));
+    rawlog_put32(p + 8, (uint32_t)meta->time_us);
+    rawlog_put32(p + 12, meta->rtt_us);
+    memcpy(p + 16, &(meta->addr), 4);
+    memcpy(p + 20, &(meta->port), 2);
+    rawlog_put16(p + 22, meta->attempts > 0xFFFF?0xFFFF:(uint16_t)meta->attempts);
+    memcpy(p + RAWLOG_RECORD_HEADER_SIZE, msg, len);
+    buf->len += RAWLOG_RECORD_HEADER_SIZE + len;
+    return 0;
+}
+
+// read the record header in 'data' (RAWLOG_RECORD_HEADER_SIZE bytes): the
+// length of the message which follows and its metadata. returns 0 on success
+int rawlog_record_header(const char * data, size_t * len, dnswire_meta * meta){
+    *len = rawlog_get32(data);
+    if (*len > RAWLOG_MAX_MESSAGE)
+        return 1;
+    meta->time_us = ((uint64_t)rawlog_get32(data + 4) << 32) | rawlog_get32(data + 8);
+    meta->rtt_us = rawlog_get32(data + 12);
+    memcpy(&(meta->addr), data + 16, 4);
+    memcpy(&(meta->port), data + 20, 2);
+    meta->attempts = rawlog_get16(data + 22);
+    return 0;
+}
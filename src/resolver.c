@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <resolver.h>
+
+// parse one resolver 'ip[:port][@weight]' into 'entry'.
+// returns 0 on success and 1 on error
+static int resolver_parse(const char * spec, uint16_t default_port, resolver_entry * entry){
+    char token[64];
+    if (strlen(spec) >= sizeof(token))
+        return 1;
+    strcpy(token, spec);
+    unsigned long int weight = 1;
+    unsigned long int port = default_port;
+    char * at = strchr(token, '@');
+    if (at != NULL){
+        *at = '\0';
+        char * end = NULL;
+        weight = strtoul(at + 1, &end, 10);
+        if (end == at + 1 || *end != '\0' || weight == 0 || weight > RESOLVER_MAX_WEIGHT)
+            return 1;
+    }
+    char * colon = strchr(token, ':');
+    if (colon != NULL){
+        *colon = '\0';
+        char * end = NULL;
+        port = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || port == 0 || port > 65535)
+            return 1;
+    }
+    memset(entry, 0, sizeof(resolver_entry));
+    entry->addr.sin_family = AF_INET;
+    entry->addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, token, &(entry->addr.sin_addr)) != 1)
+        return 1;
+    entry->weight = (unsigned int)weight;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &(entry->addr.sin_addr), ip, sizeof(ip));
+    snprintf(entry->name, sizeof(entry->name), "%s:%lu", ip, port);
+    return 0;
+}
+
+// add all the resolvers of 'line' (separated by ',' or spaces) to the pool.
+// returns 0 on success and 1 on error
+static int resolver_add_line(resolver_pool * pool, char * line, uint16_t default_port){
+    char * comment = strchr(line, '#');
+    if (comment != NULL)
+        *comment = '\0';
+    char * saveptr = NULL;
+    char * token = strtok_r(line, ", \t\r\n", &saveptr);
+    while (token != NULL){
+        resolver_entry * tmp = (resolver_entry*) realloc(pool->list, (pool->count + 1) * sizeof(resolver_entry));
+        if (tmp == NULL){
+            fprintf(stderr, "Can not allocate memory for the resolvers\n");
+            return 1;
+        }
+        pool->list = tmp;
+        if (resolver_parse(token, default_port, &(pool->list[pool->count])) != 0){
+            fprintf(stderr, "Wrong resolver: %s (expected ip[:port][@weight])\n", token);
+            return 1;
+        }
+        pool->count += 1;
+        token = strtok_r(NULL, ", \t\r\n", &saveptr);
+    }
+    return 0;
+}
+
+// 'spec' is either a file with one or more resolvers per line or a
+// comma-separated list of resolvers. Each resolver is 'ip[:port][@weight]'.
+// 'rate' is the limit of each resolver in queries per second (0: no limit).
+resolver_pool * resolver_pool_init(const char * spec, uint16_t default_port, int policy, double rate, uint64_t slice_ns){
+    resolver_pool * pool = (resolver_pool*) calloc(1, sizeof(resolver_pool));
+    if (!pool){
+        fprintf(stderr, "Can not initialize the resolver pool\n");
+        return NULL;
+    }
+    pool->policy = policy;
+    int res = 0;
+    FILE * fp = NULL;
+    if (strchr(spec, ',') == NULL && access(spec, R_OK) == 0)
+        fp = fopen(spec, "r");
+    if (fp != NULL){
+        char line[1024];
+        while (res == 0 && fgets(line, sizeof(line), fp) != NULL)
+            res = resolver_add_line(pool, line, default_port);
+        fclose(fp);
+    }else{
+        char * copy = strdup(spec);
+        res = resolver_add_line(pool, copy, default_port);
+        free(copy);
+    }
+    if (res == 0 && pool->count == 0){
+        fprintf(stderr, "No resolver found in: %s\n", spec);
+        res = 1;
+    }
+    if (res != 0){
+        resolver_pool_free(pool);
+        return NULL;
+    }
+    for (unsigned int i=0; i<pool->count; ++i){
+        if (rate > 0){
+            pool->list[i].rate = ratelimit_init(rate, slice_ns);
+            if (pool->list[i].rate == NULL){
+                resolver_pool_free(pool);
+                return NULL;
+            }
+        }
+    }
+    pool->healthy = pool->count;
+    return pool;
+}
+
+void resolver_pool_free(resolver_pool * pool){
+    if (pool == NULL)
+        return;
+    for (unsigned int i=0; i<pool->count; ++i)
+        ratelimit_free(pool->list[i].rate);
+    free(pool->list);
+    free(pool);
+}
+
+resolver_load * resolver_load_init(resolver_pool * pool){
+    resolver_load * load = (resolver_load*) calloc(pool->count, sizeof(resolver_load));
+    if (!load)
+        fprintf(stderr, "Can not allocate memory for the resolver load\n");
+    return load;
+}
+
+// add the counters of an engine to the totals of the pool and free them
+void resolver_load_free(resolver_pool * pool, resolver_load * load){
+    if (load == NULL)
+        return;
+    for (unsigned int i=0; i<pool->count; ++i){
+        __atomic_fetch_add(&(pool->list[i].sent), load[i].sent, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(pool->list[i].total_timeouts), load[i].timeouts, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(pool->list[i].total_refused), load[i].refused, __ATOMIC_RELAXED);
+    }
+    free(load);
+}
+
+// returns 1 if we can send queries to the resolver (it's not ejected)
+int resolver_usable(resolver_pool * pool, unsigned int idx){
+    return __atomic_load_n(&(pool->list[idx].ejected_until), __ATOMIC_RELAXED) == 0;
+}
+
+// choose the resolver of the next query. If an ejected resolver is due
+// for a probe, we pick it and set 'probe' to 1: the caller must report
+// the result of this query with the same flag.
+unsigned int resolver_pick(resolver_pool * pool, resolver_load * load, uint64_t now, int * probe){
+    *probe = 0;
+    if (pool->count == 1)
+        return 0;
+    if (__atomic_load_n(&(pool->healthy), __ATOMIC_RELAXED) < pool->count){
+        for (unsigned int i=0; i<pool->count; ++i){
+            uint64_t until = __atomic_load_n(&(pool->list[i].ejected_until), __ATOMIC_RELAXED);
+            if (until == 0 || now < until)
+                continue;
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&(pool->list[i].probing), &expected, 1, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+                *probe = 1;
+                return i;
+            }
+        }
+    }
+    long int best = -1;
+    if (pool->policy == RESOLVER_POLICY_LEAST){
+        // the lowest outstanding/weight wins
+        for (unsigned int i=0; i<pool->count; ++i){
+            if (!resolver_usable(pool, i))
+                continue;
+            if (best == -1 || (uint64_t)load[i].outstanding * pool->list[best].weight <
+                              (uint64_t)load[best].outstanding * pool->list[i].weight)
+                best = i;
+        }
+    }else{
+        // smooth weighted round-robin (as in nginx): every resolver gains its
+        // weight, the richest one is picked and pays the total weight.
+        long int total = 0;
+        for (unsigned int i=0; i<pool->count; ++i){
+            if (!resolver_usable(pool, i))
+                continue;
+            load[i].current += pool->list[i].weight;
+            total += pool->list[i].weight;
+            if (best == -1 || load[i].current > load[best].current)
+                best = i;
+        }
+        if (best != -1)
+            load[best].current -= total;
+    }
+    // we never eject the last healthy resolver but a probe may have just
+    // ejected it again. Take the first one in that case.
+    return best == -1?0:(unsigned int)best;
+}
+
+// a usable resolver other than 'except' with the lowest outstanding/weight
+// (for the duplicates of '--hedge'). It doesn't move the round-robin, so the
+// duplicates don't change how the other queries are spread, and it never
+// probes an ejected resolver. returns 'except' if there is no other one.
+unsigned int resolver_pick_other(resolver_pool * pool, resolver_load * load, unsigned int except){
+    long int best = -1;
+    for (unsigned int i=0; i<pool->count; ++i){
+        if (i == except || !resolver_usable(pool, i))
+            continue;
+        if (best == -1 || (uint64_t)load[i].outstanding * pool->list[best].weight <
+                          (uint64_t)load[best].outstanding * pool->list[i].weight)
+            best = i;
+    }
+    return best == -1?except:(unsigned int)best;
+}
+
+// the probe query was dropped before we know its result (e.g. another
+// answer won the race). The resolver stays ejected and the next pick probes it.
+void resolver_cancel_probe(resolver_pool * pool, unsigned int idx){
+    __atomic_store_n(&(pool->list[idx].probing), 0, __ATOMIC_RELEASE);
+}
+
+// eject the resolver for 'ms' milliseconds
+static void resolver_eject(resolver_entry * entry, uint64_t now, uint64_t ms, const char * why){
+    __atomic_store_n(&(entry->ejected_until), now + ms, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(entry->total_ejections), 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "resolver %s ejected for %lus (%s)\n", entry->name, (unsigned long)(ms / 1000), why);
+}
+
+// tell the pool what happened to a query sent to resolver 'idx'
+void resolver_report(resolver_pool * pool, resolver_load * load, unsigned int idx, int outcome, int probe, uint64_t now){
+    resolver_entry * entry = &(pool->list[idx]);
+    if (outcome == RESOLVER_TIMEOUT)
+        load[idx].timeouts += 1;
+    else if (outcome == RESOLVER_REFUSED)
+        load[idx].refused += 1;
+    if (probe){
+        if (outcome == RESOLVER_ANSWER){
+            entry->ejections = 0;
+            __atomic_store_n(&(entry->results), 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&(entry->timeouts), 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&(entry->refused), 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&(entry->ejected_until), 0, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&(pool->healthy), 1, __ATOMIC_RELAXED);
+            fprintf(stderr, "resolver %s is back\n", entry->name);
+        }else{
+            // still sick: eject it again for twice as long
+            entry->ejections += 1;
+            uint64_t ms = RESOLVER_EJECT_MS;
+            for (unsigned int i=1; i<entry->ejections && ms < RESOLVER_MAX_EJECT_MS; ++i)
+                ms <<= 1;
+            if (ms > RESOLVER_MAX_EJECT_MS)
+                ms = RESOLVER_MAX_EJECT_MS;
+            resolver_eject(entry, now, ms, outcome == RESOLVER_TIMEOUT?"probe timed out":"probe refused");
+        }
+        __atomic_store_n(&(entry->probing), 0, __ATOMIC_RELEASE);
+        return;
+    }
+    if (!resolver_usable(pool, idx))
+        return;     // a query sent before the ejection
+    if (outcome == RESOLVER_TIMEOUT)
+        __atomic_fetch_add(&(entry->timeouts), 1, __ATOMIC_RELAXED);
+    else if (outcome == RESOLVER_REFUSED)
+        __atomic_fetch_add(&(entry->refused), 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&(entry->results), 1, __ATOMIC_RELAXED) != RESOLVER_HEALTH_WINDOW)
+        return;
+    // end of the health window: only one engine gets here
+    unsigned long int timeouts = __atomic_exchange_n(&(entry->timeouts), 0, __ATOMIC_RELAXED);
+    unsigned long int refused = __atomic_exchange_n(&(entry->refused), 0, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&(entry->results), RESOLVER_HEALTH_WINDOW, __ATOMIC_RELAXED);
+    if (timeouts <= RESOLVER_HEALTH_WINDOW * RESOLVER_MAX_TIMEOUT && refused <= RESOLVER_HEALTH_WINDOW * RESOLVER_MAX_REFUSED)
+        return;
+    // keep at least one resolver in service
+    unsigned int healthy = __atomic_load_n(&(pool->healthy), __ATOMIC_RELAXED);
+    do{
+        if (healthy <= 1)
+            return;
+    }while (!__atomic_compare_exchange_n(&(pool->healthy), &healthy, healthy - 1, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    char why[64];
+    snprintf(why, sizeof(why), "%lu%% timeouts, %lu%% refused",
+             timeouts * 100 / RESOLVER_HEALTH_WINDOW, refused * 100 / RESOLVER_HEALTH_WINDOW);
+    entry->ejections = 1;
+    resolver_eject(entry, now, RESOLVER_EJECT_MS, why);
+}
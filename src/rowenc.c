@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <rowenc.h>
+
+static const char * rowenc_field_names[] = {"qname", "qtype", "qclass", "rcode", "id", "flags",
+                                            "ancount", "nscount", "arcount", "attempts", "resolver", "rtt", "time"};
+static const char * rowenc_section_names[] = {"answer", "authority", "additional"};
+static const char * rowenc_rr_names[] = {"name", "type", "class", "ttl", "rdata"};
+
+#define ROWENC_NUM_FIELDS (sizeof(rowenc_field_names) / sizeof(rowenc_field_names[0]))
+#define ROWENC_NUM_SECTIONS (sizeof(rowenc_section_names) / sizeof(rowenc_section_names[0]))
+
+static inline uint16_t rowenc_u16(const char * p){
+    return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+}
+
+static inline uint32_t rowenc_u32(const char * p){
+    return ((uint32_t)rowenc_u16(p) << 16) | rowenc_u16(p + 2);
+}
+
+static inline int rowenc_str(jsonenc_buf * buf, const char * str){
+    return jsonenc_append(buf, str, strlen(str));
+}
+
+static inline int rowenc_char(jsonenc_buf * buf, char c){
+    return jsonenc_append(buf, &c, 1);
+}
+
+// returns the ROWENC_FORMAT_* of 'name' or -1
+int rowenc_format(const char * name){
+    if (strcasecmp(name, "json") == 0)
+        return ROWENC_FORMAT_JSON;
+    if (strcasecmp(name, "tsv") == 0)
+        return ROWENC_FORMAT_TSV;
+    if (strcasecmp(name, "csv") == 0)
+        return ROWENC_FORMAT_CSV;
+    if (strcasecmp(name, "raw") == 0)
+        return ROWENC_FORMAT_RAW;
+    return -1;
+}
+
+// the id of one field of '--fields' or -1. 'ttl' and 'rdata' are
+// short for 'answer.ttl' and 'answer.rdata'.
+static int rowenc_field(const char * name){
+    if (strcmp(name, "ttl") == 0 || strcmp(name, "rdata") == 0)
+        return ROWENC_SECTION_FIELDS + (name[0] == 't'?ROWENC_RR_TTL:ROWENC_RR_RDATA);
+    for (unsigned int i=0; i<ROWENC_NUM_FIELDS; ++i){
+        if (strcmp(name, rowenc_field_names[i]) == 0)
+            return i;
+    }
+    const char * dot = strchr(name, '.');
+    if (dot == NULL)
+        return -1;
+    for (unsigned int s=0; s<ROWENC_NUM_SECTIONS; ++s){
+        if (strlen(rowenc_section_names[s]) != (size_t)(dot - name) ||
+            strncmp(name, rowenc_section_names[s], dot - name) != 0)
+            continue;
+        for (int f=0; f<ROWENC_RR_FIELDS; ++f){
+            if (strcmp(dot + 1, rowenc_rr_names[f]) == 0)
+                return ROWENC_SECTION_FIELDS + s * ROWENC_RR_FIELDS + f;
+        }
+    }
+    return -1;
+}
+
+// 'fields' is the comma-separated list of '--fields' (NULL: the default
+// ones). returns 0 on success and 1 if a field is unknown.
+int rowenc_init(rowenc_ctx * ctx, int format, const char * fields){
+    memset(ctx, 0, sizeof(rowenc_ctx));
+    ctx->format = format;
+    char * copy = strdup(fields != NULL?fields:ROWENC_DEFAULT_FIELDS);
+    if (copy == NULL)
+        return 1;
+    int res = 0;
+    char * saveptr = NULL;
+    char * token = strtok_r(copy, ", ", &saveptr);
+    while (token != NULL && res == 0){
+        int field = rowenc_field(token);
+        if (field == -1){
+            fprintf(stderr, "Unknown field: %s\n", token);
+            res = 1;
+        }else if (ctx->count == ROWENC_MAX_FIELDS){
+            fprintf(stderr, "Too many fields (at most %d)\n", ROWENC_MAX_FIELDS);
+            res = 1;
+        }else{
+            ctx->fields[ctx->count++] = field;
+        }
+        token = strtok_r(NULL, ", ", &saveptr);
+    }
+    free(copy);
+    if (res == 0 && ctx->count == 0){
+        fprintf(stderr, "No field to write\n");
+        res = 1;
+    }
+    return res;
+}
+
+// one name in the presentation format ("a.b.c.", "." for the root). The
+// special characters are escaped ('\.', '\"', ...) and the non-printable
+// ones are written as '\DDD'.
+static int rowenc_name(jsonenc_buf * buf, const char * msg, size_t len, size_t pos){
+    unsigned int pointers = 0;
+    size_t written = 0;
+    while (pos < len){
+        uint8_t label = (uint8_t)msg[pos];
+        if (label == 0)
+            return written == 0?rowenc_char(buf, '.'):0;
+        if ((label & 0xC0) == 0xC0){
+            if (pos + 2 > len || ++pointers > DNSWIRE_MAX_POINTERS)
+                return 1;
+            pos = ((label & 0x3F) << 8) | (uint8_t)msg[pos + 1];
+            continue;
+        }
+        if ((label & 0xC0) != 0 || pos + 1 + label > len || jsonenc_reserve(buf, label * 4 + 1) != 0)
+            return 1;
+        char * out = buf->mem + buf->len;
+        for (size_t i=pos+1; i<=pos+label; ++i){
+            uint8_t c = (uint8_t)msg[i];
+            if (c <= 0x20 || c >= 0x7F){
+                out += sprintf(out, "\\%03u", c);
+            }else{
+                if (c == '.' || c == '\\' || c == '"' || c == ';')
+                    *out++ = '\\';
+                *out++ = (char)c;
+            }
+        }
+        *out++ = '.';
+        buf->len = out - buf->mem;
+        written += label + 1;
+        pos += label + 1;
+    }
+    return 1;
+}
+
+// the name at 'pos' inside the rdata (which ends at 'end'), then move 'pos' after it
+static int rowenc_rdata_name(jsonenc_buf * buf, const char * msg, size_t len, size_t * pos, size_t end){
+    size_t next = *pos;
+    if (dnswire_skip_name(msg, end, &next) != 0 || rowenc_name(buf, msg, len, *pos) != 0)
+        return 1;
+    *pos = next;
+    return 0;
+}
+
+// one character-string with \DDD for the bytes we can't print, between
+// double quotes or (without 'quoted') with its spaces escaped as well
+static int rowenc_escape(jsonenc_buf * buf, const char * data, size_t len, int quoted){
+    if (jsonenc_reserve(buf, len * 4 + 2) != 0)
+        return 1;
+    char * out = buf->mem + buf->len;
+    if (quoted)
+        *out++ = '"';
+    for (size_t i=0; i<len; ++i){
+        uint8_t c = (uint8_t)data[i];
+        if (c < 0x20 || c >= 0x7F || (c == ' ' && !quoted)){
+            out += sprintf(out, "\\%03u", c);
+        }else{
+            if (c == '"' || c == '\\')
+                *out++ = '\\';
+            *out++ = (char)c;
+        }
+    }
+    if (quoted)
+        *out++ = '"';
+    buf->len = out - buf->mem;
+    return 0;
+}
+
+static int rowenc_text(jsonenc_buf * buf, const char * data, size_t len){
+    return rowenc_escape(buf, data, len, 1);
+}
+
+static int rowenc_hex(jsonenc_buf * buf, const char * data, size_t len){
+    static const char * digits = "0123456789abcdef";
+    if (jsonenc_reserve(buf, len * 2) != 0)
+        return 1;
+    char * out = buf->mem + buf->len;
+    for (size_t i=0; i<len; ++i){
+        *out++ = digits[(uint8_t)data[i] >> 4];
+        *out++ = digits[(uint8_t)data[i] & 0x0F];
+    }
+    buf->len = out - buf->mem;
+    return 0;
+}
+
+static int rowenc_uint(jsonenc_buf * buf, uint64_t value, char after){
+    return jsonenc_uint(buf, value) || (after != 0 && rowenc_char(buf, after));
+}
+
+// the rdata of 'rr' in the presentation format. The types we don't know
+// (and the rdata which don't match their type) are in the generic format
+// of RFC 3597: '\# <length> <hex>'.
+int rowenc_rdata(jsonenc_buf * buf, const char * msg, size_t len, dnswire_rr * rr){
+    size_t mark = buf->len;
+    const char * p = msg + rr->rdata;
+    size_t n = rr->rdlen;
+    size_t pos = rr->rdata;
+    size_t end = rr->rdata + rr->rdlen;
+    char ip[INET6_ADDRSTRLEN];
+    char tmp[16];
+    int res = 1;
+    switch (rr->type){
+        case 1:         // A
+        case 28:        // AAAA
+            if ((rr->type == 1 && n != 4) || (rr->type == 28 && n != 16))
+                break;
+            inet_ntop(rr->type == 1?AF_INET:AF_INET6, p, ip, sizeof(ip));
+            res = rowenc_str(buf, ip);
+            break;
+        case 2:         // NS
+        case 5:         // CNAME
+        case 12:        // PTR
+            res = rowenc_rdata_name(buf, msg, len, &pos, end) || pos != end;
+            break;
+        case 15:        // MX
+        case 107:       // LP
+            if (n < 3)
+                break;
+            pos += 2;
+            res = rowenc_uint(buf, rowenc_u16(p), ' ') || rowenc_rdata_name(buf, msg, len, &pos, end) || pos != end;
+            break;
+        case 6:         // SOA
+            if (rowenc_rdata_name(buf, msg, len, &pos, end) || rowenc_char(buf, ' ') ||
+                rowenc_rdata_name(buf, msg, len, &pos, end) || pos + 20 != end)
+                break;
+            res = 0;
+            for (int i=0; i<5 && res == 0; ++i)
+                res = rowenc_char(buf, ' ') || jsonenc_uint(buf, rowenc_u32(msg + pos + i * 4));
+            break;
+        case 16:        // TXT
+            res = n == 0;
+            while (res == 0 && pos < end){
+                size_t slen = (uint8_t)msg[pos];
+                if (pos + 1 + slen > end){
+                    res = 1;
+                    break;
+                }
+                res = (pos != rr->rdata && rowenc_char(buf, ' ')) || rowenc_text(buf, msg + pos + 1, slen);
+                pos += slen + 1;
+            }
+            break;
+        case 13:        // HINFO
+            if (n < 1 || (size_t)(uint8_t)p[0] + 2 > n || (size_t)(uint8_t)p[0] + 2 + (uint8_t)p[(uint8_t)p[0] + 1] != n)
+                break;
+            res = rowenc_text(buf, p + 1, (uint8_t)p[0]) || rowenc_char(buf, ' ') ||
+                  rowenc_text(buf, p + (uint8_t)p[0] + 2, (uint8_t)p[(uint8_t)p[0] + 1]);
+            break;
+        case 33:        // SRV
+            if (n < 7)
+                break;
+            pos += 6;
+            res = rowenc_uint(buf, rowenc_u16(p), ' ') || rowenc_uint(buf, rowenc_u16(p + 2), ' ') ||
+                  rowenc_uint(buf, rowenc_u16(p + 4), ' ') || rowenc_rdata_name(buf, msg, len, &pos, end) || pos != end;
+            break;
+        case 46:        // RRSIG (the signature in hex)
+            if (n < 19)
+                break;
+            pos += 18;
+            res = rowenc_str(buf, jsonenc_type_name(rowenc_u16(p), tmp)) || rowenc_char(buf, ' ') ||
+                  rowenc_uint(buf, (uint8_t)p[2], ' ') || rowenc_uint(buf, (uint8_t)p[3], ' ') ||
+                  rowenc_uint(buf, rowenc_u32(p + 4), ' ') || rowenc_uint(buf, rowenc_u32(p + 8), ' ') ||
+                  rowenc_uint(buf, rowenc_u32(p + 12), ' ') || rowenc_uint(buf, rowenc_u16(p + 16), ' ') ||
+                  rowenc_rdata_name(buf, msg, len, &pos, end) || rowenc_char(buf, ' ') ||
+                  rowenc_hex(buf, msg + pos, end - pos);
+            break;
+        case 257:       // CAA
+            if (n < 2 || (size_t)(uint8_t)p[1] + 2 > n)
+                break;
+            // the tag is not quoted ('0 issue "ca.example"')
+            res = rowenc_uint(buf, (uint8_t)p[0], ' ') || rowenc_escape(buf, p + 2, (uint8_t)p[1], 0) ||
+                  rowenc_char(buf, ' ') || rowenc_text(buf, p + 2 + (uint8_t)p[1], n - 2 - (uint8_t)p[1]);
+            break;
+    }
+    if (res == 0)
+        return 0;
+    buf->len = mark;
+    return rowenc_str(buf, "\\# ") || rowenc_uint(buf, n, n > 0?' ':0) || rowenc_hex(buf, p, n);
+}
+
+// the value of one field of a record
+static int rowenc_rr_field(jsonenc_buf * buf, const char * msg, size_t len, dnswire_rr * rr, int field){
+    char tmp[16];
+    switch (field){
+        case ROWENC_RR_NAME:
+            return rowenc_name(buf, msg, len, rr->name);
+        case ROWENC_RR_TYPE:
+            return rowenc_str(buf, jsonenc_type_name(rr->type, tmp));
+        case ROWENC_RR_CLASS:
+            return rowenc_str(buf, jsonenc_class_name(rr->rr_class, tmp));
+        case ROWENC_RR_TTL:
+            return jsonenc_uint(buf, rr->ttl);
+        default:
+            return rowenc_rdata(buf, msg, len, rr);
+    }
+}
+
+// one field of a section: the values of all its records. The OPT record
+// of the additional section is not a real record, we skip it.
+static int rowenc_section(jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire, int section, int field){
+    size_t pos = wire->records;
+    dnswire_rr rr;
+    unsigned int skip = 0;
+    unsigned int count = wire->ancount;
+    if (section >= 1){
+        skip += wire->ancount;
+        count = wire->nscount;
+    }
+    if (section == 2){
+        skip += wire->nscount;
+        count = wire->arcount;
+    }
+    for (unsigned int i=0; i<skip; ++i){
+        if (dnswire_next_rr(msg, len, &pos, &rr) != 0)
+            return 1;
+    }
+    int first = 1;
+    for (unsigned int i=0; i<count; ++i){
+        if (dnswire_next_rr(msg, len, &pos, &rr) != 0)
+            return 1;
+        if (rr.type == DNSWIRE_TYPE_OPT)
+            continue;
+        if ((!first && rowenc_char(buf, ROWENC_VALUE_SEPARATOR)) || rowenc_rr_field(buf, msg, len, &rr, field))
+            return 1;
+        first = 0;
+    }
+    return 0;
+}
+
+// 'qr rd ra' like dig
+static int rowenc_flags(jsonenc_buf * buf, const char * msg, dnswire_msg * wire){
+    const char * names[] = {"qr", "aa", "tc", "rd", "ra", "ad", "cd"};
+    int values[] = {wire->qr, wire->aa, wire->tc, wire->rd, wire->ra,
+                    ((uint8_t)msg[3] >> 5) & 1, ((uint8_t)msg[3] >> 4) & 1};
+    int first = 1;
+    for (int i=0; i<7; ++i){
+        if (!values[i])
+            continue;
+        if ((!first && rowenc_char(buf, ' ')) || rowenc_str(buf, names[i]))
+            return 1;
+        first = 0;
+    }
+    return 0;
+}
+
+// 'ip:port' of the resolver
+static int rowenc_resolver(jsonenc_buf * buf, dnswire_meta * meta){
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &(meta->addr), ip, sizeof(ip));
+    return rowenc_str(buf, ip) || rowenc_char(buf, ':') || jsonenc_uint(buf, ntohs(meta->port));
+}
+
+// 'value' is in microseconds. We write it in milliseconds ('digits' is 3)
+// or in seconds ('digits' is 6)
+static int rowenc_fixed(jsonenc_buf * buf, uint64_t value, int digits){
+    char tmp[8];
+    uint64_t unit = digits == 3?1000:1000000;
+    if (jsonenc_uint(buf, value / unit) || rowenc_char(buf, '.'))
+        return 1;
+    snprintf(tmp, sizeof(tmp), "%0*u", digits, (unsigned int)(value % unit));
+    return rowenc_str(buf, tmp);
+}
+
+static int rowenc_value(jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire,
+                        dnswire_meta * meta, int field){
+    char tmp[16];
+    switch (field){
+        case ROWENC_QNAME: return rowenc_name(buf, msg, len, wire->qname);
+        case ROWENC_QTYPE: return rowenc_str(buf, jsonenc_type_name(wire->qtype, tmp));
+        case ROWENC_QCLASS: return rowenc_str(buf, jsonenc_class_name(wire->qclass, tmp));
+        case ROWENC_RCODE: return rowenc_str(buf, jsonenc_rcode_name(wire->rcode, tmp));
+        case ROWENC_ID: return jsonenc_uint(buf, wire->id);
+        case ROWENC_FLAGS: return rowenc_flags(buf, msg, wire);
+        case ROWENC_ANCOUNT: return jsonenc_uint(buf, wire->ancount);
+        case ROWENC_NSCOUNT: return jsonenc_uint(buf, wire->nscount);
+        case ROWENC_ARCOUNT: return jsonenc_uint(buf, wire->arcount);
+        case ROWENC_ATTEMPTS: return jsonenc_uint(buf, meta->attempts);
+        case ROWENC_RESOLVER: return rowenc_resolver(buf, meta);
+        case ROWENC_RTT: return meta->rtt_us == 0?0:rowenc_fixed(buf, meta->rtt_us, 3);     // ms
+        case ROWENC_TIME: return rowenc_fixed(buf, meta->time_us, 6);                       // s
+    }
+    field -= ROWENC_SECTION_FIELDS;
+    return rowenc_section(buf, msg, len, wire, field / ROWENC_RR_FIELDS, field % ROWENC_RR_FIELDS);
+}
+
+// CSV: a value with a comma or a double quote goes between double
+// quotes (RFC 4180). The value is already in 'buf' from 'start'.
+static int rowenc_csv_quote(jsonenc_buf * buf, size_t start){
+    size_t quotes = 0;
+    int special = 0;
+    for (size_t i=start; i<buf->len; ++i){
+        if (buf->mem[i] == '"')
+            quotes++;
+        else if (buf->mem[i] == ',' || buf->mem[i] == '\n' || buf->mem[i] == '\r')
+            special = 1;
+    }
+    if (quotes == 0 && !special)
+        return 0;
+    if (jsonenc_reserve(buf, quotes + 2) != 0)
+        return 1;
+    // move the value to the right from its end, doubling the quotes
+    char * src = buf->mem + buf->len;
+    char * dst = src + quotes + 2;
+    *--dst = '"';
+    while (src > buf->mem + start){
+        *--dst = *--src;
+        if (*src == '"')
+            *--dst = '"';
+    }
+    *--dst = '"';
+    buf->len += quotes + 2;
+    return 0;
+}
+
+// the first line of the output: the names of the fields
+int rowenc_header(rowenc_ctx * ctx, jsonenc_buf * buf){
+    for (unsigned int i=0; i<ctx->count; ++i){
+        int field = ctx->fields[i];
+        if (i > 0 && rowenc_char(buf, ctx->format == ROWENC_FORMAT_CSV?',':'\t'))
+            return 1;
+        if (field < ROWENC_SECTION_FIELDS){
+            if (rowenc_str(buf, rowenc_field_names[field]))
+                return 1;
+            continue;
+        }
+        field -= ROWENC_SECTION_FIELDS;
+        if (rowenc_str(buf, rowenc_section_names[field / ROWENC_RR_FIELDS]) || rowenc_char(buf, '.') ||
+            rowenc_str(buf, rowenc_rr_names[field % ROWENC_RR_FIELDS]))
+            return 1;
+    }
+    return rowenc_char(buf, '\n');
+}
+
+// append the row of 'msg' (checked by dnswire_parse() into 'wire') with
+// its newline to 'buf'. returns 0 on success. On error, 'buf' is left as it was.
+int rowenc_message(rowenc_ctx * ctx, jsonenc_buf * buf, const char * msg, size_t len, dnswire_msg * wire, dnswire_meta * meta){
+    size_t start = buf->len;
+    for (unsigned int i=0; i<ctx->count; ++i){
+        if (i > 0 && rowenc_char(buf, ctx->format == ROWENC_FORMAT_CSV?',':'\t'))
+            break;
+        size_t value = buf->len;
+        if (rowenc_value(buf, msg, len, wire, meta, ctx->fields[i]) != 0)
+            break;
+        if (ctx->format == ROWENC_FORMAT_CSV && rowenc_csv_quote(buf, value) != 0)
+            break;
+        if (i + 1 == ctx->count && rowenc_char(buf, '\n') == 0)
+            return 0;
+    }
+    buf->len = start;
+    return 1;
+}
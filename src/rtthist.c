@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include <rtthist.h>
+
+void rtthist_init(rtthist_ctx * ctx){
+    memset(ctx, 0, sizeof(rtthist_ctx));
+}
+
+static unsigned int rtthist_index(uint64_t value){
+    if (value < RTTHIST_SUB)
+        return (unsigned int)value;
+    if (value >= ((uint64_t)1 << RTTHIST_MAX_BITS))
+        return RTTHIST_BUCKETS - 1;
+    unsigned int exp = 63 - __builtin_clzll(value);
+    unsigned int sub = (value >> (exp - RTTHIST_SUB_BITS)) & (RTTHIST_SUB - 1);
+    return RTTHIST_SUB + (exp - RTTHIST_SUB_BITS) * RTTHIST_SUB + sub;
+}
+
+// the largest value of bucket 'idx'
+static uint64_t rtthist_value(unsigned int idx){
+    if (idx < RTTHIST_SUB)
+        return idx;
+    unsigned int exp = (idx - RTTHIST_SUB) / RTTHIST_SUB + RTTHIST_SUB_BITS;
+    uint64_t sub = (idx - RTTHIST_SUB) % RTTHIST_SUB;
+    uint64_t width = (uint64_t)1 << (exp - RTTHIST_SUB_BITS);
+    return ((RTTHIST_SUB + sub) << (exp - RTTHIST_SUB_BITS)) + width - 1;
+}
+
+void rtthist_add(rtthist_ctx * ctx, uint64_t rtt){
+    ctx->buckets[rtthist_index(rtt)] += 1;
+    ctx->count += 1;
+}
+
+// returns the RTT below which 'percentile'% of the samples are
+// (rounded up to the end of its bucket) or 0 if we have no sample.
+uint64_t rtthist_percentile(rtthist_ctx * ctx, double percentile){
+    if (ctx->count == 0)
+        return 0;
+    unsigned long int rank = (unsigned long int)(ctx->count * percentile / 100.0);
+    if (rank >= ctx->count)
+        rank = ctx->count - 1;
+    unsigned long int seen = 0;
+    for (unsigned int i=0; i<RTTHIST_BUCKETS; ++i){
+        seen += ctx->buckets[i];
+        if (seen > rank)
+            return rtthist_value(i);
+    }
+    return rtthist_value(RTTHIST_BUCKETS - 1);
+}
+
+// add the samples of 'src' to 'dst'. 'dst' may be shared by several
+// threads, so we use atomic additions.
+void rtthist_merge(rtthist_ctx * dst, rtthist_ctx * src){
+    for (unsigned int i=0; i<RTTHIST_BUCKETS; ++i){
+        if (src->buckets[i] != 0)
+            __atomic_fetch_add(&(dst->buckets[i]), src->buckets[i], __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&(dst->count), src->count, __ATOMIC_RELAXED);
+}
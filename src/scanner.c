@@ -4,6 +4,8 @@
 #include <pthread.h>
 #include <unistd.h>         ///< sleep function
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -12,6 +14,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <ctype.h>
 
 #ifdef COMPILE_WITH_LUA
 #include <lua.h>
@@ -20,7 +24,6 @@
 #endif
 
 #include <cstrlib.h>
-#include <cqueue.h>
 #include <sdns.h>
 #include <sdns_json.h>
 #include <sdns_print.h>
@@ -46,6 +49,49 @@ static char * bulkdns_mem_copy(char * data, unsigned long int len){
     return tmp;
 }
 
+static inline uint64_t bulkdns_now_ns(void){
+    /**Monotonic time in nanoseconds*/
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t bulkdns_now_ms(void){
+    /**Monotonic time in milliseconds (the tick of the timer wheels)*/
+    return bulkdns_now_ns() / 1000000;
+}
+
+static inline uint64_t bulkdns_unix_us(void){
+    /**Wall-clock time in microseconds (the time we write in the output)*/
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint64_t bulkdns_rand64(uint64_t * state){
+    /**xorshift64* generator. One state per thread so we never lock (unlike rand())*/
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void bulkdns_random_key(uint8_t * key, size_t len){
+    /**Fills 'key' with random bytes from the kernel (or from the clock if we can't)*/
+    FILE * fp = fopen("/dev/urandom", "rb");
+    if (fp != NULL){
+        size_t done = fread(key, 1, len, fp);
+        fclose(fp);
+        if (done == len)
+            return;
+    }
+    uint64_t state = bulkdns_now_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL);
+    for (size_t i=0; i<len; ++i)
+        key[i] = (uint8_t)(bulkdns_rand64(&state) >> 56);
+}
+
 /*We use COMPILE_WITH_LUA macro because what we have inside the macro
 is only useful when we compile the code with Lua support.*/
 #ifdef COMPILE_WITH_LUA
@@ -106,6 +152,8 @@ int main(int argc, char ** argv){
         free(si->resolver);
         free(si->bind_ip);
         free(si->lua_file);
+        free(si->dnstap_dest);
+        outsplit_free(si->split);
         free(si);
         return 0;
     }
@@ -121,6 +169,10 @@ int main(int argc, char ** argv){
         return 0;
     }
 
+    // '--decode' converts a raw log written by an earlier scan
+    if (si->decode)
+        return switch_decode_mode(si);
+
     // if we are here, it means we are in bulk DNS scan mode
 
     struct thread_param * tp = (struct thread_param*) malloc(sizeof(struct thread_param));
@@ -131,36 +183,77 @@ int main(int argc, char ** argv){
 
     
     // init the input queue
-    tp->qinput = cqueue_init(BULKDNS_MAX_QUEUE_SIZE);
+    tp->qinput = mpmc_queue_init(BULKDNS_MAX_QUEUE_SIZE);
 
     // init the TCP queue
-    tp->queue_tcp = cqueue_init(BULKDNS_MAX_QUEUE_SIZE);
+    tp->queue_tcp = mpmc_queue_init(BULKDNS_MAX_QUEUE_SIZE);
+    tp->names = namearena_init();
+    if (tp->qinput == NULL || tp->queue_tcp == NULL || tp->names == NULL)
+        return 1;
+    tp->shards = NULL;
+    tp->shard_names = NULL;
+
+    // '--dedup' remembers the names with a secret key, so nobody can make
+    // two different names look the same
+    tp->dedup = NULL;
+    if (si->dedup){
+        uint8_t dedup_key[SIPHASH_KEY_SIZE];
+        bulkdns_random_key(dedup_key, SIPHASH_KEY_SIZE);
+        tp->dedup = dedup_init(dedup_key, (size_t)si->dedup_bloom_mb);
+        if (tp->dedup == NULL)
+            return 1;
+    }
+
+    memset(&(tp->stats), 0, sizeof(scan_mode_stats));
+    rtthist_init(&(tp->rtt));
+
+    // rate limiters shared by all the engines
+    tp->rate_limit = NULL;
+    if (si->rate > 0)
+        tp->rate_limit = ratelimit_init(si->rate, BULKDNS_RATE_SLICE_MS * 1000000ULL);
+
+    // the resolvers of '-r', each one with its own '--resolver-rate' limiter
+    tp->resolvers = resolver_pool_init(si->resolver, si->port, si->resolver_policy,
+                                       si->resolver_rate, BULKDNS_RATE_SLICE_MS * 1000000ULL);
+    if (tp->resolvers == NULL){
+        fprintf(stderr, "ERROR: Can not use the resolvers: %s\n", si->resolver);
+        return 1;
+    }
 
-    // randomize the DNS IDs
-    srand(time(NULL));
+    // all the queries come from one template: only the name and the ID change
+    qtemplate_init(&(tp->query), (uint16_t)si->rr_type, (uint16_t)si->rr_class,
+                   !si->no_edns, si->set_do, si->set_nsid);
 
-    // when a thread fetches 'quit_msg' value from input queue, it knows that it's time to die!
-    char quit_msg[50];
-    sprintf(quit_msg, "QUIT_%d%d", rand(), rand());
-    char * quit_data = strdup(quit_msg);
-    tp->quit_data = quit_data;
+    // the secret of the '--stateless' DNS IDs
+    if (si->stateless)
+        bulkdns_random_key(tp->cookie_key, SIPHASH_KEY_SIZE);
 
     // we need to pass input switches to each thread
     tp->si = si;
 
+    // the engines, '--stateless' receivers and TCP threads fill output
+    // buffers and one thread writes them (Lua scripts write on their own)
+    tp->output = NULL;
+    tp->pcap = NULL;
+    tp->dnstap = NULL;
+    tp->dnstap_output = NULL;
+    tp->capture = 0;
+    if (si->lua_file == NULL){
+        if (scan_write_header(si) != 0)
+            return 1;
+        tp->output = scan_output_init(si);
+        if (tp->output == NULL)
+            return 1;
+        // '--pcap' and '--dnstap' have a writer thread of their own
+        if (scan_capture_init(tp) != 0)
+            return 1;
+    }
+
     //read input file
-    char * line;
-    PSTR str;
+    const char * name;
+    size_t name_len;
     char * line_stripped;
 
-    // init the mutex   
-    if (pthread_mutex_init(&(tp->lock), NULL) != 0){
-        fprintf(stderr, "ERROR: Can not initialize the mutex\n");
-        cqueue_free(tp->qinput);
-        free(quit_data);
-        return 1;
-    }
-
     // how many TCP threads we want to run?
     int num_tcp_threads = 0;
 
@@ -170,6 +263,7 @@ int main(int argc, char ** argv){
     int actual_num_threads = 0;
     pthread_t * actual_threads_array = NULL;
     int * sock_array = NULL;
+    scan_stateless_ctx * stateless = NULL;
 
     // here is the case we want to use Lua. We launch normal threads
     if (si->lua_file != NULL){
@@ -178,14 +272,15 @@ int main(int argc, char ** argv){
         actual_num_threads = si->concurrency;
         pthread_t * threads = (pthread_t*) malloc(si->concurrency * sizeof(pthread_t));      //TODO: fix this number
         actual_threads_array = threads;
+        if (scan_input_shard(tp, si->concurrency) != 0)
+            return 1;
 #endif
 
         for (int i=0; i< si->concurrency; ++i){
 #ifdef COMPILE_WITH_LUA
             if (pthread_create(&threads[i], NULL, scan_lua_worker_routine, (void*) tp) != 0){
                 fprintf(stderr, "ERROR: Can not create thread#%d\n", i);
-                free(quit_data);
-                cqueue_free(tp->qinput);
+                mpmc_queue_free(tp->qinput);
                 return 2;
             }
 #else
@@ -197,21 +292,33 @@ int main(int argc, char ** argv){
         }
 
     }else{
-        // we don't have Lua option. We need to launch our concurrent model with select
-
-        // let's say the number of concurrent open ports is '--concurrency'
-        // each thread can handle 50 ports (max_select variable).
-        // Therefore, we need 'floor(concurrency / max_select) + (1 if concurrency % max_select > 0 else 0)'
+        // we don't have Lua option. We launch one scan engine per thread.
+        // Each engine runs its own epoll loop over a subset of the sockets.
+
+        // '--concurrency' is the number of in-flight requests. Each socket
+        // carries '--batch' of them, so we open 'ceil(concurrency / batch)'
+        // sockets (with the default batch of one, one port per request).
+        // With '--sockets=N', we open N sockets and each one carries
+        // 'ceil(concurrency / N)' requests (told apart by their DNS ID).
+        // '--stateless' keeps nothing per request, so '--concurrency' has no
+        // meaning there: we open '--sockets' sockets (default: one per thread).
+        // The number of engines is '--threads' (default: number of cores).
+        // We spread the sockets evenly: each engine gets 'sockets / threads'
+        // sockets and the first 'sockets % threads' engines get one more.
         
-        int concurrency = si->concurrency;
-        int max_select = BULKDNS_MAX_SOCKET_FOR_POLL;
+        unsigned int depth = si->batch;
+        int concurrency = (si->concurrency + si->batch - 1) / si->batch;
+        if (si->stateless){
+            concurrency = si->sockets > 0?si->sockets:si->threads;
+        }else if (si->sockets > 0){
+            concurrency = si->sockets < si->concurrency?si->sockets:si->concurrency;
+            depth = (si->concurrency + concurrency - 1) / concurrency;
+        }
+        int num_threads = si->threads > concurrency?concurrency:si->threads;
         
-        int int_part = concurrency / max_select;
-        int remainder = concurrency % max_select;
-        int num_threads = int_part + (remainder > 0?1:0);
+        int int_part = concurrency / num_threads;
+        int remainder = concurrency % num_threads;
 
-        // --concurrency param is the same as number of open ports.
-        // so we need to open 'concurrency' sockes.
         sock_array = (int *) bulkdns_malloc_or_abort(concurrency * sizeof(int));
         for (int i=0; i< concurrency; ++i){
             sock_array[i] = init_udp_socket(si);
@@ -229,20 +336,38 @@ int main(int argc, char ** argv){
         pthread_t * threads = (pthread_t*) malloc((num_threads) * sizeof(pthread_t));
         actual_threads_array = threads;
         
+        if (si->stateless)
+            stateless = bulkdns_malloc_or_abort(num_threads * sizeof(scan_stateless_ctx));
+        if (scan_input_shard(tp, num_threads) != 0)
+            return 1;
+        int sock_offset = 0;
         for (int i=0; i< num_threads; ++i){
+            if (si->stateless){
+                // one sender and one receiver per share of the sockets
+                int num_sock = int_part + (i < remainder?1:0);
+                scan_stateless_init(&(stateless[i]), tp, i, sock_array + sock_offset, num_sock);
+                sock_offset += num_sock;
+                if (pthread_create(&threads[i], NULL, scan_stateless_sender, (void*) &(stateless[i])) != 0 ||
+                    pthread_create(&(stateless[i].receiver), NULL, scan_stateless_receiver, (void*) &(stateless[i])) != 0){
+                    fprintf(stderr, "ERROR: Can not create thread#%d\n", i);
+                    mpmc_queue_free(tp->qinput);
+                    mpmc_queue_free(tp->queue_tcp);
+                    return 2;
+                }
+                continue;
+            }
             scan_mode_receiver_param * tmp_tp = bulkdns_malloc_or_abort(sizeof(scan_mode_receiver_param));
             tmp_tp->tp = tp;
-            if (remainder > 0)
-                tmp_tp->num_sock = i == num_threads -1?remainder:max_select;
-            else
-                tmp_tp->num_sock = max_select;
-            tmp_tp->sock_list = sock_array + (i * max_select);
+            tmp_tp->thread_id = i;
+            tmp_tp->num_sock = int_part + (i < remainder?1:0);
+            tmp_tp->depth = depth;
+            tmp_tp->sock_list = sock_array + sock_offset;
+            sock_offset += tmp_tp->num_sock;
             // this is a normal bulkDNS scan option
             if (pthread_create(&threads[i], NULL, scan_receiver_routine, (void*) tmp_tp) != 0){
                 fprintf(stderr, "ERROR: Can not create thread#%d\n", i);
-                free(quit_data);
-                cqueue_free(tp->qinput);
-                cqueue_free(tp->queue_tcp);
+                mpmc_queue_free(tp->qinput);
+                mpmc_queue_free(tp->queue_tcp);
                 return 2;
             }
         }
@@ -254,110 +379,125 @@ int main(int argc, char ** argv){
         for (int i=0; i< num_tcp_threads; ++i){
             if (pthread_create(&(tcp_threads[i]), NULL, tcp_routine_handler, (void*) tp) != 0){
                 fprintf(stderr, "ERROR: Can not create TCP thread#%d\n", i);
-                free(quit_data);
-                cqueue_free(tp->qinput);
-                cqueue_free(tp->queue_tcp);
+                mpmc_queue_free(tp->qinput);
+                mpmc_queue_free(tp->queue_tcp);
                 return 2;
             }
         }
     }
     
     
-    int res_q = 0;
-    // we start adding input lines to the queue. If we reach
-    // the max size of the queue, we sleep for 5 seconds and continue.
-    while ((line = readline(si->INPUT)) != NULL){
-        str = str_init(line);
-        free(line);
-        line_stripped = str->str_strip(str, NULL);
-        str_free(str);
-        if (line_stripped == NULL)
-            continue;
-        if(strlen(line_stripped) == 0){
-            free(line_stripped);
-            continue;
-        }
-        do{
-            pthread_mutex_lock(&(tp->lock));
-            res_q = cqueue_put(tp->qinput, (void*) line_stripped);
-            pthread_mutex_unlock(&(tp->lock));
-            if (res_q == 1){    // this means queue is full
-                sleep(5);
-                continue;
+    // the reader gives the names without the spaces around them and skips
+    // the blank lines: we copy each name to the arena and push them in
+    // batches. If the queue is full, we sleep until the scan threads take some.
+    // With '--shard-input', the scan threads read the input themselves.
+    if (tp->shards == NULL){
+        inreader_ctx * input = inreader_open(fileno(si->INPUT));
+        if (input == NULL)
+            return 1;
+        void * batch[BULKDNS_INPUT_BATCH];
+        size_t batch_len = 0;
+        while (inreader_next(input, &name, &name_len) == 1){
+            line_stripped = namearena_copy(tp->names, name, name_len);
+            if (line_stripped == NULL)
+                continue;       // not a domain name
+            // only the names we would query are remembered
+            if (tp->dedup != NULL && dedup_seen(tp->dedup, line_stripped, name_len)){
+                namearena_release(line_stripped);
+                continue;       // we already queried it
             }
-            break;
-        }while(1);
+            batch[batch_len++] = line_stripped;
+            if (batch_len == BULKDNS_INPUT_BATCH){
+                mpmc_queue_push_batch(tp->qinput, batch, batch_len, MPMC_FOREVER);
+                batch_len = 0;
+            }
+        }
+        if (batch_len > 0)
+            mpmc_queue_push_batch(tp->qinput, batch, batch_len, MPMC_FOREVER);
+        inreader_free(input);
     }
 
+    // the shards keep their own mapping of the file
     fclose(si->INPUT);
 
-    // we want to add the quit_message to queue. One for each thread.
-    // However, we need to make sure our queue has enough space. So we
-    // loop and sleep until we have enough space. This is a very poor code
-    // and must be changed.
-    do{
-        pthread_mutex_lock(&(tp->lock));
-        int qs = cqueue_size(tp->qinput);
-        if (BULKDNS_MAX_QUEUE_SIZE - qs < actual_num_threads){
-            pthread_mutex_unlock(&(tp->lock));
-            sleep(3);
-            continue;
-        }
-        pthread_mutex_unlock(&(tp->lock));
-        break;
-    }while(1);
-
-    // add one quit message for each thread
-    for (int i=0; i<actual_num_threads; ++i){   // in fact, we need to only send it to sender threads
-                                                // but now we are sending it to all threads.
-        pthread_mutex_lock(&(tp->lock));
-        if (cqueue_put(tp->qinput, (void*)quit_data) != 0){
-            // it's almost impossible to fail here but still need more considerations
-            // What we should do? :-D
-        }
-        pthread_mutex_unlock(&(tp->lock));
-    }
+    // the scan threads stop once they took everything
+    mpmc_queue_close(tp->qinput);
 
-    // join the threads and destroy the lock since we are done
+    // join the threads since we are done
     for (int i=0; i<actual_num_threads; ++i){
         pthread_join(actual_threads_array[i], NULL);
     }
     
+    // the '--stateless' receivers stop '--timeout' seconds after their sender
+    if (stateless != NULL){
+        for (int i=0; i<actual_num_threads; ++i){
+            pthread_join(stateless[i].receiver, NULL);
+            scan_stateless_free(&(stateless[i]));
+        }
+        free(stateless);
+    }
+
+    // nothing goes to the TCP threads anymore: they stop once they are done
+    mpmc_queue_close(tp->queue_tcp);
+
     // let's join TCP threads
     // fprintf(stderr, "Let's join TCP threads....\n");
     for (int i=0; i<num_tcp_threads; ++i){
         pthread_join(tcp_threads[i], NULL);
     }
 
-    pthread_mutex_destroy(&(tp->lock));
+    // all the records are in the output buffers now
+    if (tp->output != NULL)
+        outwriter_close(tp->output);
+    if (si->split != NULL)
+        outsplit_close(si->split);
+    if (tp->pcap != NULL)
+        outwriter_close(tp->pcap);
+    if (tp->dnstap_output != NULL)
+        outwriter_close(tp->dnstap_output);
+
+    if (tp->dedup != NULL)
+        fprintf(stderr, "dedup: %lu duplicate names were not queried (%s of %zu KB)\n", tp->dedup->duplicates,
+                si->dedup_bloom_mb > 0?"Bloom filter":"hash set", dedup_memory(tp->dedup) / 1024);
+    if (si->stats)
+        scan_print_stats(tp);
+    outwriter_free(tp->output);
+    outwriter_free(tp->pcap);
+    outwriter_free(tp->dnstap_output);
+    dnstap_close(tp->dnstap);
+
+    ratelimit_free(tp->rate_limit);
+    resolver_pool_free(tp->resolvers);
 
     // free the remaining memory parts
     free(actual_threads_array);
     free(tcp_threads);
     
 
-    // we allocated heap memory for 'quit_data'
-    free(quit_data);
-
-    void * dummy;
-
-    // we need to empty the queue before freeing its memory
-    while((dummy = cqueue_get(tp->qinput)) != NULL);
-    cqueue_free(tp->qinput);
-
-    while((dummy = cqueue_get(tp->queue_tcp)) != NULL);
-    cqueue_free(tp->queue_tcp);
-
-    // we used strdup() for 'resolver', 'bind_ip' and 'lua_file'
+    // both queues are empty now and every name was released
+    mpmc_queue_free(tp->qinput);
+    mpmc_queue_free(tp->queue_tcp);
+    namearena_free(tp->names);
+    for (unsigned int i=0; tp->shards != NULL && i<tp->shards->count; ++i)
+        namearena_free(tp->shard_names[i]);
+    free(tp->shard_names);
+    inshard_free(tp->shards);
+    dedup_free(tp->dedup);
+
+    // we used strdup() for 'resolver', 'bind_ip', 'lua_file' and 'dnstap_dest'
     free(si->resolver);
     free(si->bind_ip);
     free(si->lua_file);
+    free(si->dnstap_dest);
 
     // close it if it's not standard input/output/error
     if (si->ERROR != stderr)
         fclose(si->ERROR);
-    if (si->OUTPUT != stdout)
+    if (si->OUTPUT != stdout && si->OUTPUT != NULL)
         fclose(si->OUTPUT);
+    outsplit_free(si->split);
+    if (si->PCAP != NULL)
+        fclose(si->PCAP);
 
     // These were also allocated by heap.
     free(sock_array);
@@ -376,312 +516,1311 @@ void * tcp_routine_handler(void * ptr){
     // handle TCP connections
     struct thread_param * tp = (struct thread_param *)ptr;
     char * mem = bulkdns_malloc_or_abort(65535);
+    char query[BULKDNS_MAX_QUERY_SIZE];
+    uint64_t rng = bulkdns_now_ns() ^ (uint64_t)(uintptr_t)query;   // for the DNS IDs
     void * item = NULL;
 
     while (1){
-        pthread_mutex_lock(&(tp->lock));
-        item = cqueue_get(tp->queue_tcp);
-        pthread_mutex_unlock(&(tp->lock));
+        // we sleep until an answer comes (or the queue is closed), and
+        // wake up from time to time to hand off our output buffer
+        item = mpmc_queue_pop(tp->queue_tcp, BULKDNS_INPUT_POLL_MS);
         if (item == NULL){
-            // sleep 1 sec and continue    
-            sleep(1);
+            if (mpmc_queue_drained(tp->queue_tcp))
+                break;
+            scan_output_tick(tp);
             continue;
-            //fprintf(si->ERROR, "ERROR: %s\n", qinput->errmsg);
-        }
-        
-        if (item == NULL){
-            // something is wrong. we should never be here.
-            fprintf(tp->si->ERROR, "We should never have NULL item in the queue!!!!!\n");
-            // just quit the thread
-            return NULL;
-        }
-        if (strcmp((char*) item, tp->quit_data) == 0){
-            //fprintf(stderr, "We have received a quit message in thread#%ld\n", pthread_self());
-            // or break and close them after while-loop
-            break;
         }
         // do the TCP lookup and print out the output
-        // item is a domain name
-        char * domain_name = (char*)item;
-        sdns_context * dns = sdns_init_context();
-        if (NULL == dns)
-            continue;
-        int res = sdns_make_query(dns, tp->si->rr_type, tp->si->rr_class, domain_name, ~(tp->si->no_edns));
-        if (res != 0){
+        // item is a domain name and the number of UDP attempts
+        scan_mode_tcp_item * tcp_item = (scan_mode_tcp_item*)item;
+        char * domain_name = tcp_item->name;
+        unsigned int attempts = tcp_item->attempts + 1;
+        unsigned int resolver = tcp_item->resolver;
+        free(tcp_item);
+        size_t query_len = qtemplate_build(&(tp->query), domain_name, (uint16_t)(bulkdns_rand64(&rng) >> 48),
+                                           query, BULKDNS_MAX_QUERY_SIZE);
+        free(domain_name);
+        if (query_len == 0){
             fprintf(stderr, "Can not make a query packet for TCP....\n");
-            sdns_free_context(dns);
-            continue;
-        }
-        if (tp->si->set_do && (!(tp->si->no_edns)))
-            dns->msg->additional->opt_ttl.DO = 1;
-        if (tp->si->set_nsid && (!(tp->si->no_edns))){
-            sdns_opt_rdata * nsid = sdns_create_edns0_nsid(NULL, 0);
-            if (nsid != NULL){
-                res = sdns_add_edns(dns, nsid);
-                if (res != 0){
-                    sdns_free_context(dns);
-                    sdns_free_opt_rdata(nsid);
-                    continue;
-                }
-            }
-        }
-        res = sdns_to_wire(dns);
-        if (res != 0){
-            fprintf(stderr, "Can not make a to_wire packet for TCP....\n");
-            sdns_free_context(dns);
             continue;
         }
         size_t to_receive = 0;
-        res = perform_lookup_tcp(dns->raw, dns->raw_len, &mem, &to_receive, tp->si);
-        sdns_free_context(dns);
+        uint64_t sent_at = bulkdns_now_ns() / 1000;     // the RTT includes the connection
+        uint64_t sent_time = bulkdns_unix_us();
+        struct sockaddr_in local;
+        int res = perform_lookup_tcp(query, query_len, &mem, &to_receive,
+                                     &(tp->resolvers->list[resolver].addr), tp->si, &local);
         if (res != 0){
             // TODO:we have timeout or any other types of error. we need to send it to output
             continue;
         }
-        sdns_context * dns_tcp_response = sdns_init_context();
-        if (NULL == dns_tcp_response){
-            continue;
+        if (tp->capture){
+            scan_capture(tp, PCAPFILE_TCP, 1, &local, &(tp->resolvers->list[resolver].addr), query, query_len, sent_time);
+            scan_capture(tp, PCAPFILE_TCP, 0, &(tp->resolvers->list[resolver].addr), &local, mem, to_receive,
+                         bulkdns_unix_us());
         }
-        dns_tcp_response->raw = mem;
-        dns_tcp_response->raw_len = to_receive;
-        res = sdns_from_wire(dns_tcp_response);
-        if (res != 0){
-            dns_tcp_response->raw = NULL;
-            sdns_free_context(dns_tcp_response);
+        dnswire_msg wire;
+        if (dnswire_parse(mem, to_receive, &wire) != 0)
             continue;
-        }
-        char * dmp = sdns_json_dns_string(dns_tcp_response);
-        fprintf(tp->si->OUTPUT, "%s\n", dmp);
-        free(dmp);
-        dns_tcp_response->raw = NULL;
-        sdns_free_context(dns_tcp_response);
-        continue;
+        dnswire_meta meta;
+        scan_answer_meta(&meta, attempts, &(tp->resolvers->list[resolver].addr), sent_at);
+        scan_write_answer(tp, mem, to_receive, &wire, &meta);
     }
     free(mem);
+    scan_output_release(tp);
+    return NULL;
+}
+
+
+// the names this thread took from the input queue and didn't use yet: we
+// take them in batches, so the threads meet on the queue less often
+static __thread void * scan_input_items[BULKDNS_INPUT_BATCH];
+static __thread size_t scan_input_count = 0;
+static __thread size_t scan_input_next = 0;
+
+// '--shard-input': the part of the input file this thread reads
+static __thread inshard_cursor scan_input_cursor;
+static __thread int scan_input_joined = 0;     // 1: we have a shard, -1: there was none left
+
+// split the input file between the 'count' scan threads. If it's not a
+// file (a pipe, stdin), the main thread reads it as usual. returns 0 on success
+int scan_input_shard(struct thread_param * tp, unsigned int count){
+    if (!tp->si->shard_input)
+        return 0;
+    tp->shards = inshard_open(fileno(tp->si->INPUT), count);
+    if (tp->shards == NULL){
+        fprintf(stderr, "WARNING: '--shard-input' needs a regular file: the input is read by one thread\n");
+        return 0;
+    }
+    tp->shard_names = (namearena_ctx**) calloc(count, sizeof(namearena_ctx*));
+    if (tp->shard_names == NULL)
+        return 1;
+    for (unsigned int i=0; i<count; ++i){
+        tp->shard_names[i] = namearena_init();
+        if (tp->shard_names[i] == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+// the next name of our shard: it never waits, there is nothing to wait for
+static void * scan_input_take_shard(struct thread_param * tp, int * quit){
+    if (scan_input_joined == 0)
+        scan_input_joined = inshard_join(tp->shards, &scan_input_cursor) == 0?1:-1;
+    const char * name;
+    size_t name_len;
+    while (scan_input_joined == 1 && inshard_next(tp->shards, &scan_input_cursor, &name, &name_len) == 1){
+        char * item = namearena_copy(tp->shard_names[scan_input_cursor.id], name, name_len);
+        if (item == NULL)
+            continue;
+        if (tp->dedup != NULL && dedup_seen(tp->dedup, item, name_len)){
+            namearena_release(item);
+            continue;
+        }
+        return item;
+    }
+    *quit = 1;
     return NULL;
 }
 
+static void * scan_input_take(struct thread_param * tp, int timeout_ms, int * quit){
+    if (tp->shards != NULL)
+        return scan_input_take_shard(tp, quit);
+    if (scan_input_next == scan_input_count){
+        scan_input_next = 0;
+        scan_input_count = mpmc_queue_pop_batch(tp->qinput, scan_input_items, BULKDNS_INPUT_BATCH, timeout_ms);
+        if (scan_input_count == 0){
+            if (mpmc_queue_drained(tp->qinput))
+                *quit = 1;
+            return NULL;
+        }
+    }
+    return scan_input_items[scan_input_next++];
+}
 
 void * read_item_from_queue(struct thread_param * tp){
     // Safe routine to read from input-queue and return the item.
-    // if the queue is empty, wait until there is an entry.
-    // if we receive quit_message in queue, we return NULL
+    // if the queue is empty, we sleep until there is an entry.
+    // returns NULL once the whole input was taken
     void * item = NULL;
-    while (1){
-        pthread_mutex_lock(&(tp->lock));
-        item = cqueue_get(tp->qinput);
-        pthread_mutex_unlock(&(tp->lock));
-        if (item == NULL){
-            // sleep 1 sec and continue
-            sleep(1);
+    int quit = 0;
+    while (item == NULL && quit == 0)
+        item = scan_input_take(tp, MPMC_FOREVER, &quit);
+    return item;
+}
+
+void * try_read_item_from_queue(struct thread_param * tp, int * quit){
+    // Same as read_item_from_queue() but never waits.
+    // returns NULL if the queue is empty and sets 'quit' to 1
+    // once the whole input was taken.
+    return scan_input_take(tp, 0, quit);
+}
+
+void scan_flush_socket(scan_mode_engine * eng, scan_mode_socket * sms){
+    // send the queries that are waiting in the batch of one socket
+    if (sms->batch->count == 0)
+        return;
+    unsigned long int calls = sms->batch->calls;
+    if (eng->tp->capture)
+        scan_capture_queries(eng->tp, sms);
+    eng->stats.queries_sent += udpbatch_send(sms->batch, sms->sockfd);
+    eng->stats.send_calls += sms->batch->calls - calls;
+}
+
+void scan_flush_sockets(scan_mode_engine * eng){
+    // send all the queries that are waiting in the batch of the sockets
+    for (int i=0; i < eng->num_dirty; ++i){
+        scan_mode_socket * sms = eng->dirty[i];
+        sms->dirty = 0;
+        scan_flush_socket(eng, sms);
+    }
+    eng->num_dirty = 0;
+}
+
+int scan_engine_send(scan_mode_engine * eng, void * item, unsigned int resolver, int probe){
+    // takes a free in-flight entry for 'item', encodes the query with a DNS ID
+    // which is unique on its socket and queues it in the batch of the socket
+    // for 'resolver' ('probe' is set if it's the probe of an ejected resolver).
+    // returns 0 on success, 1 if there is no free entry (item is untouched)
+    // and 2 if we can not make the query (item is freed).
+    if (eng->num_free == 0)
+        return 1;
+    unsigned int idx = eng->free_queries[eng->num_free - 1];
+    scan_mode_worker_item * smwi = &(eng->queries[idx]);
+    smwi->item = item;
+    if (dns_routine_scan(smwi, eng->tp, smwi->query) != 0){
+        namearena_release(item);
+        smwi->item = NULL;
+        return 2;
+    }
+    // pick a random DNS ID which is not in use on this socket
+    uint16_t id;
+    do{
+        id = (uint16_t)(bulkdns_rand64(&(eng->rng)) >> 48);
+    }while (inflight_put(eng->inflight, INFLIGHT_KEY(smwi->sock->index, id), idx) != 0);
+    smwi->id = id;
+    smwi->query[0] = (char)(id >> 8);
+    smwi->query[1] = (char)(id & 0xFF);
+    smwi->attempts = 0;
+    smwi->resolver = resolver;
+    smwi->probe = probe;
+    eng->load[resolver].outstanding += 1;
+    eng->num_free -= 1;
+    eng->started += 1;
+    scan_engine_resend(eng, smwi);
+    return 0;
+}
+
+void scan_engine_resend(scan_mode_engine * eng, scan_mode_worker_item * smwi){
+    // queue the query in the batch of its socket and start its deadline.
+    // Retries keep the same DNS ID so a late answer of an earlier
+    // attempt is still accepted (if it's from the same resolver).
+    smwi->state = BULKDNS_QUERY_SENT;
+    smwi->attempts += 1;
+    smwi->sent_at = bulkdns_now_ns() / 1000;
+    uint64_t now = bulkdns_now_ms();
+    twheel_add(eng->timers, &(smwi->timer), now + (eng->tp->si->timeout * 1000));
+    if (eng->hedge_after > 0 && smwi->hedge == 0 && smwi->twin == NULL)
+        twheel_add(eng->timers, &(smwi->hedge_timer), now + eng->hedge_after);
+    scan_mode_socket * sms = smwi->sock;
+    struct sockaddr_in * server = &(eng->tp->resolvers->list[smwi->resolver].addr);
+    if (udpbatch_add(sms->batch, smwi->query, smwi->query_len, server) != 0){
+        // with '--sockets', a socket carries more queries than its batch
+        // holds. The batch is full, send it now.
+        scan_flush_socket(eng, sms);
+        udpbatch_add(sms->batch, smwi->query, smwi->query_len, server);
+    }
+    eng->load[smwi->resolver].sent += 1;
+    if (sms->dirty == 0){
+        sms->dirty = 1;
+        eng->dirty[eng->num_dirty++] = sms;
+    }
+}
+
+int scan_engine_hedge(scan_mode_engine * eng, scan_mode_worker_item * smwi){
+    // the query has no answer after the '--hedge' percentile of the RTT.
+    // Send a duplicate to another resolver (with its own socket and DNS ID)
+    // if we have a free entry and the budget allows it. The first answer
+    // of the two wins. returns 0 if we sent the duplicate.
+    struct scanner_input * si = eng->tp->si;
+    if (smwi->state != BULKDNS_QUERY_SENT || smwi->twin != NULL || eng->num_free == 0)
+        return 1;
+    if ((eng->stats.hedges + 1) * 100 > (unsigned long int)si->hedge_budget * eng->started)
+        return 1;
+    // a duplicate to the same server is only more traffic: no hedge with a
+    // single resolver (or when all the others are ejected)
+    unsigned int resolver = resolver_pick_other(eng->tp->resolvers, eng->load, smwi->resolver);
+    if (resolver == smwi->resolver)
+        return 1;
+    uint64_t wait_ms = 0;
+    if (scan_engine_pace(eng, resolver, &wait_ms) != 0)
+        return 1;
+    unsigned int idx = eng->free_queries[eng->num_free - 1];
+    scan_mode_worker_item * dup = &(eng->queries[idx]);
+    memcpy(dup->query, smwi->query, smwi->query_len);
+    dup->query_len = smwi->query_len;
+    uint16_t id;
+    do{
+        id = (uint16_t)(bulkdns_rand64(&(eng->rng)) >> 48);
+    }while (inflight_put(eng->inflight, INFLIGHT_KEY(dup->sock->index, id), idx) != 0);
+    dup->id = id;
+    dup->query[0] = (char)(id >> 8);
+    dup->query[1] = (char)(id & 0xFF);
+    dup->item = smwi->item;
+    dup->hedge = 1;
+    dup->twin = smwi;
+    smwi->twin = dup;
+    dup->attempts = 0;
+    dup->resolver = resolver;
+    dup->probe = 0;
+    eng->load[resolver].outstanding += 1;
+    eng->num_free -= 1;
+    eng->stats.hedges += 1;
+    scan_engine_resend(eng, dup);
+    return 0;
+}
+
+void scan_engine_rtt(scan_mode_engine * eng, uint64_t rtt){
+    // keep the RTT of an answer. With '--hedge', we update the delay of
+    // the duplicates from time to time.
+    rtthist_add(&(eng->rtt), rtt);
+    double percentile = eng->tp->si->hedge;
+    if (percentile > 0 && eng->rtt.count >= BULKDNS_HEDGE_MIN_SAMPLES &&
+        (eng->hedge_after == 0 || eng->rtt.count % BULKDNS_HEDGE_UPDATE == 0)){
+        eng->hedge_after = (rtthist_percentile(&(eng->rtt), percentile) + 999) / 1000;
+        if (eng->hedge_after == 0)
+            eng->hedge_after = 1;
+    }
+}
+
+int scan_engine_can_send(scan_mode_engine * eng){
+    // returns 1 if we have a free entry for a new query and, in adaptive
+    // mode, the queries in flight are below the window. With '--hedge',
+    // the budget of the duplicates is kept free for them.
+    if (eng->num_free <= eng->hedge_reserve)
+        return 0;
+    if (eng->adaptive && eng->num_queries - eng->num_free >= eng->aimd.window)
+        return 0;
+    return 1;
+}
+
+void scan_engine_adapt(scan_mode_engine * eng, int changed, unsigned int old_window){
+    // log the change of the adaptive window
+    if (changed == 0)
+        return;
+    aimd_ctx * aimd = &(eng->aimd);
+    eng->stats.window_changes += 1;
+    fprintf(stderr, "adaptive: engine %d window %u -> %u (loss %.2f%%, rtt %.2fms, base rtt %.2fms)\n",
+            eng->id, old_window, aimd->window, aimd->last_loss * 100,
+            aimd->last_rtt / 1000.0, aimd->base_rtt / 1000.0);
+}
+
+int scan_engine_pace(scan_mode_engine * eng, unsigned int resolver, uint64_t * wait_ms){
+    // take one token from the limiter of 'resolver' and the global one.
+    // returns 0 if we can send a query now. Otherwise returns 1 and sets
+    // 'wait_ms' to how long we should wait before trying again.
+    struct thread_param * tp = eng->tp;
+    ratelimit_ctx * resolver_rate = tp->resolvers->list[resolver].rate;
+    if (tp->rate_limit == NULL && resolver_rate == NULL)
+        return 0;
+    uint64_t now = bulkdns_now_ns();
+    uint64_t wait = 0;
+    if (resolver_rate != NULL && ratelimit_take(resolver_rate, now, &wait) != 0)
+        goto paced;
+    if (tp->rate_limit != NULL && ratelimit_take(tp->rate_limit, now, &wait) != 0){
+        if (resolver_rate != NULL)
+            ratelimit_refund(resolver_rate);
+        goto paced;
+    }
+    return 0;
+paced:
+    eng->stats.paced += 1;
+    *wait_ms = (wait + 999999) / 1000000;
+    if (*wait_ms == 0)
+        *wait_ms = 1;
+    return 1;
+}
+
+int scan_engine_retry(scan_mode_engine * eng, scan_mode_worker_item * smwi){
+    // schedule the query to be sent again after an exponential backoff
+    // with jitter: the delay is picked in [backoff/2, backoff] where backoff
+    // is '--retry-backoff' doubled for each attempt (capped).
+    // returns 0 if we retry and 1 if the query ran out of attempts.
+    struct scanner_input * si = eng->tp->si;
+    if (smwi->attempts > si->retries)
+        return 1;
+    uint64_t backoff = si->retry_backoff;
+    for (unsigned int i=1; i<smwi->attempts && backoff < BULKDNS_MAX_RETRY_BACKOFF_MS; ++i)
+        backoff <<= 1;
+    if (backoff > BULKDNS_MAX_RETRY_BACKOFF_MS)
+        backoff = BULKDNS_MAX_RETRY_BACKOFF_MS;
+    uint64_t delay = backoff / 2 + bulkdns_rand64(&(eng->rng)) % (backoff / 2 + 1);
+    smwi->state = BULKDNS_QUERY_BACKOFF;
+    twheel_add(eng->timers, &(smwi->timer), bulkdns_now_ms() + delay);
+    eng->stats.retries += 1;
+    return 0;
+}
+
+void scan_engine_release(scan_mode_engine * eng, scan_mode_worker_item * smwi){
+    // the query is done (answered or timed out). Free its entry and
+    // the entry of its duplicate if it has one.
+    if (smwi->twin != NULL){
+        scan_mode_worker_item * twin = smwi->twin;
+        twin->twin = NULL;
+        smwi->twin = NULL;
+        scan_engine_release(eng, twin);
+    }
+    inflight_del(eng->inflight, INFLIGHT_KEY(smwi->sock->index, smwi->id));
+    twheel_del(eng->timers, &(smwi->timer));
+    twheel_del(eng->timers, &(smwi->hedge_timer));
+    if (smwi->probe)
+        resolver_cancel_probe(eng->tp->resolvers, smwi->resolver);
+    smwi->probe = 0;
+    if (smwi->hedge == 0)
+        namearena_release(smwi->item);
+    smwi->item = NULL;
+    smwi->hedge = 0;
+    eng->load[smwi->resolver].outstanding -= 1;
+    eng->free_queries[eng->num_free++] = smwi - eng->queries;
+}
+
+void scan_engine_expire(scan_mode_engine * eng){
+    // handle the queries which passed their deadline: retry them or
+    // report and release them. Queries at the end of their backoff are sent again.
+    // We take the timers one at a time: releasing a query deletes the timers
+    // of its entry and of its duplicate, even if they expired with this one.
+    uint64_t now = bulkdns_now_ms();
+    twheel_timer * expired;
+    while ((expired = twheel_advance(eng->timers, now)) != NULL){
+        scan_mode_worker_item * smwi = (scan_mode_worker_item*)expired->data;
+        if (expired == &(smwi->hedge_timer)){
+            scan_engine_hedge(eng, smwi);
             continue;
-            //fprintf(si->ERROR, "ERROR: %s\n", qinput->errmsg);
         }
-        
-        if (item == NULL){
-            // something is wrong. we should never be here.
-            fprintf(tp->si->ERROR, "We should never have NULL item in the queue!!!!!\n");
-            // just quit the thread
-            return NULL;
+        if (smwi->hedge){
+            // the duplicate has no answer either. The original query
+            // has its own deadline, just drop the duplicate.
+            smwi->twin->twin = NULL;
+            smwi->twin = NULL;
+            scan_engine_release(eng, smwi);
+            continue;
         }
-        if (strcmp((char*) item, tp->quit_data) == 0){
-            //fprintf(stderr, "We have received a quit message in thread#%ld\n", pthread_self());
-            // or break and close them after while-loop
-            return NULL;
+        if (smwi->state == BULKDNS_QUERY_BACKOFF){
+            // end of the backoff, send it again (when the rate limiter lets us).
+            // With several resolvers, the retry goes to the next one in turn.
+            resolver_pool * pool = eng->tp->resolvers;
+            if (pool->count > 1 && !smwi->probe){
+                int probe = 0;
+                unsigned int resolver = resolver_pick(pool, eng->load, bulkdns_now_ms(), &probe);
+                eng->load[smwi->resolver].outstanding -= 1;
+                eng->load[resolver].outstanding += 1;
+                smwi->resolver = resolver;
+                smwi->probe = probe;
+            }
+            uint64_t wait_ms = 0;
+            if (scan_engine_pace(eng, smwi->resolver, &wait_ms) != 0){
+                twheel_add(eng->timers, &(smwi->timer), bulkdns_now_ms() + wait_ms);
+                continue;
+            }
+            scan_engine_resend(eng, smwi);
+            continue;
         }
-        return item;
+        if (eng->adaptive){
+            unsigned int old_window = eng->aimd.window;
+            scan_engine_adapt(eng, aimd_on_timeout(&(eng->aimd)), old_window);
+        }
+        resolver_report(eng->tp->resolvers, eng->load, smwi->resolver, RESOLVER_TIMEOUT, smwi->probe, bulkdns_now_ms());
+        smwi->probe = 0;
+        if (scan_engine_retry(eng, smwi) == 0)
+            continue;
+        if (eng->tp->si->retries > 0)
+            fprintf(eng->tp->si->ERROR, "timeout: %s (%u attempts)\n", (char*)smwi->item, smwi->attempts);
+        else
+            fprintf(eng->tp->si->ERROR, "timeout: %s\n", (char*)smwi->item);
+        eng->stats.timeouts += 1;
+        scan_engine_release(eng, smwi);
     }
 }
 
+void scan_merge_stats(struct thread_param * tp, scan_mode_stats * st){
+    // add the counters of one thread to the global ones
+    __atomic_fetch_add(&(tp->stats.queries_sent), st->queries_sent, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.send_calls), st->send_calls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.responses), st->responses, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.recv_calls), st->recv_calls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.timeouts), st->timeouts, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.unmatched), st->unmatched, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.retries), st->retries, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.paced), st->paced, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.window_changes), st->window_changes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.hedges), st->hedges, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(tp->stats.hedges_won), st->hedges_won, __ATOMIC_RELAXED);
+}
+
+void scan_print_stats(struct thread_param * tp){
+    // print the counters of the scan engines to stderr
+    scan_mode_stats * st = &(tp->stats);
+    fprintf(stderr, "queries sent: %lu, responses received: %lu\n", st->queries_sent, st->responses);
+    fprintf(stderr, "sendmmsg() calls: %lu, average batch fill: %.2f/%u\n", st->send_calls,
+            st->send_calls > 0?(double)st->queries_sent / st->send_calls:0.0, tp->si->batch);
+    fprintf(stderr, "recvmmsg() calls: %lu, average batch fill: %.2f/%u\n", st->recv_calls,
+            st->recv_calls > 0?(double)(st->responses + st->unmatched) / st->recv_calls:0.0, tp->si->batch);
+    fprintf(stderr, "timeouts: %lu, unmatched responses: %lu, retries: %lu\n", st->timeouts, st->unmatched, st->retries);
+    if (tp->si->stateless)
+        fprintf(stderr, "stateless: %lu queries without an answer\n",
+                st->queries_sent > st->responses?st->queries_sent - st->responses:0);
+    if (tp->rate_limit != NULL || tp->si->resolver_rate > 0)
+        fprintf(stderr, "waits for the rate limiter: %lu\n", st->paced);
+    resolver_pool * pool = tp->resolvers;
+    for (unsigned int i=0; pool->count > 1 && i<pool->count; ++i){
+        resolver_entry * r = &(pool->list[i]);
+        fprintf(stderr, "resolver %s (weight %u): sent: %lu, timeouts: %lu, refused: %lu, ejected: %lu times\n",
+                r->name, r->weight, r->sent, r->total_timeouts, r->total_refused, r->total_ejections);
+    }
+    if (tp->si->adaptive)
+        fprintf(stderr, "adaptive window changes: %lu\n", st->window_changes);
+    if (tp->rtt.count > 0)
+        fprintf(stderr, "rtt p50: %.2fms, p95: %.2fms, p99: %.2fms\n", rtthist_percentile(&(tp->rtt), 50) / 1000.0,
+                rtthist_percentile(&(tp->rtt), 95) / 1000.0, rtthist_percentile(&(tp->rtt), 99) / 1000.0);
+    if (tp->si->hedge > 0)
+        fprintf(stderr, "hedged queries: %lu, won by the duplicate: %lu\n", st->hedges, st->hedges_won);
+    unsigned long int slabs = tp->names->slabs;
+    for (unsigned int i=0; tp->shards != NULL && i<tp->shards->count; ++i)
+        slabs += tp->shard_names[i]->slabs;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        fprintf(stderr, "peak RSS: %ld KB, name slabs: %lu (%u KB each)\n", usage.ru_maxrss,
+                slabs, NAMEARENA_SLAB_SIZE / 1024);
+    if (tp->shards != NULL)
+        fprintf(stderr, "input shards: %u, ranges stolen: %lu\n", tp->shards->count, tp->shards->steals);
+    if (tp->output != NULL)
+        fprintf(stderr, "output: %lu bytes in %lu writev() calls, waits for a free buffer: %lu\n",
+                tp->output->bytes, tp->output->writes, tp->output->stalls);
+    if (tp->output != NULL && tp->si->compress != COMPRESS_NONE)
+        fprintf(stderr, "compression: %lu bytes before, ratio %.2f\n", tp->output->raw_bytes,
+                tp->output->bytes > 0?(double)tp->output->raw_bytes / tp->output->bytes:0.0);
+    if (tp->si->split != NULL)
+        fprintf(stderr, "output files: %lu\n", tp->si->split->parts);
+    if (tp->pcap != NULL)
+        fprintf(stderr, "pcap: %lu bytes in %lu writev() calls, waits for a free buffer: %lu\n",
+                tp->pcap->bytes, tp->pcap->writes, tp->pcap->stalls);
+    if (tp->dnstap_output != NULL)
+        fprintf(stderr, "dnstap: %lu bytes in %lu writev() calls, waits for a free buffer: %lu\n",
+                tp->dnstap_output->bytes, tp->dnstap_output->writes, tp->dnstap_output->stalls);
+}
+
 void * scan_receiver_routine(void * ptr){
     scan_mode_receiver_param * smrp = (scan_mode_receiver_param*) ptr;
     struct thread_param * tp = (struct thread_param*) smrp->tp;
     
     // fprintf(stderr, "receiver_thread\n");
-    // each thread handle around 50 sockets for receiving data from
-    // the resolver and sending data to resolver.
+    // each thread is one scan engine: it owns 'num_sock' sockets and runs
+    // one epoll loop over them for receiving data from the resolver and
+    // sending data to resolver.
+    // Each socket carries up to '--batch' queries. We queue the encoded
+    // queries in the batch of the socket and send them with one sendmmsg()
+    // when there is nothing more to send. Responses are drained with recvmmsg().
+    // Every query is in the in-flight table with its own deadline in the
+    // timer wheel. A response must match the socket, DNS ID, source address
+    // and question of the query, otherwise we drop it.
     // if the request needs TCP connection (truncated), we submit it to another
     // queue for TCP request. Otherwise, print out the result and continue
     
-    int nfds = smrp->num_sock;
-    struct pollfd * pfds;
-    pfds = calloc(nfds, sizeof(struct pollfd));
-    if (NULL == pfds){
-        fprintf(stderr, "Can not allocate memory for polling\n");
+    scan_mode_engine engine;
+    scan_mode_engine * eng = &engine;
+    memset(eng, 0, sizeof(scan_mode_engine));
+    eng->tp = tp;
+    eng->num_sock = smrp->num_sock;
+    unsigned int depth = smrp->depth;
+    // the send batch of a socket never holds more than its queries
+    unsigned int batch = tp->si->batch < depth?tp->si->batch:depth;
+    eng->epfd = epoll_create1(0);
+    if (eng->epfd == -1){
+        perror("Can not create epoll instance");
         exit(1);
     }
-    // fill the structures with socket
-    for (int i=0; i< nfds; ++i){
-        pfds[i].fd = smrp->sock_list[i];
-        pfds[i].events = POLLIN;
-        //pfds[i].events |= POLLOUT;
+    eng->socks = bulkdns_malloc_or_abort(eng->num_sock * sizeof(scan_mode_socket));
+    // register all the sockets of this engine. We keep the index of
+    // the socket in 'socks' as the epoll data.
+    for (int i=0; i< eng->num_sock; ++i){
+        eng->socks[i].sockfd = smrp->sock_list[i];
+        eng->socks[i].index = i;
+        eng->socks[i].dirty = 0;
+        eng->socks[i].batch = udpbatch_init(batch, 0);
+        if (eng->socks[i].batch == NULL)
+            abort();
+        struct sockaddr_in local;
+        socklen_t local_len = sizeof(local);
+        if (getsockname(eng->socks[i].sockfd, (struct sockaddr *)&local, &local_len) != 0){
+            perror("Can not get the port of the socket");
+            exit(1);
+        }
+        eng->socks[i].port = local.sin_port;
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+        if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, eng->socks[i].sockfd, &ev) != 0){
+            perror("Can not add socket to epoll");
+            exit(1);
+        }
+    }
+    int max_events = eng->num_sock < BULKDNS_MAX_EPOLL_EVENTS?eng->num_sock:BULKDNS_MAX_EPOLL_EVENTS;
+    struct epoll_event * events = bulkdns_malloc_or_abort(max_events * sizeof(struct epoll_event));
+    eng->recv_batch = udpbatch_init(batch, BULKDNS_MAX_UDP_RESPONSE);
+    if (eng->recv_batch == NULL)
+        abort();
+    eng->dirty = bulkdns_malloc_or_abort(eng->num_sock * sizeof(scan_mode_socket*));
+
+    // each socket carries 'depth' queries. We put 'batch' entries of one
+    // socket next to each other on the free stack (the first on the top) so
+    // that its batch is filled before we move to the next socket. With
+    // '--sockets', the groups go round the sockets to spread the load.
+    eng->num_queries = eng->num_sock * depth;
+    eng->queries = bulkdns_malloc_or_abort(eng->num_queries * sizeof(scan_mode_worker_item));
+    eng->free_queries = bulkdns_malloc_or_abort(eng->num_queries * sizeof(unsigned int));
+    eng->query_mem = bulkdns_malloc_or_abort(eng->num_queries * BULKDNS_MAX_QUERY_SIZE);
+    memset(eng->queries, 0, eng->num_queries * sizeof(scan_mode_worker_item));
+    for (unsigned int i=0; i<eng->num_queries; ++i){
+        scan_mode_worker_item * smwi = &(eng->queries[i]);
+        smwi->sock = &(eng->socks[(i / batch) % eng->num_sock]);
+        smwi->query = eng->query_mem + (i * BULKDNS_MAX_QUERY_SIZE);
+        smwi->timer.data = smwi;
+        smwi->hedge_timer.data = smwi;
+        eng->free_queries[eng->num_queries - 1 - i] = i;
+    }
+    eng->num_free = eng->num_queries;
+    eng->inflight = inflight_init(eng->num_queries);
+    eng->timers = twheel_init(bulkdns_now_ms());
+    eng->load = resolver_load_init(tp->resolvers);
+    if (eng->inflight == NULL || eng->timers == NULL || eng->load == NULL)
+        abort();
+    eng->rng = ((uint64_t)time(NULL) << 20) ^ ((uint64_t)(uintptr_t)eng) ^ (smrp->thread_id + 1);
+    eng->id = smrp->thread_id;
+    eng->adaptive = tp->si->adaptive;
+    // in adaptive mode '--concurrency' is the largest window. We start
+    // with a quarter of it and let the loss and the RTT move it.
+    aimd_init(&(eng->aimd), eng->num_queries / 4, 1, eng->num_queries);
+    rtthist_init(&(eng->rtt));
+    if (tp->si->hedge > 0){
+        eng->hedge_reserve = (eng->num_queries * tp->si->hedge_budget + 99) / 100;
+        if (eng->hedge_reserve >= eng->num_queries)
+            eng->hedge_reserve = eng->num_queries - 1;
     }
-    char * mem_send = bulkdns_malloc_or_abort(65535);
-    char * mem_recv = bulkdns_malloc_or_abort(65535);
-
 
-    struct sockaddr_in server;
-    server.sin_port = htons(tp->si->port);
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(tp->si->resolver);
-    scan_mode_worker_item smwi = {.item=NULL, .udp_sock=-1, .server=server};
     void * item = NULL;
-    int ready;      // result of poll() goes here
-
-    cqueue_ctx * ready_to_send = cqueue_init(nfds);
-    for (int i=0; i<nfds; ++i){
-        cqueue_put(ready_to_send, (void*)(&(smrp->sock_list[i])));
-    }
+    unsigned int item_resolver = 0;     // the resolver we picked for 'item'
+    int item_probe = -1;                // -1: we didn't pick a resolver for 'item' yet
+    int ready;      // result of epoll_wait() goes here
     int quit = 0;
     while (1){
+        scan_engine_expire(eng);
         if (item == NULL && quit == 0){
-            item = read_item_from_queue(tp);
-            if (item == NULL)
-                quit = 1;
-        }
-
-        if (item != NULL){
-            void * sock_to_send = (cqueue_get(ready_to_send));
-            if (sock_to_send != NULL){
-                // we have a socket to send data to
-                int sock = *((int *)sock_to_send);
-                smwi.item = item;
-                smwi.udp_sock = sock;
-                dns_routine_scan(&smwi, tp->si, mem_send);
-                //fprintf(stderr, "Sending %s to %d\n", (char*)item, sock);
-                free(item);
+            item = try_read_item_from_queue(tp, &quit);
+            if (item == NULL && quit == 0 && eng->num_free == eng->num_queries){
+                // nothing in flight, we can wait for the input
+                scan_output_release(tp);
+                item = read_item_from_queue(tp);
+                if (item == NULL)
+                    quit = 1;
+            }
+        }
+
+        uint64_t pace_ms = TWHEEL_NO_TIMER;
+        if (item != NULL && scan_engine_can_send(eng)){
+            // pick the resolver once per item. The rate limiter of the resolver
+            // and the global one spread the queries over time.
+            if (item_probe == -1)
+                item_resolver = resolver_pick(tp->resolvers, eng->load, bulkdns_now_ms(), &item_probe);
+            if (scan_engine_pace(eng, item_resolver, &pace_ms) == 0){
+                scan_engine_send(eng, item, item_resolver, item_probe);
+                //fprintf(stderr, "Sending %s\n", (char*)item);
                 item = NULL;
+                item_probe = -1;
                 continue;
             }
         }
-        ready = poll(pfds, nfds, tp->si->timeout * 1000);
+        // nothing more to send for now. Let's flush the batches before waiting.
+        scan_flush_sockets(eng);
+        scan_output_tick(tp);
+        if (quit == 1 && eng->num_free == eng->num_queries){
+            // no more input and nothing in flight. We are done.
+            break;
+        }
+        // wait until the next deadline. If the input queue was empty, we
+        // check it again after a short while. If the rate limiter stopped
+        // us, we wait for the next token.
+        uint64_t wait_ms = twheel_next_expiry(eng->timers);
+        if (item == NULL && quit == 0 && wait_ms > BULKDNS_INPUT_POLL_MS)
+            wait_ms = BULKDNS_INPUT_POLL_MS;
+        if (pace_ms < wait_ms)
+            wait_ms = pace_ms;
+        ready = epoll_wait(eng->epfd, events, max_events, wait_ms == TWHEEL_NO_TIMER?-1:(int)wait_ms);
         if (ready == -1){
+            if (errno == EINTR)
+                continue;
             // this is an error
-            perror("ERROR in poll()");
+            perror("ERROR in epoll_wait()");
             exit(1);
         }
-
-        if (ready == 0 ){
-            // fprintf(stderr, "POLL() function timedout.....\n");
-            if (quit == 1){
-                break;
-            }else{
-                //TODO: WE NEED TO ADD ALL THE SOCKETS TO READY_TO_SEND?
-                // add all the sockets to ready_to_send state
-                void * dummy;
-                while ((dummy = cqueue_get(ready_to_send)) != NULL);
-                for (int i=0; i< nfds; ++i){
-                    cqueue_put(ready_to_send, (void*)(&(smrp->sock_list[i])));
-                }
-                continue;
-            }
-        }
         //fprintf(stderr, "*********We have socket to read.....%d\n", ready);
         // this one is just for reading
-        for (int j=0; j < nfds; ++j){
-            if (pfds[j].revents == 0)
-                continue;
-            if (pfds[j].revents & POLLIN){
+        for (int j=0; j < ready; ++j){
+            scan_mode_socket * sms = &(eng->socks[events[j].data.u32]);
+            if (events[j].events & EPOLLIN){
                 // we are ready to read
-                handle_read_socket(pfds[j].fd, mem_recv, tp);
-                cqueue_put(ready_to_send, (void*)(&(pfds[j].fd)));
-                continue;
-            }else if(pfds[j].revents & POLLNVAL){
-                // fprintf(stderr, "Apparently socket is closed (%d)\n", pfds[j].fd);
+                handle_read_socket(eng, sms);
                 continue;
-            }else{
-                // fprintf(stderr, "we have another event: %d\n", pfds[j].revents);
             }
             // we don't care about other cases
         }
     }
     // fprintf(stderr, "Done with the thread routine.... %d\n", num_item_received);
-    free(item);
-    free(mem_send);
-    free(mem_recv);
-    while ((item = cqueue_get(ready_to_send)) != NULL);
-    cqueue_free(ready_to_send);
+    namearena_release(item);
     // close all the sockets that are open
-    for (int i=0; i<nfds; ++i){
-        close(smrp->sock_list[i]);
+    for (int i=0; i<eng->num_sock; ++i){
+        close(eng->socks[i].sockfd);
+        udpbatch_free(eng->socks[i].batch);
     }   
-    free(pfds);
+    close(eng->epfd);
+    free(events);
+    free(eng->dirty);
+    free(eng->socks);
+    free(eng->queries);
+    free(eng->free_queries);
+    free(eng->query_mem);
+    inflight_free(eng->inflight);
+    twheel_free(eng->timers);
+    resolver_load_free(tp->resolvers, eng->load);
+    udpbatch_free(eng->recv_batch);
     free(ptr);
+    scan_output_release(tp);
+
+    // add our counters to the global ones
+    scan_merge_stats(tp, &(eng->stats));
+    rtthist_merge(&(tp->rtt), &(eng->rtt));
+    return NULL;
+}
+
+int bulkdns_same_question(const char * query, size_t query_len, const char * response, size_t response_len){
+    // check that the response has exactly the question of our query.
+    // Names are compared case-insensitively, labels lengths, qtype and
+    // qclass must be the same. returns 1 if they match.
+    if (query_len < 12 || response_len < 12)
+        return 0;
+    if ((uint8_t)response[4] != 0 || (uint8_t)response[5] != 1)
+        return 0;       // qdcount must be one
+    size_t pos = 12;
+    while (pos < query_len && query[pos] != 0)
+        pos += (uint8_t)query[pos] + 1;
+    pos += 5;           // root label + qtype + qclass
+    if (pos > query_len || pos > response_len)
+        return 0;
+    for (size_t i=12; i<pos; ++i){
+        if (query[i] != response[i] && tolower((uint8_t)query[i]) != tolower((uint8_t)response[i]))
+            return 0;
+    }
+    return 1;
+}
+
+int handle_read_socket(scan_mode_engine * eng, scan_mode_socket * sms){ 
+    // read as many responses as the batch can hold with one recvmmsg(),
+    // match them with the in-flight queries and process them.
+    // returns the number of responses we accepted.
+    udpbatch_ctx * rb = eng->recv_batch;
+    unsigned long int calls = rb->calls;
+    int received = udpbatch_recv(rb, sms->sockfd);
+    eng->stats.recv_calls += rb->calls - calls;
+    if (received == -1){
+        perror("Error receive=-1");
+        //fprintf(si->ERROR, "Error in receive function\n");
+        return -1;
+    }
+    if (eng->tp->capture)
+        scan_capture_answers(eng->tp, sms, rb);
+    int accepted = 0;
+    for (int i=0; i<received; ++i){
+        size_t len = 0;
+        char * mem_result = udpbatch_msg(rb, i, &len);
+        struct sockaddr_in * from = udpbatch_addr(rb, i);
+        // must be a response (qr=1) with a valid header and question
+        dnswire_msg wire;
+        if (dnswire_parse(mem_result, len, &wire) != 0 || wire.qr == 0){
+            eng->stats.unmatched += 1;
+            continue;
+        }
+        long int idx = inflight_get(eng->inflight, INFLIGHT_KEY(sms->index, wire.id));
+        if (idx == INFLIGHT_NOT_FOUND){
+            eng->stats.unmatched += 1;
+            continue;
+        }
+        scan_mode_worker_item * smwi = &(eng->queries[idx]);
+        struct sockaddr_in * server = &(eng->tp->resolvers->list[smwi->resolver].addr);
+        if (from->sin_addr.s_addr != server->sin_addr.s_addr || from->sin_port != server->sin_port ||
+            !bulkdns_same_question(smwi->query, smwi->query_len, mem_result, len)){
+            eng->stats.unmatched += 1;
+            continue;
+        }
+        if (smwi->state == BULKDNS_QUERY_BACKOFF){
+            // a late answer of the previous attempt. It's as good as the next one.
+            eng->stats.retries -= 1;
+        }
+        int rcode = wire.rcode;
+        if (smwi->state == BULKDNS_QUERY_SENT){
+            resolver_report(eng->tp->resolvers, eng->load, smwi->resolver,
+                            rcode == 5?RESOLVER_REFUSED:RESOLVER_ANSWER, smwi->probe, bulkdns_now_ms());
+            smwi->probe = 0;
+        }
+        if (smwi->hedge && (rcode == 2 || rcode == 5)){
+            // SERVFAIL or REFUSED for a duplicate never wins: we drop it
+            // and wait for the original query
+            smwi->twin->twin = NULL;
+            smwi->twin = NULL;
+            scan_engine_release(eng, smwi);
+            continue;
+        }
+        if ((rcode == 2 && eng->tp->si->retry_servfail) || (rcode == 5 && eng->tp->si->retry_refused)){
+            // SERVFAIL or REFUSED: try again if we still can
+            if (smwi->state == BULKDNS_QUERY_SENT && scan_engine_retry(eng, smwi) == 0)
+                continue;
+        }
+        // like Karn's algorithm, we only take the RTT of queries sent once:
+        // for a retried query we don't know which attempt is answered.
+        uint64_t rtt = 0;
+        if (smwi->attempts == 1){
+            rtt = bulkdns_now_ns() / 1000 - smwi->sent_at;
+            if (rtt == 0)
+                rtt = 1;
+            scan_engine_rtt(eng, rtt);
+        }
+        if (eng->adaptive){
+            unsigned int old_window = eng->aimd.window;
+            scan_engine_adapt(eng, aimd_on_answer(&(eng->aimd), rtt), old_window);
+        }
+        // the first answer wins: the output is written for the original
+        // query and both entries are released.
+        if (smwi->hedge){
+            eng->stats.hedges_won += 1;
+            smwi = smwi->twin;
+        }
+        handle_udp_response(mem_result, len, &wire, from, smwi, eng->tp);
+        scan_engine_release(eng, smwi);
+        eng->stats.responses += 1;
+        accepted += 1;
+    }
+    return accepted;
+}
+
+int scan_stateless_id(struct thread_param * tp, const char * msg, size_t len, uint16_t port, struct sockaddr_in * server, uint16_t * id){
+    // the DNS ID of a '--stateless' query is a keyed hash of the resolver,
+    // our local port and the question (the name in lower case). The receiver
+    // computes it again from the response to know that it answers our query.
+    // returns 0 on success and 1 if 'msg' has no valid question.
+    uint8_t data[8 + BULKDNS_MAX_QUERY_SIZE];
+    if (len < 12 || (uint8_t)msg[4] != 0 || (uint8_t)msg[5] != 1)
+        return 1;       // qdcount must be one
+    memcpy(data, &(server->sin_addr.s_addr), 4);
+    memcpy(data + 4, &(server->sin_port), 2);
+    memcpy(data + 6, &port, 2);
+    size_t pos = 12;
+    size_t n = 8;
+    while (pos < len && msg[pos] != 0){
+        uint8_t label = (uint8_t)msg[pos];
+        if ((label & 0xC0) != 0 || pos + 1 + label > len || n + label + 1 > sizeof(data) - 5)
+            return 1;
+        data[n++] = label;
+        for (size_t i=pos + 1; i<pos + 1 + label; ++i)
+            data[n++] = (uint8_t)tolower((uint8_t)msg[i]);
+        pos += label + 1;
+    }
+    if (pos + 5 > len)
+        return 1;
+    memcpy(data + n, msg + pos, 5);     // root label + qtype + qclass
+    n += 5;
+    *id = (uint16_t)siphash24(tp->cookie_key, data, n);
+    return 0;
+}
+
+void scan_stateless_init(scan_stateless_ctx * ctx, struct thread_param * tp, int id, int * sock_list, int num_sock){
+    // the sockets of one sender/receiver pair. We need the local port
+    // of each socket for the DNS IDs.
+    memset(ctx, 0, sizeof(scan_stateless_ctx));
+    ctx->tp = tp;
+    ctx->id = id;
+    ctx->num_sock = num_sock;
+    ctx->socks = bulkdns_malloc_or_abort(num_sock * sizeof(scan_mode_socket));
+    for (int i=0; i<num_sock; ++i){
+        scan_mode_socket * sms = &(ctx->socks[i]);
+        sms->sockfd = sock_list[i];
+        sms->index = i;
+        sms->dirty = 0;
+        sms->batch = udpbatch_init(tp->si->batch, 0);
+        if (sms->batch == NULL)
+            abort();
+        struct sockaddr_in local;
+        socklen_t local_len = sizeof(local);
+        if (getsockname(sms->sockfd, (struct sockaddr *)&local, &local_len) != 0){
+            perror("Can not get the port of the socket");
+            exit(1);
+        }
+        sms->port = local.sin_port;
+    }
+}
+
+void scan_stateless_free(scan_stateless_ctx * ctx){
+    for (int i=0; i<ctx->num_sock; ++i){
+        close(ctx->socks[i].sockfd);
+        udpbatch_free(ctx->socks[i].batch);
+    }
+    free(ctx->socks);
+}
+
+void * scan_stateless_sender(void * ptr){
+    // '--stateless' sender: take the names from the input and send them as
+    // fast as the rate limiters allow. We keep nothing about the queries:
+    // the receiver recognizes the responses by their DNS ID.
+    scan_stateless_ctx * ctx = (scan_stateless_ctx*) ptr;
+    struct thread_param * tp = ctx->tp;
+    scan_mode_engine engine;
+    scan_mode_engine * eng = &engine;
+    memset(eng, 0, sizeof(scan_mode_engine));
+    eng->tp = tp;
+    eng->id = ctx->id;
+    eng->socks = ctx->socks;
+    eng->num_sock = ctx->num_sock;
+    eng->dirty = bulkdns_malloc_or_abort(eng->num_sock * sizeof(scan_mode_socket*));
+    eng->load = resolver_load_init(tp->resolvers);
+    if (eng->load == NULL)
+        abort();
+    // a query waits in the batch of its socket until the next sendmmsg(),
+    // so each socket has one buffer per message of its batch
+    unsigned int batch = tp->si->batch;
+    eng->query_mem = bulkdns_malloc_or_abort(eng->num_sock * batch * BULKDNS_MAX_QUERY_SIZE);
+    scan_mode_worker_item smwi;
+    memset(&smwi, 0, sizeof(scan_mode_worker_item));
+    unsigned long int count = 0;
+    int quit = 0;
+    while (1){
+        void * item = try_read_item_from_queue(tp, &quit);
+        if (item == NULL){
+            if (quit == 1)
+                break;
+            // the input is empty: send what we have before we wait for it
+            scan_flush_sockets(eng);
+            scan_output_release(tp);
+            item = read_item_from_queue(tp);
+            if (item == NULL)
+                break;
+        }
+        // fill the batch of one socket before we move to the next one
+        scan_mode_socket * sms = &(eng->socks[(count / batch) % eng->num_sock]);
+        if (sms->batch->count == batch)
+            scan_flush_socket(eng, sms);
+        int probe = 0;
+        unsigned int resolver = resolver_pick(tp->resolvers, eng->load, bulkdns_now_ms(), &probe);
+        uint64_t wait_ms = 0;
+        while (scan_engine_pace(eng, resolver, &wait_ms) != 0){
+            scan_flush_sockets(eng);
+            scan_output_tick(tp);
+            usleep(wait_ms * 1000);
+        }
+        struct sockaddr_in * server = &(tp->resolvers->list[resolver].addr);
+        uint16_t id = 0;
+        smwi.item = item;
+        smwi.query = eng->query_mem + ((sms->index * batch) + sms->batch->count) * BULKDNS_MAX_QUERY_SIZE;
+        if (dns_routine_scan(&smwi, tp, smwi.query) != 0 ||
+            scan_stateless_id(tp, smwi.query, smwi.query_len, sms->port, server, &id) != 0){
+            namearena_release(item);
+            continue;
+        }
+        namearena_release(item);
+        smwi.query[0] = (char)(id >> 8);
+        smwi.query[1] = (char)(id & 0xFF);
+        udpbatch_add(sms->batch, smwi.query, smwi.query_len, server);
+        eng->load[resolver].sent += 1;
+        if (sms->dirty == 0){
+            sms->dirty = 1;
+            eng->dirty[eng->num_dirty++] = sms;
+        }
+        count += 1;
+    }
+    scan_flush_sockets(eng);
+    scan_output_release(tp);
+    // the receiver waits '--timeout' seconds from now for the last answers
+    __atomic_store_n(&(ctx->done_ms), bulkdns_now_ms(), __ATOMIC_RELEASE);
+    scan_merge_stats(tp, &(eng->stats));
+    resolver_load_free(tp->resolvers, eng->load);
+    free(eng->dirty);
+    free(eng->query_mem);
+    return NULL;
+}
+
+void * scan_stateless_receiver(void * ptr){
+    // '--stateless' receiver: accept the responses whose DNS ID is the keyed
+    // hash of their resolver, socket and question and write them. We stop
+    // '--timeout' seconds after our sender sent its last query.
+    scan_stateless_ctx * ctx = (scan_stateless_ctx*) ptr;
+    struct thread_param * tp = ctx->tp;
+    resolver_pool * pool = tp->resolvers;
+    scan_mode_stats * st = &(ctx->stats);
+    int epfd = epoll_create1(0);
+    if (epfd == -1){
+        perror("Can not create epoll instance");
+        exit(1);
+    }
+    for (int i=0; i<ctx->num_sock; ++i){
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, ctx->socks[i].sockfd, &ev) != 0){
+            perror("Can not add socket to epoll");
+            exit(1);
+        }
+    }
+    int max_events = ctx->num_sock < BULKDNS_MAX_EPOLL_EVENTS?ctx->num_sock:BULKDNS_MAX_EPOLL_EVENTS;
+    struct epoll_event * events = bulkdns_malloc_or_abort(max_events * sizeof(struct epoll_event));
+    udpbatch_ctx * rb = udpbatch_init(tp->si->batch, BULKDNS_MAX_UDP_RESPONSE);
+    if (rb == NULL)
+        abort();
+    char name[1024];
+    scan_mode_worker_item smwi;
+    memset(&smwi, 0, sizeof(scan_mode_worker_item));
+    smwi.item = name;
+    smwi.attempts = 1;
     while (1){
-        pthread_mutex_lock(&(tp->lock));
-        quit = cqueue_put(tp->queue_tcp, (void*)tp->quit_data);
-        pthread_mutex_unlock(&(tp->lock));
-        if (quit == 0){
+        uint64_t done = __atomic_load_n(&(ctx->done_ms), __ATOMIC_ACQUIRE);
+        if (done != 0 && bulkdns_now_ms() >= done + tp->si->timeout * 1000)
             break;
+        scan_output_tick(tp);
+        int ready = epoll_wait(epfd, events, max_events, BULKDNS_STATELESS_POLL_MS);
+        if (ready == -1){
+            if (errno == EINTR)
+                continue;
+            perror("ERROR in epoll_wait()");
+            exit(1);
+        }
+        for (int j=0; j<ready; ++j){
+            scan_mode_socket * sms = &(ctx->socks[events[j].data.u32]);
+            unsigned long int calls = rb->calls;
+            int received = udpbatch_recv(rb, sms->sockfd);
+            st->recv_calls += rb->calls - calls;
+            if (tp->capture)
+                scan_capture_answers(tp, sms, rb);
+            for (int i=0; i<received; ++i){
+                size_t len = 0;
+                char * mem_result = udpbatch_msg(rb, i, &len);
+                struct sockaddr_in * from = udpbatch_addr(rb, i);
+                // must be a response (qr=1) from one of our resolvers
+                // with the DNS ID we would have given to its question
+                unsigned int resolver = pool->count;
+                dnswire_msg wire;
+                if (dnswire_parse(mem_result, len, &wire) == 0 && wire.qr == 1){
+                    for (resolver=0; resolver<pool->count; ++resolver){
+                        if (from->sin_addr.s_addr == pool->list[resolver].addr.sin_addr.s_addr &&
+                            from->sin_port == pool->list[resolver].addr.sin_port)
+                            break;
+                    }
+                }
+                uint16_t id = 0;
+                if (resolver == pool->count ||
+                    scan_stateless_id(tp, mem_result, len, sms->port, &(pool->list[resolver].addr), &id) != 0 ||
+                    id != wire.id || dnswire_name_to_text(mem_result, len, wire.qname, name, sizeof(name)) != 0){
+                    st->unmatched += 1;
+                    continue;
+                }
+                smwi.resolver = resolver;
+                handle_udp_response(mem_result, len, &wire, from, &smwi, tp);
+                st->responses += 1;
+            }
         }
     }
+    close(epfd);
+    free(events);
+    udpbatch_free(rb);
+    scan_output_release(tp);
+    scan_merge_stats(tp, st);
     return NULL;
 }
 
-void handle_read_socket(int sockfd, char * mem_result, struct thread_param * tp){ 
-    struct sockaddr_in server;
-    unsigned int from_size = 0;
-    ssize_t received = recvfrom(sockfd, (void*)mem_result, 65535, 0, (struct sockaddr*)&server, &from_size);
-    if (received == -1){
-        perror("Error receive=-1");
-        //fprintf(si->ERROR, "Error in receive function\n");
+static void scan_end_record(struct thread_param * tp, unsigned int lane, jsonenc_buf * buf, size_t start,
+                            unsigned int attempts){
+    // the JSON object of a record is in 'buf' from 'start'. If we retry the
+    // queries, we add the number of attempts as the last member of the object.
+    // Then the record is complete and the writer thread may have it.
+    int res = 0;
+    if (tp->si->retries > 0 && buf->len > start && buf->mem[buf->len - 1] == '}'){
+        buf->len -= 1;
+        res = jsonenc_append(buf, ", \"attempts\": ", 14) || jsonenc_uint(buf, attempts) ||
+              jsonenc_append(buf, "}", 1);
+    }
+    if (res != 0 || jsonenc_append(buf, "\n", 1) != 0){
+        buf->len = start;       // no half record in the output
         return;
     }
-    if (received == 0){
-        perror("Error receive=0");
+    outwriter_lane_commit(tp->output, lane);
+}
+
+void scan_write_record(struct thread_param * tp, unsigned int lane, const char * record, unsigned int attempts){
+    // writes one JSON record to the output buffer of this thread for the
+    // shard 'lane' (always 0 without '--output-shards')
+    jsonenc_buf * buf = outwriter_lane_buffer(tp->output, lane);
+    if (buf == NULL)
+        return;
+    size_t start = buf->len;
+    if (jsonenc_append(buf, record, strlen(record)) != 0){
+        buf->len = start;
         return;
     }
-    
-    sdns_context * dns_udp_response = sdns_init_context();
-    dns_udp_response->raw = mem_result;
-    dns_udp_response->raw_len = received;
-    
-    int res = sdns_from_wire(dns_udp_response);
-    if (res != 0){
-        dns_udp_response->raw = NULL;
-        sdns_free_context(dns_udp_response);
+    scan_end_record(tp, lane, buf, start, attempts);
+}
+
+int scan_write_header(struct scanner_input * si){
+    // what goes before the records: the names of the fields for TSV/CSV
+    // and the file header of the raw log. returns 0 on success
+    jsonenc_buf header;
+    if (jsonenc_init(&header) != 0)
+        return 1;
+    int res = 0;
+    if (si->format == ROWENC_FORMAT_RAW)
+        res = rawlog_file_header(&header, si->retries > 0?RAWLOG_FLAG_ATTEMPTS:0);
+    else if (si->format != ROWENC_FORMAT_JSON)
+        res = rowenc_header(&(si->rows), &header);
+    if (res == 0 && header.len > 0 && si->compress != COMPRESS_NONE){
+        // a block of its own, like the ones of the writer
+        jsonenc_buf packed = {NULL, 0, 0};
+        compress_ctx * codec = compress_init(si->compress, si->compress_level);
+        res = codec == NULL || compress_block(codec, header.mem, header.len, &packed) != 0;
+        compress_free(codec);
+        jsonenc_free(&header);
+        header = packed;
+    }
+    if (res == 0 && si->split != NULL){
+        // at the start of each part of the output
+        res = outsplit_set_header(si->split, header.mem, header.len);
+        jsonenc_free(&header);
+        return res;
+    }
+    if (res == 0 && header.len > 0)
+        fwrite(header.mem, 1, header.len, si->OUTPUT);
+    jsonenc_free(&header);
+    // the writer thread writes to the file descriptor from now on
+    fflush(si->OUTPUT);
+    return res;
+}
+
+outwriter_ctx * scan_output_init(struct scanner_input * si){
+    // the writer of the output: 4 buffers per thread (and one for each
+    // thread which compresses them with '--compress'). With '--output-split'
+    // or '--output-shards', it writes to the files of 'si->split'.
+    unsigned int count = BULKDNS_OUTPUT_BUFFERS_PER_THREAD * (si->threads + 1);
+    if (si->compress != COMPRESS_NONE)
+        count += si->compress_threads;
+    if (si->split != NULL){
+        // a producer (an engine, its '--stateless' receiver or a TCP thread)
+        // may hold one buffer for each shard
+        count += 3 * (si->threads + 1) * (si->output_shards - 1);
+        if (outsplit_start(si->split) != 0)
+            return NULL;
+        return outwriter_init_split(si->split, count, si->compress, si->compress_level, si->compress_threads);
+    }
+    if (si->compress == COMPRESS_NONE)
+        return outwriter_init(fileno(si->OUTPUT), count);
+    return outwriter_init_compressed(fileno(si->OUTPUT), count, si->compress,
+                                     si->compress_level, si->compress_threads);
+}
+
+void scan_answer_meta(dnswire_meta * meta, unsigned int attempts, struct sockaddr_in * from, uint64_t sent_at){
+    // what we write about an answer of 'from' besides its message. 'sent_at'
+    // is when we sent the (last) query in microseconds (0: we don't know).
+    meta->attempts = attempts;
+    meta->addr = from->sin_addr.s_addr;
+    meta->port = from->sin_port;
+    meta->rtt_us = 0;
+    if (sent_at != 0){
+        uint64_t rtt = bulkdns_now_ns() / 1000 - sent_at;
+        meta->rtt_us = rtt == 0?1:(rtt > UINT32_MAX?UINT32_MAX:(uint32_t)rtt);
+    }
+    meta->time_us = bulkdns_unix_us();
+}
+
+static int scan_pcap_header(struct scanner_input * si){
+    // write the header of the '--pcap' file. returns 0 on success
+    jsonenc_buf header;
+    if (jsonenc_init(&header) != 0)
+        return 1;
+    int res = pcapfile_header(&header);
+    if (res == 0 && fwrite(header.mem, 1, header.len, si->PCAP) != header.len)
+        res = 1;
+    jsonenc_free(&header);
+    if (res != 0 || fflush(si->PCAP) != 0){
+        perror("ERROR: Can not write the pcap file");
+        return 1;
+    }
+    return 0;
+}
+
+int scan_capture_init(struct thread_param * tp){
+    // start the writers of '--pcap' and '--dnstap' (if we have them). Our
+    // address in the packets is the one the kernel picks to reach the
+    // first resolver (the sockets are bound to 0.0.0.0). returns 0 on success
+    struct scanner_input * si = tp->si;
+    if (si->PCAP == NULL && si->dnstap_dest == NULL)
+        return 0;
+    tp->capture = 1;
+    memset(&(tp->local), 0, sizeof(struct sockaddr_in));
+    tp->local.sin_family = AF_INET;
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd != -1){
+        struct sockaddr_in local;
+        socklen_t local_len = sizeof(local);
+        if (connect(sockfd, (struct sockaddr *) &(tp->resolvers->list[0].addr), sizeof(struct sockaddr_in)) == 0 &&
+            getsockname(sockfd, (struct sockaddr *) &local, &local_len) == 0)
+            tp->local.sin_addr = local.sin_addr;
+        close(sockfd);
+    }
+    unsigned int count = BULKDNS_OUTPUT_BUFFERS_PER_THREAD * (si->threads + 1);
+    if (si->PCAP != NULL){
+        if (scan_pcap_header(si) != 0)
+            return 1;
+        tp->pcap = outwriter_init(fileno(si->PCAP), count);
+        if (tp->pcap == NULL)
+            return 1;
+    }
+    if (si->dnstap_dest != NULL){
+        tp->dnstap = dnstap_open(si->dnstap_dest);
+        if (tp->dnstap == NULL)
+            return 1;
+        tp->dnstap_output = outwriter_init(tp->dnstap->fd, count);
+        if (tp->dnstap_output == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+void scan_capture(struct thread_param * tp, int proto, int query, struct sockaddr_in * src, struct sockaddr_in * dst,
+                  const char * msg, size_t len, uint64_t time_us){
+    // write one packet we sent ('query' is 1) or received to the '--pcap'
+    // and '--dnstap' buffers of this thread
+    if (tp->pcap != NULL){
+        jsonenc_buf * buf = outwriter_buffer(tp->pcap);
+        if (buf != NULL && pcapfile_append(buf, proto, src, dst, msg, len, time_us) == 0)
+            outwriter_commit(tp->pcap);
+    }
+    if (tp->dnstap != NULL){
+        // dnstap wants the address which sent the query first: it's ours
+        jsonenc_buf * buf = outwriter_buffer(tp->dnstap_output);
+        int res = 1;
+        if (buf != NULL && query)
+            res = dnstap_append(tp->dnstap, buf, DNSTAP_RESOLVER_QUERY, proto == PCAPFILE_TCP?DNSTAP_TCP:DNSTAP_UDP,
+                                src, dst, msg, len, time_us);
+        else if (buf != NULL)
+            res = dnstap_append(tp->dnstap, buf, DNSTAP_RESOLVER_RESPONSE, proto == PCAPFILE_TCP?DNSTAP_TCP:DNSTAP_UDP,
+                                dst, src, msg, len, time_us);
+        if (res == 0)
+            outwriter_commit(tp->dnstap_output);
+    }
+}
+
+void scan_output_tick(struct thread_param * tp){
+    // don't keep what this thread wrote in its buffers for too long
+    uint64_t now = bulkdns_now_ms();
+    outwriter_tick(tp->output, now);
+    outwriter_tick(tp->pcap, now);
+    outwriter_tick(tp->dnstap_output, now);
+}
+
+void scan_output_release(struct thread_param * tp){
+    // this thread is done (or waits for a while): hand off its buffers
+    outwriter_release(tp->output);
+    outwriter_release(tp->pcap);
+    outwriter_release(tp->dnstap_output);
+}
+
+void scan_capture_queries(struct thread_param * tp, scan_mode_socket * sms){
+    // '--pcap'/'--dnstap': the queries in the batch of 'sms' are about to be sent
+    udpbatch_ctx * batch = sms->batch;
+    struct sockaddr_in local = tp->local;
+    local.sin_port = sms->port;
+    uint64_t now = bulkdns_unix_us();
+    for (unsigned int i=0; i<batch->count; ++i)
+        scan_capture(tp, PCAPFILE_UDP, 1, &local, &(batch->addr[i]), batch->iov[i].iov_base, batch->iov[i].iov_len, now);
+}
+
+void scan_capture_answers(struct thread_param * tp, scan_mode_socket * sms, udpbatch_ctx * rb){
+    // '--pcap'/'--dnstap': what recvmmsg() just gave us on 'sms', matched or not
+    struct sockaddr_in local = tp->local;
+    local.sin_port = sms->port;
+    uint64_t now = bulkdns_unix_us();
+    for (unsigned int i=0; i<rb->count; ++i){
+        size_t len = 0;
+        char * msg = udpbatch_msg(rb, i, &len);
+        if (len > 0)
+            scan_capture(tp, PCAPFILE_UDP, 0, udpbatch_addr(rb, i), &local, msg, len, now);
+    }
+}
+
+void scan_write_answer(struct thread_param * tp, char * msg, size_t len, dnswire_msg * wire, dnswire_meta * meta){
+    // write the answer 'msg' to the output. The default is sdns and its
+    // jansson encoder. With '--fast-json' or '--format=tsv|csv', we encode
+    // it from the wire straight into the output buffer of this thread.
+    // '--format=raw' keeps the message as it is, with 'meta'.
+    unsigned int attempts = meta->attempts;
+    // '--output-shards': the answers for one name go to one shard
+    unsigned int lane = 0;
+    if (tp->si->output_shards > 1)
+        lane = dnswire_qname_hash(msg, wire) % tp->si->output_shards;
+    if (tp->si->format == ROWENC_FORMAT_RAW){
+        jsonenc_buf * buf = outwriter_lane_buffer(tp->output, lane);
+        if (buf != NULL && rawlog_append(buf, msg, len, meta) == 0)
+            outwriter_lane_commit(tp->output, lane);
         return;
     }
-    
-    if (tp->si->udp_only){
-        char * dmp = sdns_json_dns_string(dns_udp_response);
-        fprintf(tp->si->OUTPUT, "%s\n", dmp);
-        free(dmp);
-        dns_udp_response->raw = NULL;
-        sdns_free_context(dns_udp_response);
+    if (wire->complete == 0)
+        return;     // sdns can not decode it either
+    if (tp->si->format != ROWENC_FORMAT_JSON){
+        // only the fields of '--fields', straight from the wire
+        jsonenc_buf * buf = outwriter_lane_buffer(tp->output, lane);
+        if (buf != NULL && rowenc_message(&(tp->si->rows), buf, msg, len, wire, meta) == 0)
+            outwriter_lane_commit(tp->output, lane);
         return;
     }
-    // we are here, it means we need to check the truncation 
-    // for a possible TCP request
-    if (dns_udp_response->msg->header.tc == 1){
-        
-        
-        int res;
-        char * domain = dns_udp_response->msg->question.qname == NULL?NULL:strdup(dns_udp_response->msg->question.qname);
-        if (domain == NULL)
+    if (tp->si->fast_json){
+        jsonenc_buf * buf = outwriter_lane_buffer(tp->output, lane);
+        if (buf == NULL)
             return;
-        dns_udp_response->raw = NULL;
-        sdns_free_context(dns_udp_response);
-        while (1){
-            pthread_mutex_lock(&(tp->lock));
-            res = cqueue_put(tp->queue_tcp, (void*)(domain));
-            pthread_mutex_unlock(&(tp->lock));
-            if (res != 0){
-                sleep(1);
-                continue;
-            }else{
-                break;
-            }
-        }
+        size_t start = buf->len;
+        if (jsonenc_message(buf, msg, len, wire) != 0)
+            return;
+        scan_end_record(tp, lane, buf, start, attempts);
         return;
-    }else{
-        char * dmp = sdns_json_dns_string(dns_udp_response);
-        fprintf(tp->si->OUTPUT, "%s\n", dmp);
+    }
+    sdns_context * dns = sdns_init_context();
+    if (NULL == dns)
+        return;
+    dns->raw = msg;
+    dns->raw_len = len;
+    if (sdns_from_wire(dns) == 0){
+        char * dmp = sdns_json_dns_string(dns);
+        scan_write_record(tp, lane, dmp, attempts);
         free(dmp);
-        dns_udp_response->raw = NULL;
-        sdns_free_context(dns_udp_response); 
+    }
+    dns->raw = NULL;
+    sdns_free_context(dns);
+}
+
+void handle_udp_response(char * mem_result, size_t received, dnswire_msg * wire, struct sockaddr_in * from,
+                         scan_mode_worker_item * smwi, struct thread_param * tp){ 
+    // 'wire' is what the wire scanner found in the answer. A truncated
+    // answer goes to the TCP threads without being decoded: we only
+    // decode (sdns) the answers we write.
+    if (tp->si->udp_only || wire->tc == 0){
+        dnswire_meta meta;
+        scan_answer_meta(&meta, smwi->attempts, from, smwi->sent_at);
+        scan_write_answer(tp, mem_result, received, wire, &meta);
         return;
     }
+    // we are here, it means the answer is truncated: we need a TCP request
+    scan_mode_tcp_item * tcp_item = bulkdns_malloc_or_abort(sizeof(scan_mode_tcp_item));
+    tcp_item->name = strdup((char*)smwi->item);
+    tcp_item->attempts = smwi->attempts;
+    tcp_item->resolver = smwi->resolver;
+    // if the TCP threads are behind, we wait for them
+    mpmc_queue_push(tp->queue_tcp, (void*)(tcp_item), MPMC_FOREVER);
 }
 
 int udp_socket_send(char * tosend_buffer, size_t tosend_len, int sockfd, struct sockaddr_in server){
@@ -700,43 +1839,15 @@ int udp_socket_send(char * tosend_buffer, size_t tosend_len, int sockfd, struct
     return 0;   // success
 }
 
-void dns_routine_scan(scan_mode_worker_item * smwi, struct scanner_input * si, char * mem_result){
-
-    char * domain_name = strdup((char*)smwi->item);
-    sdns_context * dns = sdns_init_context();
-    if (NULL == dns)
-        return;
-    int res = sdns_make_query(dns, si->rr_type, si->rr_class, domain_name, ~(si->no_edns));
-    if (res != 0){
-        sdns_free_context(dns);
-        return;
-    }
-    if (si->set_do && (!si->no_edns))
-        dns->msg->additional->opt_ttl.DO = 1;
-    if (si->set_nsid && (!si->no_edns)){
-        sdns_opt_rdata * nsid = sdns_create_edns0_nsid(NULL, 0);
-        if (nsid != NULL){
-            res = sdns_add_edns(dns, nsid);
-            if (res != 0){
-                sdns_free_context(dns);
-                sdns_free_opt_rdata(nsid);
-                return;
-            }
-        }
-    }
-    res = sdns_to_wire(dns);
-    if (res != 0){
-        sdns_free_context(dns);
-        return;
-    }
-    
-    res = udp_socket_send(dns->raw, dns->raw_len, smwi->udp_sock, smwi->server);
-    sdns_free_context(dns);
-    return;
+int dns_routine_scan(scan_mode_worker_item * smwi, struct thread_param * tp, char * mem_result){
+    // encodes the query for smwi->item in 'mem_result' (BULKDNS_MAX_QUERY_SIZE
+    // bytes) and sets smwi->query_len. Only the name is written here, the
+    // rest comes from the template of the scan (the caller sets the ID).
+    // returns 0 on success.
+    smwi->query_len = qtemplate_build(&(tp->query), (char*)smwi->item, 0, mem_result, BULKDNS_MAX_QUERY_SIZE);
+    return smwi->query_len == 0?1:0;
 }
     
-
-
 #ifdef COMPILE_WITH_LUA
 void * scan_lua_worker_routine(void * ptr){
     // this worker routine is for custom scan scenario
@@ -768,26 +1879,9 @@ void * scan_lua_worker_routine(void * ptr){
     }
     //fprintf(stdout, "starting thread...\n");
     while (1){
-        // loop forever until item is "quit"
-        // as our queue is not thread-safe, we have to lock it
-        pthread_mutex_lock(&(tp->lock));
-        item = cqueue_get(tp->qinput);
-        pthread_mutex_unlock(&(tp->lock));
-        if (item == NULL){
-            // sleep 1 sec and continue
-            sleep(1);
-            continue;
-            //fprintf(si->ERROR, "ERROR: %s\n", qinput->errmsg);
-        }
-        //cnt += 1;
+        // loop until we took the whole input
+        item = read_item_from_queue(tp);
         if (item == NULL){
-            // something is wrong. we should never be here.
-            fprintf(stderr, "We should never have NULL item in the queue!!!!!\n");
-            // just quit the thread
-            return NULL;
-        }
-        if (strcmp((char*) item, tp->quit_data) == 0){
-            //fprintf(stderr, "We have received a quit message in thread#%ld\n", pthread_self());
             // let's call the lua script for the last time but pass nil instead
             // this is very usefull for the lua file to know the last call
             lua_settop (L, 0);
@@ -800,7 +1894,7 @@ void * scan_lua_worker_routine(void * ptr){
         // do whatever you want with the item
         lua_dns_routine_scan(item, si, L);
         // item is just a char* pointer (one stripped line of the input file)
-        free(item);
+        namearena_release(item);
     }
     return NULL;
 }
@@ -864,13 +1958,16 @@ int init_udp_socket(struct scanner_input * si){
         close(sockfd);
         return -2;
     }
-    
-    int enable_reuseaddr = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable_reuseaddr, sizeof(int)) < 0){
-        perror("Error making socket reusable");
-        close(sockfd);
-        exit(1);
+    if (si->sockets > 0 || si->stateless){
+        // a socket of '--sockets' (or '--stateless') carries many queries: ask for large
+        // buffers so a burst of answers is not dropped (best effort)
+        int size = BULKDNS_SOCKET_BUFFER;
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
     }
+    // no SO_REUSEADDR here: with port 0, the OS may give the same port
+    // to two 'reusable' sockets and the answers of one socket would
+    // arrive on the other one.
     if (bind(sockfd, (struct sockaddr *)&local, sizeof(local)) != 0){
         close(sockfd);
         perror("Error in binding socket");
@@ -881,18 +1978,15 @@ int init_udp_socket(struct scanner_input * si){
 
 
 int perform_lookup_udp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer,
-                       size_t * toreceive_len, struct scanner_input * si, int sockfd){
+                       size_t * toreceive_len, struct sockaddr_in * server, struct scanner_input * si, int sockfd){
     //char buffer[256] = {0x00};
     //char * error = buffer;
-    struct sockaddr_in server;
+    struct sockaddr_in from;
     unsigned int from_size;
-    server.sin_port = htons(si->port);
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(si->resolver);
     
     ssize_t sent = 0;
     
-    sent = sendto(sockfd, tosend_buffer, tosend_len, 0, (struct sockaddr *)&server, sizeof(server));
+    sent = sendto(sockfd, tosend_buffer, tosend_len, 0, (struct sockaddr *)server, sizeof(struct sockaddr_in));
     if (sent == -1){  //error
         perror("error");
         fprintf(si->ERROR, "Error in sendto()\n");
@@ -907,7 +2001,7 @@ int perform_lookup_udp(char * tosend_buffer, size_t tosend_len, char ** toreceiv
     ssize_t received = 0;
                                                     
     from_size = 0;
-    received = recvfrom(sockfd, *toreceive_buffer, 65535, 0, (struct sockaddr*)&server, &from_size);
+    received = recvfrom(sockfd, *toreceive_buffer, 65535, 0, (struct sockaddr*)&from, &from_size);
     if (received == -1){
         //perror("Error receive=-1");
         //fprintf(si->ERROR, "Error in receive function\n");
@@ -923,12 +2017,10 @@ int perform_lookup_udp(char * tosend_buffer, size_t tosend_len, char ** toreceiv
 }
 
 int perform_lookup_tcp(char * tosend_buffer, size_t tosend_len, char ** toreceive_buffer,
-                       size_t * toreceive_len, struct scanner_input * si){
+                       size_t * toreceive_len, struct sockaddr_in * server, struct scanner_input * si,
+                       struct sockaddr_in * local){
+    // 'local' gets the address of our end of the connection (may be NULL)
     struct timeval tv = {.tv_sec = si->timeout, .tv_usec = 0};
-    struct sockaddr_in server;
-    server.sin_port = htons(si->port);
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr(si->resolver);
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1){
         close(sockfd);
@@ -945,11 +2037,16 @@ int perform_lookup_tcp(char * tosend_buffer, size_t tosend_len, char ** toreceiv
         close(sockfd);
         return 2;
     }
-    if (connect(sockfd, (struct sockaddr *) &server, sizeof(server)) < 0){
+    if (connect(sockfd, (struct sockaddr *) server, sizeof(struct sockaddr_in)) < 0){
         fprintf(si->ERROR, "Can not connect to TCP socket\n");
         close(sockfd);
         return 2;
     }
+    if (local != NULL){
+        socklen_t local_len = sizeof(struct sockaddr_in);
+        if (getsockname(sockfd, (struct sockaddr *) local, &local_len) != 0)
+            memset(local, 0, sizeof(struct sockaddr_in));
+    }
     ssize_t sent = 0;
     uint16_t payload_size = tosend_len;
     char * payload = (char*) malloc(2 + payload_size);
@@ -984,37 +2081,6 @@ int perform_lookup_tcp(char * tosend_buffer, size_t tosend_len, char ** toreceiv
     return 0;   //success
 }
 
-char * readline(FILE * fp){
-    const int MAX_LINE_SIZE = 255;
-    char * line = (char*) calloc(MAX_LINE_SIZE + 1, sizeof(char));
-    int ch = -1;
-    char * new_memory = NULL;
-    unsigned long int count = 0;
-    while ((ch = fgetc(fp)) != EOF){
-        line[count++] = ch;
-        if (ch == '\n'){
-            return line;
-        }
-        if (count % MAX_LINE_SIZE == 0){
-            // we need to reallocate
-            new_memory = (char*)realloc(line, strlen(line) + MAX_LINE_SIZE);
-            if (new_memory == NULL){
-                printf("ERROR: Can not reallocate memory for reading line...");
-                free(line);
-                return NULL;
-            }
-            line = new_memory;
-        }
-    }
-    if (count == 0){
-        // we are at the end of file
-        free(line);
-        return NULL;
-    }
-    line[count] = '\0';
-    return line;
-}
-
 int convert_type_to_int(char * type){
     // no allocation no leak
     if (type == NULL)
@@ -1073,6 +2139,27 @@ int convert_class_to_int(char * cls){
 /**************** Functions from here are related to server mode *******************/
 /************************************************************************************/
 
+// the '--dnstap' stream of this process. The server only stops with
+// CTRL+C (exit()), so we end the stream in an atexit() handler.
+static dnstap_ctx * server_mode_dnstap = NULL;
+static pid_t server_mode_dnstap_owner = 0;
+
+static void server_mode_dnstap_close(void){
+    // only the process which opened the stream ends it (a forked
+    // child inherits our atexit() handlers)
+    if (server_mode_dnstap != NULL && getpid() == server_mode_dnstap_owner)
+        dnstap_close(server_mode_dnstap);
+    server_mode_dnstap = NULL;
+}
+
+static void server_mode_dnstap_open(server_mode_server_param * smsp){
+    server_mode_dnstap = dnstap_open(smsp->dnstap_dest);
+    if (server_mode_dnstap == NULL)
+        exit(1);
+    server_mode_dnstap_owner = getpid();
+    atexit(server_mode_dnstap_close);
+}
+
 server_mode_queue_data * init_server_mode_queue_data(){
     server_mode_queue_data * qd = (server_mode_queue_data*)bulkdns_malloc_or_abort(sizeof(server_mode_queue_data));
     qd->client_addr_len = sizeof(qd->client_addr);
@@ -1254,16 +2341,10 @@ void * smode_func_sender_tcp(void * data){
     }
     
     while(1){
-        pthread_mutex_lock(tp->mutex_queue);
-        pthread_cond_wait(tp->cond_queue, tp->mutex_queue);
-        to_consume = cqueue_get(tp->queue_handle);
-        if (NULL == to_consume){  // queue is empty
-            pthread_mutex_unlock(tp->mutex_queue);
-            //usleep(100000);     // 1 millisec
+        // we sleep until the receiver gives us a connection
+        to_consume = mpmc_queue_pop(tp->queue_handle, MPMC_FOREVER);
+        if (NULL == to_consume)
             continue;
-        }
-        // the data is ready to be sent
-        pthread_mutex_unlock(tp->mutex_queue);
 
         // send it to be process
         server_mode_process_input_tcp((server_mode_queue_data *)to_consume, L);
@@ -1274,6 +2355,10 @@ void * smode_func_sender_tcp(void * data){
             send(((server_mode_queue_data*)to_consume)->tcp_sock,
                  ((server_mode_queue_data*)to_consume)->to_send,
                  ((server_mode_queue_data*)to_consume)->to_send_len, 0);
+            // without the 2 bytes of the TCP size
+            server_mode_to_dnstap(tp, DNSTAP_CLIENT_RESPONSE, DNSTAP_TCP, &(((server_mode_queue_data*)to_consume)->client_addr),
+                                  ((server_mode_queue_data*)to_consume)->to_send + 2,
+                                  ((server_mode_queue_data*)to_consume)->to_send_len - 2);
 
         }
         close(((server_mode_queue_data*)to_consume)->tcp_sock);
@@ -1335,10 +2420,12 @@ void * smode_func_receiver_tcp(void * data){
         qd->received_len = received_len;
         // remove the TCP size first
         qd->received = bulkdns_mem_copy(buff+2, received_len - 2);
-        pthread_mutex_lock(tp->mutex_queue);
-        cqueue_put(tp->queue_handle, (void*)qd);
-        pthread_mutex_unlock(tp->mutex_queue);
-        pthread_cond_signal(tp->cond_queue);
+        server_mode_to_dnstap(tp, DNSTAP_CLIENT_QUERY, DNSTAP_TCP, &(qd->client_addr), qd->received, received_len - 2);
+        if (mpmc_queue_push(tp->queue_handle, (void*)qd, 0) != 0){
+            // the sender is behind: we drop this one
+            close(qd->tcp_sock);
+            free_server_mode_queue_data(qd);
+        }
         // init another queue data
         qd = init_server_mode_queue_data();
     }
@@ -1397,6 +2484,7 @@ void * smode_func_receiver_udp(void * data){
         qd->received_len = received_len;
         qd->received = bulkdns_mem_copy(buff, received_len);
         received_len = -1;
+        server_mode_to_dnstap(tp, DNSTAP_CLIENT_QUERY, DNSTAP_UDP, &(qd->client_addr), qd->received, qd->received_len);
         
         server_mode_process_input_udp(qd, L);
 
@@ -1404,6 +2492,7 @@ void * smode_func_receiver_udp(void * data){
             sendto(tp->sockfd, qd->to_send, qd->to_send_len, 0,
                    (struct sockaddr *)(&(qd->client_addr)),
                    qd->client_addr_len);
+            server_mode_to_dnstap(tp, DNSTAP_CLIENT_RESPONSE, DNSTAP_UDP, &(qd->client_addr), qd->to_send, qd->to_send_len);
         }
         free_server_mode_queue_data(qd);
 
@@ -1459,19 +2548,9 @@ void* server_mode_run_udp(void * param){
     }
     
 
-    // creating a queue. The receiver will put data in our queue and 
-    // the sender will read the data, process it and send the result to the client.
-    // The queue will be passed as an argument to both threads.
-    cqueue_ctx * queue_handle = cqueue_init(50);       // we receive up to 50 records
-                                                        // and then start to drop the packets
-    
-    // can not continue if we can not create the queues
-    if (NULL == queue_handle)
-        abort();
-     
-
     // this what we pass as the parameter to both threads
-    server_mode_thread_params tp = {.sockfd=sockfd, .lua_file=smsp->lua_file};
+    server_mode_thread_params tp = {.sockfd=sockfd, .lua_file=smsp->lua_file,
+                                    .dnstap=server_mode_dnstap, .local=server};
 
     // now we create two threads: one for listening and receiving data, putting it
     // in the queue. The other one reading the queue constantly, fetching the data,
@@ -1540,25 +2619,18 @@ void * server_mode_run_tcp(void * param){
     // creating a queue. The receiver will put data in our queue and 
     // the sender will read the data, process it and send the result to the client.
     // The queue will be passed as an argument to both sender and receiver.
-    cqueue_ctx * queue_handle = cqueue_init(50);       // we receive up to 50 records
-                                                        // and then start dropping the packets
+    // The sender sleeps on the queue until there is a connection.
+    mpmc_queue * queue_handle = mpmc_queue_init(BULKDNS_SERVER_QUEUE_SIZE);     // we receive up to 64 connections
+                                                                                // and then start dropping them
     
     // can not continue if we can not create the queues
     if (NULL == queue_handle)
         abort();
     
-    // create a lock for the queue (two threads going to have access to our queue)
-    pthread_mutex_t * mutex_queue = bulkdns_malloc_or_abort(sizeof(pthread_mutex_t));
-    pthread_cond_t * cond_queue = bulkdns_malloc_or_abort(sizeof(pthread_cond_t));
-    
-    // abort if we can not create a mutex
-    if (pthread_mutex_init(mutex_queue, NULL) != 0)
-        abort();
-    if (pthread_cond_init(cond_queue, NULL) != 0)
-        abort();
     // this what we pass as the parameter to both threads
-    server_mode_thread_params tp = {.queue_handle  = queue_handle, .mutex_queue = mutex_queue,
-                                    .sockfd=sockfd, .lua_file=smsp->lua_file, .cond_queue = cond_queue};
+    server_mode_thread_params tp = {.queue_handle  = queue_handle,
+                                    .sockfd=sockfd, .lua_file=smsp->lua_file,
+                                    .dnstap=server_mode_dnstap, .local=servaddr};
 
 
     // now we create one thread: for reading the queue constantly, fetching the data,
@@ -1575,16 +2647,27 @@ void * server_mode_run_tcp(void * param){
 }
 
 void server_mode_run_all(server_mode_server_param *smsp){
+    // a dnstap file is shared by the UDP and TCP processes (each frame is
+    // appended with one write()), a collector gets one connection from each
+    int dnstap_socket = smsp->dnstap_dest != NULL && strncmp(smsp->dnstap_dest, "unix:", 5) == 0;
+    if (smsp->dnstap_dest != NULL && !dnstap_socket)
+        server_mode_dnstap_open(smsp);
     if (smsp->run_tcp_server){
         pid_t newpid = fork();
         if (newpid == 0){   // this is the child where we run TCP mode
+            if (dnstap_socket)
+                server_mode_dnstap_open(smsp);
             server_mode_run_tcp((void*)smsp);
         }else if (newpid > 0){  // this is parent where we run UDP mode
+            if (dnstap_socket)
+                server_mode_dnstap_open(smsp);
             server_mode_run_udp((void*)smsp);
         }else{      // this is error where we should never reach
             exit(0);
         }
     }else{  // user asked for only UDP.
+        if (dnstap_socket)
+            server_mode_dnstap_open(smsp);
         server_mode_run_udp((void*)smsp);
     }
 }
@@ -1595,7 +2678,8 @@ void switch_server_mode(struct scanner_input * si){
     signal(SIGINT, sig_int_handler);
     
     server_mode_server_param p = {.ip = si->bind_ip, .port=si->port,
-                                  .lua_file=si->lua_file, .run_tcp_server=si->no_tcp ^ 1};
+                                  .lua_file=si->lua_file, .run_tcp_server=si->no_tcp ^ 1,
+                                  .dnstap_dest=si->dnstap_dest};
     server_mode_run_all(&p);
 #else
     fprintf(stderr, "ERROR: You need to compile the code with Lua to use the server mode\n");
@@ -1609,18 +2693,281 @@ void server_mode_to_log(const char * msg, FILE * fd){
     fprintf(fd, "%s\n", msg);
 }
 
+void server_mode_to_dnstap(server_mode_thread_params * tp, int type, int proto, struct sockaddr_in * client,
+                           const char * msg, size_t len){
+    // writes the query of 'client' or our response ('type' is DNSTAP_CLIENT_QUERY
+    // or DNSTAP_CLIENT_RESPONSE) to '--dnstap' as one frame
+    if (tp->dnstap == NULL)
+        return;
+    jsonenc_buf buf;
+    if (jsonenc_init(&buf) != 0)
+        return;
+    if (dnstap_append(tp->dnstap, &buf, type, proto, client, &(tp->local), msg, len, bulkdns_unix_us()) == 0)
+        dnstap_write(tp->dnstap, buf.mem, buf.len);
+    jsonenc_free(&buf);
+}
+
 
 /************************************************************************************/
 /*************** functions from here are related to command-line options**************/
 /************************************************************************************/
 
 
+/***************************************************************************/
+/***************** Functions related to bulkDNS decode mode ****************/
+/***************************************************************************/
+
+void * decode_mode_worker(void * ptr){
+    // take the chunks of the raw log and write their answers like the scan
+    // would have written them ('--format', '--fields', '--fast-json')
+    decode_mode_ctx * ctx = (decode_mode_ctx*) ptr;
+    struct thread_param * tp = ctx->tp;
+    unsigned long int records = 0;
+    unsigned long int errors = 0;
+    while (1){
+        // we sleep until the reader gives us a chunk, NULL once it closed
+        // the queue and we took the last one
+        decode_mode_chunk * chunk = (decode_mode_chunk*) mpmc_queue_pop(ctx->chunks, MPMC_FOREVER);
+        if (chunk == NULL)
+            break;
+        size_t pos = 0;
+        while (pos + RAWLOG_RECORD_HEADER_SIZE <= chunk->len){
+            size_t len = 0;
+            dnswire_meta meta;
+            rawlog_record_header(chunk->mem + pos, &len, &meta);     // checked by the reader
+            char * msg = chunk->mem + pos + RAWLOG_RECORD_HEADER_SIZE;
+            dnswire_msg wire;
+            if (dnswire_parse(msg, len, &wire) == 0)
+                scan_write_answer(tp, msg, len, &wire, &meta);
+            else
+                errors += 1;
+            records += 1;
+            pos += RAWLOG_RECORD_HEADER_SIZE + len;
+        }
+        free(chunk->mem);
+        free(chunk);
+    }
+    outwriter_release(tp->output);
+    __atomic_fetch_add(&(ctx->records), records, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(ctx->errors), errors, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int switch_decode_mode(struct scanner_input * si){
+    // '--decode': the main thread reads the raw log and cuts it in chunks
+    // of whole records, '--threads' threads decode them in parallel and
+    // the writer thread writes the output (in no particular order).
+    char header[RAWLOG_FILE_HEADER_SIZE];
+    uint32_t flags = 0;
+    if (fread(header, 1, sizeof(header), si->INPUT) != sizeof(header) ||
+        rawlog_check_file_header(header, &flags) != 0){
+        fprintf(stderr, "ERROR: The input is not a raw log of bulkDNS (--format=raw)\n");
+        return 1;
+    }
+    // the JSON records have the attempts if the scan had them
+    if (flags & RAWLOG_FLAG_ATTEMPTS)
+        si->retries = 1;
+    struct thread_param tp;
+    memset(&tp, 0, sizeof(struct thread_param));
+    tp.si = si;
+    if (scan_write_header(si) != 0)
+        return 1;
+    tp.output = scan_output_init(si);
+    decode_mode_ctx ctx;
+    memset(&ctx, 0, sizeof(decode_mode_ctx));
+    ctx.tp = &tp;
+    ctx.chunks = mpmc_queue_init(BULKDNS_DECODE_CHUNKS_PER_THREAD * si->threads);
+    if (tp.output == NULL || ctx.chunks == NULL)
+        return 1;
+    pthread_t * threads = bulkdns_malloc_or_abort(si->threads * sizeof(pthread_t));
+    for (unsigned int i=0; i<si->threads; ++i){
+        if (pthread_create(&threads[i], NULL, decode_mode_worker, (void*) &ctx) != 0){
+            fprintf(stderr, "ERROR: Can not create thread#%u\n", i);
+            return 2;
+        }
+    }
+    // a chunk has room for one more record after BULKDNS_DECODE_CHUNK_SIZE
+    size_t chunk_size = BULKDNS_DECODE_CHUNK_SIZE + RAWLOG_RECORD_HEADER_SIZE + RAWLOG_MAX_MESSAGE;
+    decode_mode_chunk * chunk = NULL;
+    int truncated = 0;
+    while (1){
+        if (chunk == NULL){
+            chunk = bulkdns_malloc_or_abort(sizeof(decode_mode_chunk));
+            chunk->mem = bulkdns_malloc_or_abort(chunk_size);
+            chunk->len = 0;
+        }
+        char * p = chunk->mem + chunk->len;
+        size_t len = 0;
+        dnswire_meta meta;
+        size_t got = fread(p, 1, RAWLOG_RECORD_HEADER_SIZE, si->INPUT);
+        if (got == 0)
+            break;
+        if (got != RAWLOG_RECORD_HEADER_SIZE || rawlog_record_header(p, &len, &meta) != 0 ||
+            fread(p + RAWLOG_RECORD_HEADER_SIZE, 1, len, si->INPUT) != len){
+            truncated = 1;
+            break;
+        }
+        chunk->len += RAWLOG_RECORD_HEADER_SIZE + len;
+        if (chunk->len < BULKDNS_DECODE_CHUNK_SIZE)
+            continue;
+        // we sleep while the decoders are behind
+        mpmc_queue_push(ctx.chunks, chunk, MPMC_FOREVER);
+        chunk = NULL;
+    }
+    if (chunk != NULL && chunk->len > 0){
+        mpmc_queue_push(ctx.chunks, chunk, MPMC_FOREVER);
+    }else if (chunk != NULL){
+        free(chunk->mem);
+        free(chunk);
+    }
+    // the decoders stop once they took the last chunk
+    mpmc_queue_close(ctx.chunks);
+    for (unsigned int i=0; i<si->threads; ++i)
+        pthread_join(threads[i], NULL);
+    outwriter_close(tp.output);
+    if (si->split != NULL)
+        outsplit_close(si->split);
+    if (truncated)
+        fprintf(stderr, "WARNING: The raw log is truncated, we stopped at the last complete answer\n");
+    if (si->stats){
+        fprintf(stderr, "decoded answers: %lu, could not be parsed: %lu\n", ctx.records, ctx.errors);
+        fprintf(stderr, "output: %lu bytes in %lu writev() calls, waits for a free buffer: %lu\n",
+                tp.output->bytes, tp.output->writes, tp.output->stalls);
+        if (si->split != NULL)
+            fprintf(stderr, "output files: %lu\n", si->split->parts);
+    }
+    outwriter_free(tp.output);
+    mpmc_queue_free(ctx.chunks);
+    free(threads);
+    if (si->INPUT != stdin)
+        fclose(si->INPUT);
+    if (si->ERROR != stderr)
+        fclose(si->ERROR);
+    if (si->OUTPUT != stdout && si->OUTPUT != NULL)
+        fclose(si->OUTPUT);
+    outsplit_free(si->split);
+    free(si->resolver);
+    free(si->bind_ip);
+    free(si->lua_file);
+    free(si);
+    return 0;
+}
+
 int initial_check_command_line(struct scanner_input * si, PARG_CMDLINE cmd){
     // the function returns -1 in case of error and 0 in case of success
     if (si->concurrency < 0 || si->concurrency == 0){
         fprintf(stderr, "Concurrency param must be greater than zero!\n");
         return -1;      // error
     }
+    if (si->threads == 0){
+        fprintf(stderr, "Threads param must be greater than zero!\n");
+        return -1;      // error
+    }
+    if (si->rate < 0 || si->resolver_rate < 0){
+        fprintf(stderr, "Rate must be a positive number of queries per second\n");
+        return -1;      // error
+    }
+    if (si->hedge < 0 || si->hedge >= 100){
+        fprintf(stderr, "Hedge percentile must be between 0 and 100\n");
+        return -1;      // error
+    }
+    if (si->hedge_budget == 0 || si->hedge_budget > 100){
+        fprintf(stderr, "Hedge budget must be between 1 and 100 percent\n");
+        return -1;      // error
+    }
+    if (si->resolver_policy == -1){
+        fprintf(stderr, "--resolver-policy accepts 'wrr' or 'least'\n");
+        return -1;      // error
+    }
+    if (si->retry_servfail == -1){
+        fprintf(stderr, "--retry-on accepts 'servfail', 'refused' or both\n");
+        return -1;      // error
+    }
+    if (si->retry_backoff == 0 || si->retry_backoff > BULKDNS_MAX_RETRY_BACKOFF_MS){
+        fprintf(stderr, "Retry backoff must be between 1 and %d milliseconds\n", BULKDNS_MAX_RETRY_BACKOFF_MS);
+        return -1;      // error
+    }
+    if (si->batch == 0 || si->batch > UDPBATCH_MAX_SIZE){
+        fprintf(stderr, "Batch param must be between 1 and %d\n", UDPBATCH_MAX_SIZE);
+        return -1;      // error
+    }
+    if (si->stateless && (si->retries > 0 || si->hedge > 0 || si->adaptive)){
+        fprintf(stderr, "--stateless keeps no state per query: it can not be used with --retries, --hedge or --adaptive\n");
+        return -1;      // error
+    }
+    if (si->sockets > 0 && !si->stateless && (si->concurrency + si->sockets - 1) / si->sockets > BULKDNS_MAX_SOCKET_QUERIES){
+        fprintf(stderr, "Too few sockets: each socket can carry at most %d concurrent requests\n", BULKDNS_MAX_SOCKET_QUERIES);
+        return -1;      // error
+    }
+    if (si->format == -1){
+        fprintf(stderr, "--format accepts 'json', 'tsv', 'csv' or 'raw'\n");
+        return -1;      // error
+    }
+    if ((si->format == ROWENC_FORMAT_JSON || si->format == ROWENC_FORMAT_RAW) && si->fields != NULL){
+        fprintf(stderr, "--fields needs --format=tsv or --format=csv\n");
+        return -1;      // error
+    }
+    if (si->decode && si->format == ROWENC_FORMAT_RAW){
+        fprintf(stderr, "--decode converts a raw log to 'json', 'tsv' or 'csv'\n");
+        return -1;      // error
+    }
+    if (si->format != ROWENC_FORMAT_JSON && si->lua_file != NULL){
+        fprintf(stderr, "--format can not be used with a Lua script (the script writes the output)\n");
+        return -1;      // error
+    }
+    if (si->pcap_file != NULL && (si->lua_file != NULL || si->decode || si->server_mode)){
+        fprintf(stderr, "--pcap captures the queries of a scan: it can not be used with Lua, --decode or --server-mode\n");
+        return -1;      // error
+    }
+    if (si->dnstap_dest != NULL && ((si->lua_file != NULL && !si->server_mode) || si->decode)){
+        fprintf(stderr, "--dnstap can not be used with a Lua scan or --decode\n");
+        return -1;      // error
+    }
+    if (si->compress == -1){
+        fprintf(stderr, "--compress accepts 'gzip' or 'zstd'\n");
+        return -1;      // error
+    }
+    if (si->compress == -2){
+        fprintf(stderr, "bulkDNS is compiled without zstd: use 'make WITH_ZSTD=1' for --compress=zstd\n");
+        return -1;      // error
+    }
+    if (si->compress != COMPRESS_NONE){
+        if (si->compress_level == 0)
+            si->compress_level = compress_default_level(si->compress);
+        if (compress_check_level(si->compress, si->compress_level) != 0){
+            fprintf(stderr, "Wrong --compress-level for this compression method\n");
+            return -1;      // error
+        }
+        if (si->compress_threads == 0 || si->compress_threads > BULKDNS_MAX_COMPRESS_THREADS){
+            fprintf(stderr, "--compress-threads must be between 1 and %d\n", BULKDNS_MAX_COMPRESS_THREADS);
+            return -1;      // error
+        }
+        if (si->lua_file != NULL){
+            fprintf(stderr, "--compress can not be used with a Lua script (the script writes the output)\n");
+            return -1;      // error
+        }
+    }
+    if (si->split_mode == -1){
+        fprintf(stderr, "--output-split accepts 'records:N' or 'bytes:N'\n");
+        return -1;      // error
+    }
+    if (si->output_shards == 0 || si->output_shards > OUTSPLIT_MAX_SHARDS){
+        fprintf(stderr, "--output-shards must be between 1 and %d\n", OUTSPLIT_MAX_SHARDS);
+        return -1;      // error
+    }
+    if ((si->split_mode != OUTSPLIT_NONE || si->output_shards > 1) &&
+        (si->output_file == NULL || si->lua_file != NULL || si->server_mode)){
+        fprintf(stderr, "--output-split and --output-shards need -o and can not be used with Lua or --server-mode\n");
+        return -1;      // error
+    }
+    if (si->dedup && si->dedup_bloom_mb < 0){
+        fprintf(stderr, "--dedup-bloom needs the size of the filter in MB (a positive number)\n");
+        return -1;      // error
+    }
+    if (si->format == ROWENC_FORMAT_TSV || si->format == ROWENC_FORMAT_CSV){
+        if (rowenc_init(&(si->rows), si->format, si->fields) != 0)
+            return -1;      // error
+    }
     // check if the port number is valid
     if (si->port < 0 || si->port > 65535){
         fprintf(stderr, "Wrong port number specified\n");
@@ -1641,12 +2988,35 @@ int initial_check_command_line(struct scanner_input * si, PARG_CMDLINE cmd){
         fprintf(stderr, "Wrong or not supported RR class specified\n");
         return -1;      // error
     }
-    // set the output file handle based on user-input
-    if (si->output_file != NULL){
+    // set the output file handle based on user-input. With '--output-split'
+    // or '--output-shards', the writer opens the files itself.
+    if (si->split_mode != OUTSPLIT_NONE || si->output_shards > 1){
+        si->split = outsplit_init(si->output_file, si->split_mode, si->split_limit, si->output_shards);
+        if (si->split == NULL){
+            fprintf(stderr, "Can not initialize the output files\n");
+            return -1;      // error
+        }
+        si->OUTPUT = NULL;
+    }else if (si->output_file != NULL){
         si->OUTPUT = fopen(si->output_file, "w");
+        if (si->OUTPUT == NULL){
+            perror("Error openning output file");
+            return -1;      // error
+        }
     }else{
         si->OUTPUT = stdout;
     }
+    if (si->format == ROWENC_FORMAT_RAW && si->OUTPUT != NULL && isatty(fileno(si->OUTPUT))){
+        fprintf(stderr, "--format=raw writes binary data: use -o to write it to a file\n");
+        return -1;      // error
+    }
+    if (si->pcap_file != NULL){
+        si->PCAP = fopen(si->pcap_file, "wb");
+        if (si->PCAP == NULL){
+            perror("Error openning pcap file");
+            return -1;      // error
+        }
+    }
     // set the output error handle based on user-input
     if (si->output_error != NULL){
         si->ERROR = fopen(si->output_error, "w");
@@ -1695,8 +3065,36 @@ PARG_CMDLINE create_command_line_arguments(){
         {.short_option=0, .long_option = "noedns", .has_param = NO_PARAM, .help="Do not support EDNS0 in queries (Default supports EDNS0)", .tag="noedns"},
         {.short_option='t', .long_option = "type", .has_param = HAS_PARAM, .help="Resource Record type (Default is 'A')", .tag="rr_type"},
         {.short_option='c', .long_option = "class", .has_param = HAS_PARAM, .help="RR Class (IN, CH). Default is 'IN'", .tag="rr_class"},
-        {.short_option='r', .long_option = "resolver", .has_param = HAS_PARAM, .help="Resolver IP address to send the query to (default 1.1.1.1)", .tag="resolver"},
+        {.short_option='r', .long_option = "resolver", .has_param = HAS_PARAM, .help="Resolvers to send the queries to: 'ip[:port][@weight],...' or a file with one per line (default 1.1.1.1)", .tag="resolver"},
+        {.short_option=0, .long_option = "resolver-policy", .has_param = HAS_PARAM, .help="How to spread the queries over the resolvers: 'wrr' (weighted round-robin, default) or 'least' (least outstanding)", .tag="resolver_policy"},
         {.short_option=0, .long_option = "concurrency", .has_param = HAS_PARAM, .help="How many concurrent requests should we send (default is 1000)", .tag="concurrency"},
+        {.short_option=0, .long_option = "batch", .has_param = HAS_PARAM, .help="Queries sent/received per sendmmsg()/recvmmsg() call on each socket (default is 1)", .tag="batch"},
+        {.short_option=0, .long_option = "sockets", .has_param = HAS_PARAM, .help="Send all the concurrent requests over this many UDP sockets (default is one socket per '--batch' requests)", .tag="sockets"},
+        {.short_option=0, .long_option = "format", .has_param = HAS_PARAM, .help="Output format: 'json' (default), 'tsv', 'csv' or 'raw' (binary log for '--decode')", .tag="format"},
+        {.short_option=0, .long_option = "fields", .has_param = HAS_PARAM, .help="Fields of the TSV/CSV rows (default is 'qname,qtype,rcode,answer.ttl,answer.rdata')", .tag="fields"},
+        {.short_option=0, .long_option = "decode", .has_param = NO_PARAM, .help="Convert a raw log of '--format=raw' (the input file) to '--format' with '--threads' threads", .tag="decode"},
+        {.short_option=0, .long_option = "pcap", .has_param = HAS_PARAM, .help="Also write the queries and the answers to this pcap file (with made-up IP/UDP headers)", .tag="pcap"},
+        {.short_option=0, .long_option = "dnstap", .has_param = HAS_PARAM, .help="Also write the queries and the answers as dnstap to this file or to 'unix:<path>' (a collector)", .tag="dnstap"},
+        {.short_option=0, .long_option = "compress", .has_param = HAS_PARAM, .help="Compress the output: 'gzip' or 'zstd' (if compiled with zstd)", .tag="compress"},
+        {.short_option=0, .long_option = "compress-level", .has_param = HAS_PARAM, .help="Level of '--compress' (default is 6 for gzip and 3 for zstd)", .tag="compress_level"},
+        {.short_option=0, .long_option = "compress-threads", .has_param = HAS_PARAM, .help="Threads which compress the output blocks (default is 2)", .tag="compress_threads"},
+        {.short_option=0, .long_option = "output-split", .has_param = HAS_PARAM, .help="Cut the output in numbered files of 'records:N' answers or 'bytes:N' bytes (N may end with K, M or G)", .tag="output_split"},
+        {.short_option=0, .long_option = "output-shards", .has_param = HAS_PARAM, .help="Write the output to this many files by the hash of the qname (at most 64)", .tag="output_shards"},
+        {.short_option=0, .long_option = "fast-json", .has_param = NO_PARAM, .help="Write the JSON output straight from the wire format (no sdns/jansson decoding)", .tag="fast_json"},
+        {.short_option=0, .long_option = "stateless", .has_param = NO_PARAM, .help="Keep no state per query: a sender thread sends and a receiver thread checks the DNS IDs (keyed hash)", .tag="stateless"},
+        {.short_option=0, .long_option = "dedup", .has_param = NO_PARAM, .help="Query each name of the input once (case-insensitive, with or without the trailing dot)", .tag="dedup"},
+        {.short_option=0, .long_option = "dedup-bloom", .has_param = HAS_PARAM, .help="Like '--dedup' with a Bloom filter of this many MB (a few unique names may be skipped)", .tag="dedup_bloom"},
+        {.short_option=0, .long_option = "shard-input", .has_param = NO_PARAM, .help="Each scan thread reads its own part of the input file and steals from the others when it's done (no reader thread)", .tag="shard_input"},
+        {.short_option=0, .long_option = "stats", .has_param = NO_PARAM, .help="Print scan statistics to stderr at the end of the scan", .tag="stats"},
+        {.short_option=0, .long_option = "retries", .has_param = HAS_PARAM, .help="How many times we retry a query without answer (default is 0)", .tag="retries"},
+        {.short_option=0, .long_option = "retry-backoff", .has_param = HAS_PARAM, .help="Backoff before the first retry in milliseconds, doubled for each retry (default is 200)", .tag="retry_backoff"},
+        {.short_option=0, .long_option = "retry-on", .has_param = HAS_PARAM, .help="Also retry these answers: 'servfail', 'refused' or 'servfail,refused'", .tag="retry_on"},
+        {.short_option=0, .long_option = "rate", .has_param = HAS_PARAM, .help="Maximum number of queries per second for the whole scan (default is no limit)", .tag="rate"},
+        {.short_option=0, .long_option = "resolver-rate", .has_param = HAS_PARAM, .help="Maximum number of queries per second sent to each resolver (default is no limit)", .tag="resolver_rate"},
+        {.short_option=0, .long_option = "hedge", .has_param = HAS_PARAM, .help="Send a duplicate to another resolver (needs two or more in '-r') when a query has no answer after this percentile of the RTT (e.g. 95)", .tag="hedge"},
+        {.short_option=0, .long_option = "hedge-budget", .has_param = HAS_PARAM, .help="Duplicates of '--hedge' add at most this percent of queries (default is 5)", .tag="hedge_budget"},
+        {.short_option=0, .long_option = "adaptive", .has_param = NO_PARAM, .help="Adapt the number of in-flight queries to loss and RTT, up to '--concurrency'", .tag="adaptive"},
+        {.short_option=0, .long_option = "threads", .has_param = HAS_PARAM, .help="Number of scan engine threads (default is the number of CPU cores)", .tag="threads"},
         {.short_option='p', .long_option = "port", .has_param = HAS_PARAM, .help="Resolver port number to send the query to (default 53)", .tag="port"},
         {.short_option='o', .long_option = "output", .has_param = HAS_PARAM, .help="Output file name (default is the terminal with stdout)", .tag="output"},
         {.short_option='e', .long_option = "error", .has_param = HAS_PARAM, .help="where to write the error (default is terminal with stderr)", .tag="error"},
@@ -1742,6 +3140,14 @@ void get_command_line(PARG_PARSED_ARGS pargs, struct scanner_input * si){
     si->set_nsid  = arg_is_tag_set(pargs, "set_nsid")?1:0;
     si->no_edns = arg_is_tag_set(pargs, "noedns")?1:0;
     si->resolver = arg_is_tag_set(pargs, "resolver")?strdup(arg_get_tag_value(pargs, "resolver")):strdup("1.1.1.1");
+    si->resolver_policy = RESOLVER_POLICY_WRR;
+    if (arg_is_tag_set(pargs, "resolver_policy")){
+        const char * policy = arg_get_tag_value(pargs, "resolver_policy");
+        if (strcasecmp(policy, "least") == 0)
+            si->resolver_policy = RESOLVER_POLICY_LEAST;
+        else if (strcasecmp(policy, "wrr") != 0)
+            si->resolver_policy = -1;   // we check it in initial_check_command_line()
+    }
     if (arg_is_tag_set(pargs, "port")){
         si->port = (unsigned int)atoi(arg_get_tag_value(pargs, "port"));
     }else{
@@ -1762,6 +3168,96 @@ void get_command_line(PARG_PARSED_ARGS pargs, struct scanner_input * si){
     }else{
         si->concurrency = 1000;
     }
+    if (arg_is_tag_set(pargs, "batch")){
+        si->batch = (unsigned int)atoi(arg_get_tag_value(pargs, "batch"));
+    }else{
+        si->batch = 1;
+    }
+    si->stateless = arg_is_tag_set(pargs, "stateless")?1:0;
+    si->decode = arg_is_tag_set(pargs, "decode")?1:0;
+    si->fast_json = arg_is_tag_set(pargs, "fast_json")?1:0;
+    si->format = ROWENC_FORMAT_JSON;
+    if (arg_is_tag_set(pargs, "format"))
+        si->format = rowenc_format(arg_get_tag_value(pargs, "format"));    // -1 is checked later
+    si->fields = (char*)(arg_is_tag_set(pargs, "fields")?arg_get_tag_value(pargs, "fields"):NULL);
+    si->pcap_file = (char*)(arg_is_tag_set(pargs, "pcap")?arg_get_tag_value(pargs, "pcap"):NULL);
+    si->dnstap_dest = arg_is_tag_set(pargs, "dnstap")?strdup(arg_get_tag_value(pargs, "dnstap")):NULL;
+    si->compress = COMPRESS_NONE;
+    if (arg_is_tag_set(pargs, "compress"))
+        si->compress = compress_method(arg_get_tag_value(pargs, "compress"));    // < 0 is checked later
+    si->compress_level = arg_is_tag_set(pargs, "compress_level")?atoi(arg_get_tag_value(pargs, "compress_level")):0;
+    if (arg_is_tag_set(pargs, "compress_threads")){
+        si->compress_threads = (unsigned int)atoi(arg_get_tag_value(pargs, "compress_threads"));
+    }else{
+        si->compress_threads = BULKDNS_COMPRESS_THREADS;
+    }
+    si->split_mode = OUTSPLIT_NONE;
+    si->split_limit = 0;
+    if (arg_is_tag_set(pargs, "output_split") &&
+        outsplit_parse(arg_get_tag_value(pargs, "output_split"), &(si->split_mode), &(si->split_limit)) != 0)
+        si->split_mode = -1;    // checked later
+    si->output_shards = arg_is_tag_set(pargs, "output_shards")?(unsigned int)atoi(arg_get_tag_value(pargs, "output_shards")):1;
+    si->split = NULL;
+    if (arg_is_tag_set(pargs, "sockets")){
+        si->sockets = (unsigned int)atoi(arg_get_tag_value(pargs, "sockets"));
+    }else{
+        si->sockets = 0;
+    }
+    si->stats = arg_is_tag_set(pargs, "stats")?1:0;
+    si->shard_input = arg_is_tag_set(pargs, "shard_input")?1:0;
+    si->dedup_bloom_mb = 0;
+    if (arg_is_tag_set(pargs, "dedup_bloom")){
+        // -1 (rejected later) unless it's a positive number and nothing else
+        const char * value = arg_get_tag_value(pargs, "dedup_bloom");
+        char * end = NULL;
+        errno = 0;
+        long int mb = strtol(value, &end, 10);
+        si->dedup_bloom_mb = (errno != 0 || end == value || *end != '\0' || mb <= 0 || mb > INT_MAX)?-1:(int)mb;
+    }
+    si->dedup = (arg_is_tag_set(pargs, "dedup") || arg_is_tag_set(pargs, "dedup_bloom"))?1:0;
+    if (arg_is_tag_set(pargs, "retries")){
+        si->retries = (unsigned int)atoi(arg_get_tag_value(pargs, "retries"));
+    }else{
+        si->retries = 0;
+    }
+    if (arg_is_tag_set(pargs, "retry_backoff")){
+        si->retry_backoff = (unsigned int)atoi(arg_get_tag_value(pargs, "retry_backoff"));
+    }else{
+        si->retry_backoff = 200;
+    }
+    if (arg_is_tag_set(pargs, "retry_on")){
+        char * retry_on = strdup(arg_get_tag_value(pargs, "retry_on"));
+        char * saveptr = NULL;
+        char * token = strtok_r(retry_on, ",", &saveptr);
+        while (token != NULL){
+            if (strcasecmp(token, "servfail") == 0){
+                si->retry_servfail = 1;
+            }else if (strcasecmp(token, "refused") == 0){
+                si->retry_refused = 1;
+            }else{
+                si->retry_servfail = -1;    // we check it in initial_check_command_line()
+                break;
+            }
+            token = strtok_r(NULL, ",", &saveptr);
+        }
+        free(retry_on);
+    }
+    si->rate = arg_is_tag_set(pargs, "rate")?atof(arg_get_tag_value(pargs, "rate")):0;
+    si->resolver_rate = arg_is_tag_set(pargs, "resolver_rate")?atof(arg_get_tag_value(pargs, "resolver_rate")):0;
+    si->adaptive = arg_is_tag_set(pargs, "adaptive")?1:0;
+    si->hedge = arg_is_tag_set(pargs, "hedge")?atof(arg_get_tag_value(pargs, "hedge")):0;
+    if (arg_is_tag_set(pargs, "hedge_budget")){
+        si->hedge_budget = (unsigned int)atoi(arg_get_tag_value(pargs, "hedge_budget"));
+    }else{
+        si->hedge_budget = 5;
+    }
+    if (arg_is_tag_set(pargs, "threads")){
+        si->threads = (unsigned int)atoi(arg_get_tag_value(pargs, "threads"));
+    }else{
+        // one epoll loop per online CPU core
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        si->threads = ncpu > 0?(unsigned int)ncpu:1;
+    }
     si->server_mode = arg_is_tag_set(pargs, "server_mode")?1:0;
     if (arg_is_tag_set(pargs, "lua_file")){
         si->lua_file = arg_get_tag_value(pargs, "lua_file") != NULL?strdup(arg_get_tag_value(pargs, "lua_file")):NULL;
@@ -0,0 +1,59 @@
+#include <siphash.h>
+
+#define SIPHASH_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3)   \
+    do{                                 \
+        v0 += v1; v1 = SIPHASH_ROTL(v1, 13); v1 ^= v0; v0 = SIPHASH_ROTL(v0, 32); \
+        v2 += v3; v3 = SIPHASH_ROTL(v3, 16); v3 ^= v2;                            \
+        v0 += v3; v3 = SIPHASH_ROTL(v3, 21); v3 ^= v0;                            \
+        v2 += v1; v1 = SIPHASH_ROTL(v1, 17); v1 ^= v2; v2 = SIPHASH_ROTL(v2, 32); \
+    }while (0)
+
+// reads 8 bytes as a little-endian integer
+static inline uint64_t siphash_load64(const uint8_t * p){
+    return ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+// hash 'len' bytes of 'data' with the SIPHASH_KEY_SIZE bytes of 'key'
+uint64_t siphash24(const uint8_t * key, const void * data, size_t len){
+    const uint8_t * in = (const uint8_t *)data;
+    uint64_t k0 = siphash_load64(key);
+    uint64_t k1 = siphash_load64(key + 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    const uint8_t * end = in + (len - (len % 8));
+    for (; in != end; in += 8){
+        uint64_t m = siphash_load64(in);
+        v3 ^= m;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    // the last block has the remaining bytes and the length in its top byte
+    uint64_t b = ((uint64_t)len) << 56;
+    switch (len % 8){
+        case 7: b |= ((uint64_t)in[6]) << 48;   // fall through
+        case 6: b |= ((uint64_t)in[5]) << 40;   // fall through
+        case 5: b |= ((uint64_t)in[4]) << 32;   // fall through
+        case 4: b |= ((uint64_t)in[3]) << 24;   // fall through
+        case 3: b |= ((uint64_t)in[2]) << 16;   // fall through
+        case 2: b |= ((uint64_t)in[1]) << 8;    // fall through
+        case 1: b |= ((uint64_t)in[0]); break;
+        case 0: break;
+    }
+    v3 ^= b;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <twheel.h>
+
+// Hierarchical timer wheel. Level 0 has one slot per tick, level 'l'
+// has one slot per 64^l ticks. A timer is stored in the lowest level
+// that can hold its distance to 'now'. When level 0 wraps, the next
+// slot of level 1 is cascaded (its timers are added again) and so on.
+// Adding and removing a timer is O(1).
+
+twheel_ctx * twheel_init(uint64_t now){
+    twheel_ctx * ctx = (twheel_ctx*) calloc(1, sizeof(twheel_ctx));
+    if (!ctx){
+        fprintf(stderr, "Can not initialize the timer wheel\n");
+        return NULL;
+    }
+    ctx->now = now;
+    return ctx;
+}
+
+static void twheel_link(twheel_ctx * ctx, twheel_timer * timer, int cascading){
+    uint64_t expires = timer->expires;
+    // while cascading, the slot of 'now' is about to be processed.
+    // Otherwise, a timer in the past fires with the next tick.
+    if (expires < ctx->now || (expires == ctx->now && !cascading))
+        expires = ctx->now + 1;
+    uint64_t delta = expires - ctx->now;
+    if (delta > TWHEEL_MAX_DELTA){
+        delta = TWHEEL_MAX_DELTA;
+        expires = ctx->now + delta;
+    }
+    timer->expires = expires;
+    int level = 0;
+    while (level < TWHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TWHEEL_BITS)))
+        level++;
+    int idx = (expires >> (level * TWHEEL_BITS)) & TWHEEL_MASK;
+    twheel_timer ** head = &(ctx->slots[level][idx]);
+    timer->slot = head;
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head)
+        (*head)->prev = timer;
+    *head = timer;
+}
+
+// add 'timer' to fire at 'expires'. If it's already pending, it's moved.
+void twheel_add(twheel_ctx * ctx, twheel_timer * timer, uint64_t expires){
+    if (timer->pending)
+        twheel_del(ctx, timer);
+    timer->expires = expires;
+    twheel_link(ctx, timer, 0);
+    timer->pending = 1;
+    ctx->count += 1;
+}
+
+// remove a pending timer. It's safe to call it for a timer which is not pending.
+void twheel_del(twheel_ctx * ctx, twheel_timer * timer){
+    if (!timer->pending)
+        return;
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *(timer->slot) = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->pending = 0;
+    ctx->count -= 1;
+}
+
+static void twheel_cascade(twheel_ctx * ctx, int level){
+    int idx = (ctx->now >> (level * TWHEEL_BITS)) & TWHEEL_MASK;
+    twheel_timer * tmp = ctx->slots[level][idx];
+    ctx->slots[level][idx] = NULL;
+    while (tmp != NULL){
+        twheel_timer * next = tmp->next;
+        twheel_link(ctx, tmp, 1);
+        tmp = next;
+    }
+}
+
+// move the wheel to 'now' and return the next expired timer (NULL once
+// there is none left): call it until it returns NULL. The timers of a tick
+// wait in 'expired' and are still pending until they are returned, so the
+// caller may add or delete any timer between two calls, even one which
+// expired with the same tick. A returned timer can be added again right away.
+twheel_timer * twheel_advance(twheel_ctx * ctx, uint64_t now){
+    while (ctx->expired == NULL && ctx->now < now){
+        if (ctx->count == 0){
+            // nothing to fire, jump to the end
+            ctx->now = now;
+            break;
+        }
+        ctx->now += 1;
+        // cascade the upper levels when the lower ones wrap (top level first)
+        for (int level = TWHEEL_LEVELS - 1; level > 0; --level){
+            uint64_t span_mask = (((uint64_t)1) << (level * TWHEEL_BITS)) - 1;
+            if ((ctx->now & span_mask) == 0)
+                twheel_cascade(ctx, level);
+        }
+        int idx = ctx->now & TWHEEL_MASK;
+        ctx->expired = ctx->slots[0][idx];
+        ctx->slots[0][idx] = NULL;
+        for (twheel_timer * tmp = ctx->expired; tmp != NULL; tmp = tmp->next)
+            tmp->slot = &(ctx->expired);
+    }
+    twheel_timer * timer = ctx->expired;
+    if (timer != NULL)
+        twheel_del(ctx, timer);
+    return timer;
+}
+
+// return the number of ticks we can wait before calling twheel_advance()
+// or TWHEEL_NO_TIMER if there is no pending timer. The value is exact
+// for timers in the next 64 ticks and a lower bound for the others.
+uint64_t twheel_next_expiry(twheel_ctx * ctx){
+    if (ctx->count == 0)
+        return TWHEEL_NO_TIMER;
+    for (uint64_t i=1; i <= TWHEEL_SLOTS; ++i){
+        uint64_t t = ctx->now + i;
+        if (ctx->slots[0][t & TWHEEL_MASK] != NULL)
+            return i;
+        if ((t & TWHEEL_MASK) == 0)
+            return i;       // next cascade
+    }
+    return TWHEEL_SLOTS;
+}
+
+void twheel_free(twheel_ctx * ctx){
+    free(ctx);
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <udpbatch.h>
+
+// A batch is a fixed array of messages that we send with one sendmmsg()
+// or fill with one recvmmsg(). A send batch points to the buffers of the
+// caller (msg_size is zero) and a receive batch owns 'size' buffers of
+// 'msg_size' bytes. Nothing is allocated after udpbatch_init(), so the
+// send/receive path does not touch the heap.
+
+udpbatch_ctx * udpbatch_init(unsigned int size, size_t msg_size){
+    if (size == 0 || size > UDPBATCH_MAX_SIZE)
+        return NULL;
+    udpbatch_ctx * ctx = (udpbatch_ctx*) calloc(1, sizeof(udpbatch_ctx));
+    if (!ctx){
+        fprintf(stderr, "Can not initialize the UDP batch\n");
+        return NULL;
+    }
+    ctx->size = size;
+    ctx->msg_size = msg_size;
+    ctx->mem = msg_size > 0?(char*) malloc(size * msg_size):NULL;
+    ctx->msgs = (struct mmsghdr*) calloc(size, sizeof(struct mmsghdr));
+    ctx->iov = (struct iovec*) calloc(size, sizeof(struct iovec));
+    ctx->addr = (struct sockaddr_in*) calloc(size, sizeof(struct sockaddr_in));
+    if ((msg_size > 0 && !ctx->mem) || !ctx->msgs || !ctx->iov || !ctx->addr){
+        fprintf(stderr, "Can not allocate memory for the UDP batch\n");
+        udpbatch_free(ctx);
+        return NULL;
+    }
+    for (unsigned int i=0; i<size; ++i){
+        ctx->iov[i].iov_base = ctx->mem != NULL?ctx->mem + (i * msg_size):NULL;
+        ctx->msgs[i].msg_hdr.msg_iov = &(ctx->iov[i]);
+        ctx->msgs[i].msg_hdr.msg_iovlen = 1;
+        ctx->msgs[i].msg_hdr.msg_name = &(ctx->addr[i]);
+    }
+    return ctx;
+}
+
+// adds 'len' bytes of 'buffer' as the next message of the batch.
+// The buffer is not copied and must stay valid until udpbatch_send().
+// return 0 on success and 1 if the batch is full
+int udpbatch_add(udpbatch_ctx * ctx, char * buffer, size_t len, struct sockaddr_in * to){
+    if (ctx->count == ctx->size)
+        return 1;
+    unsigned int i = ctx->count;
+    ctx->iov[i].iov_base = buffer;
+    ctx->iov[i].iov_len = len;
+    ctx->addr[i] = *to;
+    ctx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    ctx->count += 1;
+    return 0;
+}
+
+// sends all the messages of the batch on 'sockfd' and empties the batch.
+// returns the number of messages that left the socket. A message
+// that the kernel refuses is dropped, the rest are still sent.
+int udpbatch_send(udpbatch_ctx * ctx, int sockfd){
+    unsigned int done = 0;
+    int sent = 0;
+    while (done < ctx->count){
+        int res = sendmmsg(sockfd, ctx->msgs + done, ctx->count - done, 0);
+        ctx->calls += 1;
+        if (res == -1){
+            if (errno == EINTR)
+                continue;
+            // the first message of what is left failed, skip it
+            perror("Error in sendmmsg()");
+            done += 1;
+            continue;
+        }
+        done += res;
+        sent += res;
+    }
+    ctx->messages += sent;
+    ctx->count = 0;
+    return sent;
+}
+
+// receives as many messages as the batch can hold from 'sockfd'
+// without blocking. returns the number of messages in the batch
+// (zero if there was nothing to read) and -1 on error.
+int udpbatch_recv(udpbatch_ctx * ctx, int sockfd){
+    if (ctx->mem == NULL)
+        return -1;
+    for (unsigned int i=0; i<ctx->size; ++i){
+        ctx->iov[i].iov_len = ctx->msg_size;
+        ctx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        ctx->msgs[i].msg_hdr.msg_flags = 0;
+    }
+    ctx->count = 0;
+    int res;
+    do{
+        res = recvmmsg(sockfd, ctx->msgs, ctx->size, MSG_DONTWAIT, NULL);
+    }while (res == -1 && errno == EINTR);
+    ctx->calls += 1;
+    if (res == -1){
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        return -1;
+    }
+    ctx->count = res;
+    ctx->messages += res;
+    return res;
+}
+
+// returns the i-th received message and its length. If the message
+// did not fit in msg_size bytes, it is truncated and 'len' is zero.
+char * udpbatch_msg(udpbatch_ctx * ctx, unsigned int i, size_t * len){
+    if (i >= ctx->count)
+        return NULL;
+    if (ctx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        *len = 0;
+    else
+        *len = ctx->msgs[i].msg_len;
+    return ctx->mem + (i * ctx->msg_size);
+}
+
+// returns the source address of the i-th received message
+struct sockaddr_in * udpbatch_addr(udpbatch_ctx * ctx, unsigned int i){
+    if (i >= ctx->count)
+        return NULL;
+    return &(ctx->addr[i]);
+}
+
+void udpbatch_free(udpbatch_ctx * ctx){
+    if (ctx == NULL)
+        return;
+    free(ctx->mem);
+    free(ctx->msgs);
+    free(ctx->iov);
+    free(ctx->addr);
+    free(ctx);
+}